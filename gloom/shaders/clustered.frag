@@ -0,0 +1,48 @@
+#version 330 core
+
+in vec4 colorOut;
+in vec3 viewPosition;
+out vec4 color;
+
+// Filled every frame by ClusteredLighting, see clusteredLighting.hpp
+uniform samplerBuffer lightData;      // Two texels per light: view space position and radius, then radiance
+uniform usamplerBuffer clusterData;   // Offset and count of the light list of each cluster
+uniform usamplerBuffer lightIndices;  // Light lists of all the clusters, one after the other
+
+uniform uvec3 clusterGrid;
+uniform vec4 clusterParameters;       // Near plane, slices per log unit, tile width and height in pixels
+uniform vec3 ambientLight;
+
+void main()
+{
+    // The scene is made of boxes and flat tiles, so the face normal is all we need
+    vec3 normal = normalize(cross(dFdx(viewPosition), dFdy(viewPosition)));
+
+    // Find the cluster of the fragment, the slices are exponential in depth
+    float depth = -viewPosition.z;
+    float slice = max(log(depth / clusterParameters.x) * clusterParameters.y, 0.0);
+    uvec3 cluster = min(uvec3(vec3(gl_FragCoord.xy / clusterParameters.zw, slice)), clusterGrid - 1u);
+    int clusterIndex = int(cluster.x + clusterGrid.x * (cluster.y + clusterGrid.y * cluster.z));
+
+    // Only the lights which may reach the cluster are evaluated
+    uvec2 lightList = texelFetch(clusterData, clusterIndex).rg;
+
+    vec3 lighting = ambientLight;
+    for (uint i = 0u; i < lightList.y; i++)
+    {
+        int light = int(texelFetch(lightIndices, int(lightList.x + i)).r);
+        vec4 positionRadius = texelFetch(lightData, 2 * light);
+        vec3 radiance = texelFetch(lightData, 2 * light + 1).rgb;
+
+        vec3 toLight = positionRadius.xyz - viewPosition;
+        float distanceSquared = dot(toLight, toLight);
+
+        // Smooth falloff reaching zero at the radius of the light
+        float falloff = clamp(1.0 - distanceSquared / (positionRadius.w * positionRadius.w), 0.0, 1.0);
+        float diffuse = max(dot(normal, toLight * inversesqrt(max(distanceSquared, 1e-4))), 0.0);
+
+        lighting += radiance * diffuse * falloff * falloff;
+    }
+
+    color = vec4(colorOut.rgb * lighting, colorOut.a);
+}
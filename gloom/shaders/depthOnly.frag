@@ -0,0 +1,6 @@
+#version 330 core
+
+// The depth pre-pass only writes depth, the colour writes are masked
+void main()
+{
+}
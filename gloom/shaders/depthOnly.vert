@@ -0,0 +1,28 @@
+#version 330 core
+
+// Only the positions are read, the depth pre-pass binds a VAO without the other streams
+layout(location = 0) in vec4 position;
+
+// Same blocks and same operations as scene.vert, so that both produce exactly the same depth
+layout(std140) uniform FrameConstants
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+};
+
+layout(std140) uniform NodeTransforms
+{
+    mat4 modelMatrices[256];
+};
+
+uniform int drawID;
+
+// The opaque pass tests its depth for equality against the one written here
+invariant gl_Position;
+
+void main()
+{
+    vec4 worldPosition = modelMatrices[drawID] * position;
+    gl_Position = viewProjection * worldPosition;
+}
@@ -0,0 +1,20 @@
+#version 330 core
+
+in vec2 atlasCoordinates;
+in vec4 colorOut;
+
+// Views of the character baked by ImpostorRenderer, transparent around it
+uniform sampler2D atlasTexture;
+
+out vec4 color;
+
+void main()
+{
+    vec4 texel = texture(atlasTexture, atlasCoordinates);
+    if (texel.a < 0.5)
+    {
+        discard;
+    }
+
+    color = vec4(texel.rgb, 1.0) * colorOut;
+}
@@ -0,0 +1,51 @@
+#version 330 core
+
+// Feet position and heading, and tint of each impostor
+layout(location = 0) in vec4 instancePosition;
+layout(location = 1) in vec4 instanceColour;
+
+uniform mat4x4 viewProjection;
+uniform vec4 cameraRight;
+uniform vec4 cameraUp;
+uniform vec4 cameraPosition;
+
+// Bounding sphere of the character relative to its feet
+uniform vec4 bounds;
+
+// Views around the character, views above the horizon, highest elevation in radians,
+// and size of a cell relative to the bounding sphere, which leaves a margin around it
+uniform vec4 atlasLayout;
+
+out vec2 atlasCoordinates;
+out vec4 colorOut;
+
+const float pi = 3.14159265;
+
+void main()
+{
+    float heading = instancePosition.w;
+    vec3 centre = instancePosition.xyz + vec3(sin(heading) * bounds.z + cos(heading) * bounds.x,
+                                              bounds.y,
+                                              cos(heading) * bounds.z - sin(heading) * bounds.x);
+
+    // Direction of the camera in the frame of the character, which faces +z before its heading
+    vec3 toCamera = cameraPosition.xyz - centre;
+    float yaw = atan(toCamera.x, toCamera.z) - heading;
+    float elevation = atan(toCamera.y, length(toCamera.xz));
+
+    // Closest baked view
+    float yawCount = atlasLayout.x;
+    float elevationCount = atlasLayout.y;
+    float column = mod(floor(yaw / (2.0 * pi) * yawCount + 0.5), yawCount);
+    float row = clamp(floor(elevation / max(atlasLayout.z, 1e-3) * (elevationCount - 1.0) + 0.5), 0.0, elevationCount - 1.0);
+
+    // Triangle strip: (0, 0), (1, 0), (0, 1), (1, 1)
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    float extent = bounds.w * atlasLayout.w;
+    vec3 world = centre + (corner.x * 2.0 - 1.0) * extent * cameraRight.xyz
+                        + (corner.y * 2.0 - 1.0) * extent * cameraUp.xyz;
+
+    gl_Position = viewProjection * vec4(world, 1.0);
+    atlasCoordinates = (vec2(column, row) + corner) / vec2(yawCount, elevationCount);
+    colorOut = instanceColour;
+}
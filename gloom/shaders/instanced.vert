@@ -0,0 +1,18 @@
+#version 330 core
+
+layout(location = 0) in vec4 position;
+layout(location = 1) in vec4 colorIn;
+
+// Per-instance attributes, a mat4 takes the four locations 2 to 5
+layout(location = 2) in mat4 instanceModel;
+layout(location = 6) in vec4 instanceColour;
+
+out vec4 colorOut;
+uniform mat4x4 viewProjection;
+
+void main()
+{
+    gl_Position = viewProjection * instanceModel * position;
+
+    colorOut = colorIn * instanceColour;
+}
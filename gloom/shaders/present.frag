@@ -0,0 +1,18 @@
+#version 330 core
+
+// The resolved colour of the frame, the image lies in its lower left corner
+uniform sampler2D sourceTexture;
+
+// xy: texture coordinates per pixel of the target,
+// zw: texture coordinates of the centre of the last texel of the image
+uniform vec4 sourceMapping;
+
+out vec4 color;
+
+void main()
+{
+    // Stretched over the target with bilinear filtering, without reading past the image.
+    // When the sizes match, this lands on the texel centres and copies the image exactly.
+    vec2 coordinates = min(gl_FragCoord.xy * sourceMapping.xy, sourceMapping.zw);
+    color = vec4(texture(sourceTexture, coordinates).rgb, 1.0);
+}
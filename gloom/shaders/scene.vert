@@ -0,0 +1,37 @@
+#version 330 core
+
+layout(location = 0) in vec4 position;
+layout(location = 1) in vec4 colorIn;
+out vec4 colorOut;
+
+// Used by the lighting of clustered.frag
+out vec3 viewPosition;
+
+// Camera matrices, computed once per frame
+layout(std140) uniform FrameConstants
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+};
+
+// World matrices of the nodes drawn this frame, must match maxNodeTransforms
+layout(std140) uniform NodeTransforms
+{
+    mat4 modelMatrices[256];
+};
+
+// Index of the world matrix of the current draw in modelMatrices
+uniform int drawID;
+
+// Must match the depth written by depthOnly.vert in the pre-pass
+invariant gl_Position;
+
+void main()
+{
+    vec4 worldPosition = modelMatrices[drawID] * position;
+    gl_Position = viewProjection * worldPosition;
+    viewPosition = (view * worldPosition).xyz;
+
+    colorOut = colorIn;
+}
@@ -0,0 +1,39 @@
+#version 330 core
+
+// Generates the chessboard terrain without any vertex data. Every instance is one row of
+// tiles, and every 6 vertices of an instance are the two triangles of one tile.
+out vec4 colorOut;
+out vec3 viewPosition;
+
+layout(std140) uniform FrameConstants
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+};
+
+uniform mat4 modelMatrix;
+uniform float tileWidth;
+uniform vec4 tileColour1;
+uniform vec4 tileColour2;
+
+// Corners of the triangles of a tile, in the order used by generateChessboard
+const ivec2 corners[6] = ivec2[6](ivec2(0, 0), ivec2(1, 1), ivec2(1, 0),
+                                  ivec2(0, 0), ivec2(0, 1), ivec2(1, 1));
+
+void main()
+{
+    int x = gl_VertexID / 6;
+    int y = gl_InstanceID;
+    ivec2 corner = corners[gl_VertexID % 6];
+
+    // Tiles are centred on their integer coordinates, like those of generateChessboard
+    vec4 position = vec4((float(x + corner.x) - 0.5) * tileWidth, 0.0,
+                         (float(y + corner.y) - 0.5) * tileWidth, 1.0);
+
+    vec4 worldPosition = modelMatrix * position;
+    gl_Position = viewProjection * worldPosition;
+    viewPosition = (view * worldPosition).xyz;
+
+    colorOut = (((x ^ y) & 1) == 1) ? tileColour1 : tileColour2;
+}
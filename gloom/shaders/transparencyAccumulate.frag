@@ -0,0 +1,22 @@
+#version 330 core
+
+in vec4 colorOut;
+
+// Sum of the premultiplied colours, weighted. The alpha channel holds the revealage,
+// the product of (1 - alpha) of every fragment, through the separate alpha blend factors.
+layout(location = 0) out vec4 accumulation;
+
+// Sum of the weighted alphas
+layout(location = 1) out float weightSum;
+
+void main()
+{
+    float alpha = colorOut.a;
+
+    // Fragments closer to the camera weigh more, so that they dominate the average.
+    // The clamp keeps the 16 bit float targets from overflowing.
+    float weight = clamp(alpha * 3e3 * pow(1.0 - gl_FragCoord.z, 3.0), 1e-2, 3e3);
+
+    accumulation = vec4(colorOut.rgb * alpha * weight, alpha);
+    weightSum = alpha * weight;
+}
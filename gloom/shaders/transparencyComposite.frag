@@ -0,0 +1,25 @@
+#version 330 core
+
+uniform sampler2D accumulationTexture;
+uniform sampler2D weightTexture;
+
+// Blended over the opaque image with (1 - alpha, alpha), the alpha being the revealage
+out vec4 color;
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    vec4 accumulation = texelFetch(accumulationTexture, pixel, 0);
+
+    // Nothing translucent covers this pixel
+    float revealage = accumulation.a;
+    if (revealage >= 1.0)
+    {
+        discard;
+    }
+
+    float weightSum = texelFetch(weightTexture, pixel, 0).r;
+    vec3 averageColour = accumulation.rgb / max(weightSum, 1e-5);
+
+    color = vec4(averageColour, revealage);
+}
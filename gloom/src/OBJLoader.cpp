@@ -159,6 +159,10 @@ std::vector<Mesh> loadWavefront(std::string const srcFile, bool quiet)
 		throw std::runtime_error("Reading OBJ file failed. This is usually because the operating system can't find it. Check if the relative path (to your terminal's working directory) is correct.");
 	}
 
+	for(Mesh &mesh : meshes) {
+		mesh.computeBounds();
+	}
+
 	return meshes;
 }
 
@@ -0,0 +1,419 @@
+#include "clusteredLighting.hpp"
+#include "glStateCache.hpp"
+#include "debugLayer.hpp"
+#include "toolbox.hpp"
+#include "gloom/gloom.hpp"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CLUSTERED_LIGHTING_SSE 1
+#endif
+
+ClusteredLighting::ClusteredLighting(GpuResourceManager &resources, float nearPlane, float farPlane)
+    : resources(resources), nearPlane(nearPlane), farPlane(farPlane),
+      viewportWidth(windowWidth), viewportHeight(windowHeight), clusterLists(clusterCount * 2), sliceIndices(clusterGridZ)
+{
+    sliceScale = float(clusterGridZ) / std::log(farPlane / nearPlane);
+
+    createTextureBuffer(lightDataBuffer, GL_RGBA32F, "light data");
+    createTextureBuffer(clusterDataBuffer, GL_RG32UI, "cluster light lists");
+    createTextureBuffer(lightIndicesBuffer, GL_R32UI, "cluster light indices");
+}
+
+ClusteredLighting::~ClusteredLighting()
+{
+    releaseTextureBuffer(lightDataBuffer);
+    releaseTextureBuffer(clusterDataBuffer);
+    releaseTextureBuffer(lightIndicesBuffer);
+}
+
+void ClusteredLighting::createTextureBuffer(TextureBuffer &target, GLenum format, char const *label)
+{
+    GLStateCache &state = getGLStateCache();
+
+    // Buffer textures need storage, even before the first upload
+    target.capacity = 256;
+    glGenBuffers(1, &target.buffer);
+    state.bindBuffer(GL_TEXTURE_BUFFER, target.buffer);
+    glBufferData(GL_TEXTURE_BUFFER, target.capacity, nullptr, GL_STREAM_DRAW);
+    resources.recordAllocation(CATEGORY_STREAMING, target.capacity);
+
+    // The texture keeps pointing at the buffer when its storage is reallocated
+    glGenTextures(1, &target.texture);
+    state.bindTexture(0, GL_TEXTURE_BUFFER, target.texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, format, target.buffer);
+
+    setGLObjectLabel(GL_BUFFER, target.buffer, label);
+    setGLObjectLabel(GL_TEXTURE, target.texture, label);
+}
+
+void ClusteredLighting::releaseTextureBuffer(TextureBuffer &target)
+{
+    GLStateCache &state = getGLStateCache();
+
+    glDeleteTextures(1, &target.texture);
+    state.forgetTexture(target.texture);
+    glDeleteBuffers(1, &target.buffer);
+    state.forgetBuffer(target.buffer);
+
+    resources.recordRelease(CATEGORY_STREAMING, target.capacity);
+}
+
+void ClusteredLighting::upload(TextureBuffer &target, const void *data, GLsizeiptr size)
+{
+    getGLStateCache().bindBuffer(GL_TEXTURE_BUFFER, target.buffer);
+
+    // Grow by doubling, so that the light count can change without reallocating every frame
+    if (size > target.capacity)
+    {
+        GLsizeiptr capacity = target.capacity;
+        while (capacity < size)
+        {
+            capacity *= 2;
+        }
+        resources.recordAllocation(CATEGORY_STREAMING, capacity - target.capacity);
+        target.capacity = capacity;
+    }
+
+    // Orphan the storage the GPU may still be reading, then fill the new one
+    glBufferData(GL_TEXTURE_BUFFER, target.capacity, nullptr, GL_STREAM_DRAW);
+    if (size > 0)
+    {
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+    }
+}
+
+void ClusteredLighting::setupProgram(GLuint program)
+{
+    GLStateCache &state = getGLStateCache();
+    state.useProgram(program);
+
+    state.uniform1i(glGetUniformLocation(program, "lightData"), int(lightDataTextureUnit));
+    state.uniform1i(glGetUniformLocation(program, "clusterData"), int(clusterDataTextureUnit));
+    state.uniform1i(glGetUniformLocation(program, "lightIndices"), int(lightIndicesTextureUnit));
+
+    setClusterParameters(program);
+
+    glUniform3ui(glGetUniformLocation(program, "clusterGrid"), clusterGridX, clusterGridY, clusterGridZ);
+    glUniform3f(glGetUniformLocation(program, "ambientLight"), 0.08f, 0.08f, 0.12f);
+
+    if (std::find(programs.begin(), programs.end(), program) == programs.end())
+    {
+        programs.push_back(program);
+    }
+}
+
+void ClusteredLighting::setClusterParameters(GLuint program)
+{
+    GLStateCache &state = getGLStateCache();
+    state.useProgram(program);
+
+    // Near plane, slices per log unit, and size of a screen tile in pixels
+    glm::vec4 parameters(nearPlane, sliceScale,
+                         float(viewportWidth) / float(clusterGridX), float(viewportHeight) / float(clusterGridY));
+    state.uniform4f(glGetUniformLocation(program, "clusterParameters"), parameters);
+}
+
+void ClusteredLighting::setViewport(int width, int height)
+{
+    if (width == viewportWidth && height == viewportHeight)
+    {
+        return;
+    }
+
+    viewportWidth = width;
+    viewportHeight = height;
+    for (GLuint program : programs)
+    {
+        setClusterParameters(program);
+    }
+}
+
+void ClusteredLighting::bind()
+{
+    GLStateCache &state = getGLStateCache();
+    state.bindTexture(lightDataTextureUnit, GL_TEXTURE_BUFFER, lightDataBuffer.texture);
+    state.bindTexture(clusterDataTextureUnit, GL_TEXTURE_BUFFER, clusterDataBuffer.texture);
+    state.bindTexture(lightIndicesTextureUnit, GL_TEXTURE_BUFFER, lightIndicesBuffer.texture);
+}
+
+int ClusteredLighting::getDepthSlice(float depth) const
+{
+    int slice = int(std::log(depth / nearPlane) * sliceScale);
+    return std::min(std::max(slice, 0), int(clusterGridZ) - 1);
+}
+
+// Converts a coordinate in [-1, 1] to the index of the screen tile containing it
+static int getTile(float ndc, unsigned int tileCount)
+{
+    int tile = int((ndc * 0.5f + 0.5f) * float(tileCount));
+    return std::min(std::max(tile, 0), int(tileCount) - 1);
+}
+
+void ClusteredLighting::computeClusterRanges(glm::mat4 const &view, glm::mat4 const &projection,
+                                             unsigned int begin, unsigned int end)
+{
+    // The projection only scales x and y by these before the perspective divide
+    float scaleX = projection[0][0];
+    float scaleY = projection[1][1];
+
+    // Results for the four lights of an iteration, filled by the SSE or the scalar code
+    float depthMin[4], depthMax[4];
+    float minX[4], maxX[4], minY[4], maxY[4];
+    float viewX[4], viewY[4], viewZ[4];
+    int visible;
+
+#ifdef CLUSTERED_LIGHTING_SSE
+    __m128 m00 = _mm_set1_ps(view[0][0]), m01 = _mm_set1_ps(view[0][1]), m02 = _mm_set1_ps(view[0][2]);
+    __m128 m10 = _mm_set1_ps(view[1][0]), m11 = _mm_set1_ps(view[1][1]), m12 = _mm_set1_ps(view[1][2]);
+    __m128 m20 = _mm_set1_ps(view[2][0]), m21 = _mm_set1_ps(view[2][1]), m22 = _mm_set1_ps(view[2][2]);
+    __m128 m30 = _mm_set1_ps(view[3][0]), m31 = _mm_set1_ps(view[3][1]), m32 = _mm_set1_ps(view[3][2]);
+    __m128 nearPlanes = _mm_set1_ps(nearPlane);
+    __m128 farPlanes = _mm_set1_ps(farPlane);
+    __m128 scalesX = _mm_set1_ps(scaleX);
+    __m128 scalesY = _mm_set1_ps(scaleY);
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 minusOne = _mm_set1_ps(-1.0f);
+#endif
+
+    // Four lights at a time, the arrays are padded
+    for (unsigned int first = begin * 4; first < end * 4; first += 4)
+    {
+#ifdef CLUSTERED_LIGHTING_SSE
+        __m128 x = _mm_loadu_ps(&positionsX[first]);
+        __m128 y = _mm_loadu_ps(&positionsY[first]);
+        __m128 z = _mm_loadu_ps(&positionsZ[first]);
+        __m128 r = _mm_loadu_ps(&radii[first]);
+
+        // Transform to view space
+        __m128 vx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, x), _mm_mul_ps(m10, y)), _mm_add_ps(_mm_mul_ps(m20, z), m30));
+        __m128 vy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m01, x), _mm_mul_ps(m11, y)), _mm_add_ps(_mm_mul_ps(m21, z), m31));
+        __m128 vz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m02, x), _mm_mul_ps(m12, y)), _mm_add_ps(_mm_mul_ps(m22, z), m32));
+
+        // The camera looks down -z, clip the depth range of the sphere to the frustum
+        __m128 depth = _mm_sub_ps(_mm_setzero_ps(), vz);
+        __m128 nearDepth = _mm_max_ps(_mm_sub_ps(depth, r), nearPlanes);
+        __m128 farDepth = _mm_min_ps(_mm_add_ps(depth, r), farPlanes);
+        __m128 inFrustum = _mm_cmplt_ps(nearDepth, farDepth);
+
+        // x / depth is monotonic in depth, so the extremes of the bounding box of the sphere
+        // are reached on the nearest or the farthest depth
+        __m128 inverseNear = _mm_div_ps(one, nearDepth);
+        __m128 inverseFar = _mm_div_ps(one, farDepth);
+        __m128 left = _mm_sub_ps(vx, r), right = _mm_add_ps(vx, r);
+        __m128 bottom = _mm_sub_ps(vy, r), top = _mm_add_ps(vy, r);
+
+        __m128 ndcMinX = _mm_mul_ps(_mm_min_ps(_mm_mul_ps(left, inverseNear), _mm_mul_ps(left, inverseFar)), scalesX);
+        __m128 ndcMaxX = _mm_mul_ps(_mm_max_ps(_mm_mul_ps(right, inverseNear), _mm_mul_ps(right, inverseFar)), scalesX);
+        __m128 ndcMinY = _mm_mul_ps(_mm_min_ps(_mm_mul_ps(bottom, inverseNear), _mm_mul_ps(bottom, inverseFar)), scalesY);
+        __m128 ndcMaxY = _mm_mul_ps(_mm_max_ps(_mm_mul_ps(top, inverseNear), _mm_mul_ps(top, inverseFar)), scalesY);
+
+        // Reject the lights entirely off screen
+        inFrustum = _mm_and_ps(inFrustum, _mm_and_ps(_mm_cmpge_ps(ndcMaxX, minusOne), _mm_cmple_ps(ndcMinX, one)));
+        inFrustum = _mm_and_ps(inFrustum, _mm_and_ps(_mm_cmpge_ps(ndcMaxY, minusOne), _mm_cmple_ps(ndcMinY, one)));
+        visible = _mm_movemask_ps(inFrustum);
+
+        _mm_storeu_ps(depthMin, nearDepth);
+        _mm_storeu_ps(depthMax, farDepth);
+        _mm_storeu_ps(minX, ndcMinX);
+        _mm_storeu_ps(maxX, ndcMaxX);
+        _mm_storeu_ps(minY, ndcMinY);
+        _mm_storeu_ps(maxY, ndcMaxY);
+        _mm_storeu_ps(viewX, vx);
+        _mm_storeu_ps(viewY, vy);
+        _mm_storeu_ps(viewZ, vz);
+#else
+        visible = 0;
+        for (unsigned int lane = 0; lane < 4; lane++)
+        {
+            unsigned int i = first + lane;
+            float r = radii[i];
+            glm::vec4 position = view * glm::vec4(positionsX[i], positionsY[i], positionsZ[i], 1.0f);
+            viewX[lane] = position.x;
+            viewY[lane] = position.y;
+            viewZ[lane] = position.z;
+
+            depthMin[lane] = std::max(-position.z - r, nearPlane);
+            depthMax[lane] = std::min(-position.z + r, farPlane);
+
+            float left = position.x - r, right = position.x + r;
+            float bottom = position.y - r, top = position.y + r;
+            minX[lane] = std::min(left / depthMin[lane], left / depthMax[lane]) * scaleX;
+            maxX[lane] = std::max(right / depthMin[lane], right / depthMax[lane]) * scaleX;
+            minY[lane] = std::min(bottom / depthMin[lane], bottom / depthMax[lane]) * scaleY;
+            maxY[lane] = std::max(top / depthMin[lane], top / depthMax[lane]) * scaleY;
+
+            bool inFrustum = depthMin[lane] < depthMax[lane] &&
+                             maxX[lane] >= -1.0f && minX[lane] <= 1.0f &&
+                             maxY[lane] >= -1.0f && minY[lane] <= 1.0f;
+            visible |= inFrustum ? (1 << lane) : 0;
+        }
+#endif
+
+        // The slices are logarithmic, which is left to the scalar code
+        for (unsigned int lane = 0; lane < 4 && first + lane < lights.size(); lane++)
+        {
+            unsigned int i = first + lane;
+            ClusterRange &range = ranges[i];
+            viewPositions[i] = glm::vec4(viewX[lane], viewY[lane], viewZ[lane], radii[i]);
+
+            if ((visible & (1 << lane)) == 0)
+            {
+                range.minZ = 1;
+                range.maxZ = 0;
+                continue;
+            }
+
+            range.minX = getTile(minX[lane], clusterGridX);
+            range.maxX = getTile(maxX[lane], clusterGridX);
+            range.minY = getTile(minY[lane], clusterGridY);
+            range.maxY = getTile(maxY[lane], clusterGridY);
+            range.minZ = getDepthSlice(depthMin[lane]);
+            range.maxZ = getDepthSlice(depthMax[lane]);
+        }
+    }
+}
+
+void ClusteredLighting::fillSlice(unsigned int slice)
+{
+    const unsigned int tileCount = clusterGridX * clusterGridY;
+    uint32_t *lists = &clusterLists[slice * tileCount * 2];
+    std::vector<uint32_t> &indices = sliceIndices[slice];
+
+    // Count the lights of each cluster
+    uint32_t counts[tileCount] = {};
+    for (ClusterRange const &range : visibleRanges)
+    {
+        if (int(slice) < range.minZ || int(slice) > range.maxZ)
+        {
+            continue;
+        }
+        for (int y = range.minY; y <= range.maxY; y++)
+        {
+            for (int x = range.minX; x <= range.maxX; x++)
+            {
+                counts[y * clusterGridX + x]++;
+            }
+        }
+    }
+
+    // Give each cluster a contiguous part of the list of the slice
+    uint32_t cursors[tileCount];
+    uint32_t offset = 0;
+    for (unsigned int tile = 0; tile < tileCount; tile++)
+    {
+        lists[tile * 2] = offset;
+        lists[tile * 2 + 1] = counts[tile];
+        cursors[tile] = offset;
+        offset += counts[tile];
+    }
+
+    indices.resize(offset);
+    for (size_t light = 0; light < visibleRanges.size(); light++)
+    {
+        ClusterRange const &range = visibleRanges[light];
+        if (int(slice) < range.minZ || int(slice) > range.maxZ)
+        {
+            continue;
+        }
+        for (int y = range.minY; y <= range.maxY; y++)
+        {
+            for (int x = range.minX; x <= range.maxX; x++)
+            {
+                indices[cursors[y * clusterGridX + x]++] = uint32_t(light);
+            }
+        }
+    }
+}
+
+void ClusteredLighting::update(FrameConstants const &frame, ThreadPool &threadPool)
+{
+    // Copy the positions into padded structures of arrays, which the SSE code loads directly
+    size_t lightCount = lights.size();
+    size_t paddedCount = (lightCount + 3) & ~size_t(3);
+    positionsX.resize(paddedCount, 0.0f);
+    positionsY.resize(paddedCount, 0.0f);
+    positionsZ.resize(paddedCount, 0.0f);
+    radii.resize(paddedCount, 0.0f);
+    for (size_t i = 0; i < lightCount; i++)
+    {
+        positionsX[i] = lights[i].position.x;
+        positionsY[i] = lights[i].position.y;
+        positionsZ[i] = lights[i].position.z;
+        radii[i] = lights[i].radius;
+    }
+
+    viewPositions.resize(lightCount);
+    ranges.resize(lightCount);
+
+    threadPool.parallelFor(unsigned(paddedCount / 4), [&](unsigned int begin, unsigned int end, unsigned int)
+    {
+        computeClusterRanges(frame.view, frame.projection, begin, end);
+    }, 64);
+
+    // Keep the visible lights only, in their original order
+    visibleLightData.clear();
+    visibleRanges.clear();
+    for (size_t i = 0; i < lightCount; i++)
+    {
+        if (ranges[i].minZ > ranges[i].maxZ)
+        {
+            continue;
+        }
+        visibleLightData.push_back(viewPositions[i]);
+        visibleLightData.push_back(glm::vec4(lights[i].colour * lights[i].intensity, 0.0f));
+        visibleRanges.push_back(ranges[i]);
+    }
+
+    // Each thread fills whole slices, so the clusters are never shared between threads
+    threadPool.parallelFor(clusterGridZ, [&](unsigned int begin, unsigned int end, unsigned int)
+    {
+        for (unsigned int slice = begin; slice < end; slice++)
+        {
+            fillSlice(slice);
+        }
+    }, 1);
+
+    // Put the lists of all the slices one after the other
+    const unsigned int tileCount = clusterGridX * clusterGridY;
+    stats = ClusteredLightingStats();
+    stats.visibleLights = unsigned(visibleRanges.size());
+    lightIndices.clear();
+    for (unsigned int slice = 0; slice < clusterGridZ; slice++)
+    {
+        uint32_t base = uint32_t(lightIndices.size());
+        uint32_t *lists = &clusterLists[slice * tileCount * 2];
+        for (unsigned int tile = 0; tile < tileCount; tile++)
+        {
+            lists[tile * 2] += base;
+            stats.busiestCluster = std::max(stats.busiestCluster, unsigned(lists[tile * 2 + 1]));
+        }
+        lightIndices.insert(lightIndices.end(), sliceIndices[slice].begin(), sliceIndices[slice].end());
+    }
+    stats.lightReferences = unsigned(lightIndices.size());
+
+    upload(lightDataBuffer, visibleLightData.data(), GLsizeiptr(visibleLightData.size() * sizeof(glm::vec4)));
+    upload(clusterDataBuffer, clusterLists.data(), GLsizeiptr(clusterLists.size() * sizeof(uint32_t)));
+    upload(lightIndicesBuffer, lightIndices.data(), GLsizeiptr(lightIndices.size() * sizeof(uint32_t)));
+}
+
+std::vector<PointLight> scatterTorches(unsigned int count, glm::vec3 minCorner, glm::vec3 maxCorner)
+{
+    std::vector<PointLight> torches(count);
+    glm::vec3 extent = maxCorner - minCorner;
+
+    for (PointLight &torch : torches)
+    {
+        torch.position = minCorner + extent * glm::vec3(randomUniformFloat(), randomUniformFloat(), randomUniformFloat());
+        torch.radius = 2.0f + 2.0f * randomUniformFloat();
+
+        // From deep orange to pale yellow
+        float warmth = randomUniformFloat();
+        torch.colour = glm::vec3(1.0f, 0.45f + 0.35f * warmth, 0.1f + 0.2f * warmth);
+        torch.intensity = 0.6f + 0.4f * randomUniformFloat();
+    }
+
+    return torches;
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/vec3.hpp>
+#include <cstdint>
+#include <vector>
+#include "gpuResources.hpp"
+#include "threadPool.hpp"
+#include "frameConstants.hpp"
+
+// Size of the cluster grid: screen tiles along x and y, depth slices along z.
+// The slices grow exponentially with the distance, like the perspective does.
+const unsigned int clusterGridX = 16;
+const unsigned int clusterGridY = 16;
+const unsigned int clusterGridZ = 24;
+const unsigned int clusterCount = clusterGridX * clusterGridY * clusterGridZ;
+
+// Texture units of the buffers read by clustered.frag
+const GLuint lightDataTextureUnit = 2;
+const GLuint clusterDataTextureUnit = 3;
+const GLuint lightIndicesTextureUnit = 4;
+
+struct PointLight {
+    // In world space
+    glm::vec3 position;
+
+    // The light has no effect beyond this distance
+    float radius;
+
+    glm::vec3 colour;
+    float intensity;
+};
+
+// Counters of the last update
+struct ClusteredLightingStats {
+    // Lights overlapping the view frustum
+    unsigned int visibleLights = 0;
+
+    // Sum of the light counts of all clusters
+    unsigned int lightReferences = 0;
+
+    // Largest light count of a single cluster
+    unsigned int busiestCluster = 0;
+};
+
+// Clustered forward shading (Olsson et al., 2012).
+//
+// The view frustum is split into a grid of clusters (froxels). Every frame, the lights are
+// binned into the clusters they overlap on the CPU, and the light list of each cluster is
+// uploaded to texture buffers. A fragment then only loops over the lights of its own
+// cluster, so the shading cost depends on how many lights are nearby rather than on the
+// total number of lights.
+//
+// The binning runs in two parallel phases: the screen and depth range of every light is
+// computed four lights at a time with SSE, then each thread fills the lists of a few
+// depth slices, so no two threads ever write the same cluster.
+class ClusteredLighting {
+public:
+    // The planes must match the projection used for the frames passed to update()
+    ClusteredLighting(GpuResourceManager &resources, float nearPlane, float farPlane);
+    ~ClusteredLighting();
+
+    // The lights of the scene, may be changed between frames
+    std::vector<PointLight> & getLights() { return lights; }
+
+    // Sets the uniforms of a program using clustered.frag, which do not change between frames
+    void setupProgram(GLuint program);
+
+    // Size in pixels of the viewport the scene is rendered to, the clusters divide it into
+    // tiles. Updates the programs set up so far when it changes.
+    void setViewport(int width, int height);
+
+    // Bins the lights into the clusters of the view of frame and uploads the light lists.
+    // Expects a symmetric perspective projection.
+    void update(FrameConstants const &frame, ThreadPool &threadPool);
+
+    // Binds the texture buffers to the units read by clustered.frag
+    void bind();
+
+    ClusteredLightingStats const & getStats() const { return stats; }
+
+private:
+    ClusteredLighting(ClusteredLighting const &) = delete;
+    ClusteredLighting & operator =(ClusteredLighting const &) = delete;
+
+    // Clusters overlapped by a light, inclusive bounds. Empty when minZ > maxZ.
+    struct ClusterRange {
+        int minX, maxX;
+        int minY, maxY;
+        int minZ, maxZ;
+    };
+
+    // A buffer object read through a buffer texture, orphaned on every upload
+    struct TextureBuffer {
+        GLuint buffer = 0;
+        GLuint texture = 0;
+        GLsizeiptr capacity = 0;
+    };
+
+    void createTextureBuffer(TextureBuffer &target, GLenum format, char const *label);
+    void releaseTextureBuffer(TextureBuffer &target);
+    void upload(TextureBuffer &target, const void *data, GLsizeiptr size);
+
+    // First phase: view space position and cluster range of the lights of [begin, end)
+    void computeClusterRanges(glm::mat4 const &view, glm::mat4 const &projection,
+                              unsigned int begin, unsigned int end);
+
+    // Second phase: light lists of the clusters of one depth slice
+    void fillSlice(unsigned int slice);
+
+    int getDepthSlice(float depth) const;
+
+    // Sets the near plane, slice scale and tile size uniform of a program
+    void setClusterParameters(GLuint program);
+
+    GpuResourceManager &resources;
+    float nearPlane;
+    float farPlane;
+
+    // Number of slices per unit of log(depth / nearPlane)
+    float sliceScale;
+
+    int viewportWidth;
+    int viewportHeight;
+
+    // Programs using the clusters, their tile size follows the viewport
+    std::vector<GLuint> programs;
+
+    std::vector<PointLight> lights;
+
+    // Positions and radii of the lights as structures of arrays, padded to a multiple of 4
+    std::vector<float> positionsX;
+    std::vector<float> positionsY;
+    std::vector<float> positionsZ;
+    std::vector<float> radii;
+
+    // Results of the first phase, one for each light
+    std::vector<glm::vec4> viewPositions;
+    std::vector<ClusterRange> ranges;
+
+    // Visible lights, as uploaded: two texels each, view space position and radius, then radiance
+    std::vector<glm::vec4> visibleLightData;
+    std::vector<ClusterRange> visibleRanges;
+
+    // Offset and count of the light list of each cluster. The offsets are relative to
+    // the list of the slice until all the slices are merged.
+    std::vector<uint32_t> clusterLists;
+
+    // Light lists of each slice, then of all the clusters one after the other
+    std::vector<std::vector<uint32_t>> sliceIndices;
+    std::vector<uint32_t> lightIndices;
+
+    TextureBuffer lightDataBuffer;
+    TextureBuffer clusterDataBuffer;
+    TextureBuffer lightIndicesBuffer;
+
+    ClusteredLightingStats stats;
+};
+
+// Scatters count torches with random positions, sizes and warm colours in the box
+// between minCorner and maxCorner
+std::vector<PointLight> scatterTorches(unsigned int count, glm::vec3 minCorner, glm::vec3 maxCorner);
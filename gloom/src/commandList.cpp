@@ -0,0 +1,143 @@
+#include "commandList.hpp"
+#include "frameConstants.hpp"
+#include "glStateCache.hpp"
+#include <algorithm>
+
+CommandList::CommandList(GpuResourceManager &resources, SceneNode *root, GLuint program, GLint drawIDLocation)
+    : resources(resources), root(root), program(program), drawIDLocation(drawIDLocation)
+{
+}
+
+void CommandList::collectNodes(SceneNode *node, glm::mat4 const &parentTransformation)
+{
+    node->currentTransformationMatrix = parentTransformation * computeLocalTransformation(node);
+
+    if (node->VAOIndexCount > 0)
+    {
+        drawableNodes.push_back(node);
+    }
+
+    for (SceneNode *child : node->children)
+    {
+        collectNodes(child, node->currentTransformationMatrix);
+    }
+}
+
+void CommandList::record()
+{
+    glm::mat4 parentTransformation = (root->parent != nullptr) ? root->parent->currentTransformationMatrix : glm::mat4();
+
+    drawableNodes.clear();
+    collectNodes(root, parentTransformation);
+
+    // Group the draws by material and mesh, so that consecutive draws share their state
+    std::stable_sort(drawableNodes.begin(), drawableNodes.end(), [](SceneNode *a, SceneNode *b) {
+        if (a->material != b->material)
+        {
+            return a->material < b->material;
+        }
+        return a->mesh < b->mesh;
+    });
+
+    // Upload the world matrices, rounded up to whole windows as each window is bound in full
+    size_t windowCount = std::max<size_t>((drawableNodes.size() + maxNodeTransforms - 1) / maxNodeTransforms, 1);
+    std::vector<glm::mat4> matrices(windowCount * maxNodeTransforms);
+    for (size_t i = 0; i < drawableNodes.size(); i++)
+    {
+        matrices[i] = drawableNodes[i]->currentTransformationMatrix;
+    }
+    transforms = GpuBuffer(&resources, CATEGORY_UNIFORM_DATA, GL_UNIFORM_BUFFER,
+                           GLsizeiptr(matrices.size() * sizeof(glm::mat4)), matrices.data(), GL_STATIC_DRAW);
+
+    // Emit the bytecode, only changing the state which differs from the previous draw
+    code.clear();
+    meshes.clear();
+
+    code.push_back(OP_USE_PROGRAM);
+    code.push_back(program);
+
+    GpuMesh *currentMesh = nullptr;
+    int currentVao = -1;
+    uint32_t currentWindow = ~0u;
+
+    for (size_t i = 0; i < drawableNodes.size(); i++)
+    {
+        SceneNode *node = drawableNodes[i];
+
+        if (node->mesh != nullptr && node->mesh != currentMesh)
+        {
+            code.push_back(OP_BIND_MESH);
+            code.push_back(uint32_t(meshes.size()));
+            meshes.push_back(node->mesh);
+            currentMesh = node->mesh;
+            currentVao = -1;
+        }
+        else if (node->mesh == nullptr && node->vertexArrayObjectID != currentVao)
+        {
+            code.push_back(OP_BIND_VAO);
+            code.push_back(uint32_t(node->vertexArrayObjectID));
+            currentVao = node->vertexArrayObjectID;
+            currentMesh = nullptr;
+        }
+
+        uint32_t window = uint32_t(i / maxNodeTransforms);
+        if (window != currentWindow)
+        {
+            code.push_back(OP_BIND_TRANSFORMS);
+            code.push_back(window);
+            currentWindow = window;
+        }
+
+        code.push_back(OP_SET_DRAW_ID);
+        code.push_back(uint32_t(i % maxNodeTransforms));
+        code.push_back(OP_DRAW);
+        code.push_back(node->VAOIndexCount);
+    }
+
+    code.push_back(OP_END);
+
+    recorded = true;
+    recordedRevision = root->revision;
+    stats.recordings++;
+}
+
+void CommandList::execute()
+{
+    if (!isUpToDate())
+    {
+        record();
+    }
+
+    GLStateCache &state = getGLStateCache();
+    stats.replays++;
+
+    const uint32_t *instruction = code.data();
+    for (;;)
+    {
+        switch (*instruction++)
+        {
+        case OP_USE_PROGRAM:
+            state.useProgram(*instruction++);
+            break;
+        case OP_BIND_MESH:
+            state.bindVertexArray(meshes[*instruction++]->use());
+            break;
+        case OP_BIND_VAO:
+            state.bindVertexArray(*instruction++);
+            break;
+        case OP_BIND_TRANSFORMS:
+            state.bindBufferRange(GL_UNIFORM_BUFFER, nodeTransformsBinding, transforms.get(),
+                                  GLintptr(*instruction++) * nodeTransformWindowBytes, nodeTransformWindowBytes);
+            break;
+        case OP_SET_DRAW_ID:
+            state.uniform1i(drawIDLocation, GLint(*instruction++));
+            break;
+        case OP_DRAW:
+            glDrawElements(GL_TRIANGLES, GLsizei(*instruction++), GL_UNSIGNED_INT, 0);
+            stats.drawCalls++;
+            break;
+        default:
+            return;
+        }
+    }
+}
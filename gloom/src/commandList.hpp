@@ -0,0 +1,80 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <vector>
+#include "sceneGraph.hpp"
+#include "gpuResources.hpp"
+
+// Counters of a command list, since it was created
+struct CommandListStats {
+    unsigned int recordings = 0;
+    unsigned int replays = 0;
+    unsigned int drawCalls = 0;
+};
+
+// A retained list of the draw calls of a static subtree of the scene graph.
+//
+// The subtree is walked once and its draws are recorded into a compact bytecode, together
+// with a uniform buffer holding the world matrices of its nodes. Each frame the bytecode is
+// replayed without touching the scene graph. The list is recorded again automatically when
+// the revision of the subtree root changes, that is when any node of the subtree is changed
+// through the setters of sceneGraph.hpp.
+//
+// The nodes of the subtree, as well as their ancestors, must not move on their own:
+// the world matrices are only computed when the list is recorded.
+// Draws are expected to use a program reading the FrameConstants and NodeTransforms blocks
+// of frameConstants.hpp, like scene.vert.
+class CommandList {
+public:
+    CommandList(GpuResourceManager &resources, SceneNode *root, GLuint program, GLint drawIDLocation);
+
+    // Whether the recorded commands still match the subtree
+    bool isUpToDate() const { return recorded && root->revision == recordedRevision; }
+
+    // Walks the subtree, updates the world matrices of its nodes and records their draws
+    void record();
+
+    // Replays the recorded draws, recording them first if the subtree changed
+    void execute();
+
+    CommandListStats const & getStats() const { return stats; }
+
+private:
+    CommandList(CommandList const &) = delete;
+    CommandList & operator =(CommandList const &) = delete;
+
+    // Each opcode is followed by its operands
+    enum Opcode : uint32_t {
+        OP_USE_PROGRAM = 0,     // program
+        OP_BIND_MESH,           // index into meshes
+        OP_BIND_VAO,            // VAO name, for nodes without a GpuMesh
+        OP_BIND_TRANSFORMS,     // window of maxNodeTransforms matrices
+        OP_SET_DRAW_ID,         // index of the matrix within the window
+        OP_DRAW,                // index count
+        OP_END
+    };
+
+    void collectNodes(SceneNode *node, glm::mat4 const &parentTransformation);
+
+    GpuResourceManager &resources;
+    SceneNode *root;
+    GLuint program;
+    GLint drawIDLocation;
+
+    bool recorded = false;
+    unsigned long recordedRevision = 0;
+
+    std::vector<uint32_t> code;
+
+    // The meshes are referenced by index, their VAO changes when they are evicted
+    std::vector<GpuMesh*> meshes;
+
+    // World matrices of the recorded draws, in windows of maxNodeTransforms
+    GpuBuffer transforms;
+
+    // Scratch memory used while recording
+    std::vector<SceneNode*> drawableNodes;
+
+    CommandListStats stats;
+};
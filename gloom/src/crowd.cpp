@@ -0,0 +1,137 @@
+#include "crowd.hpp"
+#include "toolbox.hpp"
+#include <cmath>
+#include <glm/gtx/transform.hpp>
+
+// Walking speed of the characters, in units per second
+const float walkSpeed = 6.0f;
+
+// Speed of the walk cycle, in radians per second, and maximum swing of the limbs
+const float walkCycleSpeed = 4.0f;
+const float walkCycleAmplitude = 0.5f;
+
+Mesh const & getBodyPartMesh(MinecraftCharacter const &character, BodyPart part)
+{
+    switch(part)
+    {
+    case BODY_HEAD:      return character.head;
+    case BODY_LEFT_ARM:  return character.leftArm;
+    case BODY_RIGHT_ARM: return character.rightArm;
+    case BODY_LEFT_LEG:  return character.leftLeg;
+    case BODY_RIGHT_LEG: return character.rightLeg;
+    default:             return character.torso;
+    }
+}
+
+float3 getBodyPartReferencePoint(BodyPart part)
+{
+    // Same reference points as the nodes built by constructSceneGraph()
+    switch(part)
+    {
+    case BODY_HEAD:      return float3(0, 24, 0);
+    case BODY_LEFT_ARM:  return float3(-4, 22, 0);
+    case BODY_RIGHT_ARM: return float3(4, 22, 0);
+    case BODY_LEFT_LEG:  return float3(-2, 12, 0);
+    case BODY_RIGHT_LEG: return float3(2, 12, 0);
+    default:             return float3(0, 12, 0);
+    }
+}
+
+// Direction in which a limb swings during the walk cycle, 0 for parts which do not move
+static float getBodyPartSwingDirection(BodyPart part)
+{
+    switch(part)
+    {
+    case BODY_LEFT_ARM:
+    case BODY_RIGHT_LEG:
+        return 1.0f;
+    case BODY_RIGHT_ARM:
+    case BODY_LEFT_LEG:
+        return -1.0f;
+    default:
+        return 0.0f;
+    }
+}
+
+std::vector<CrowdCharacter> generateCrowd(unsigned int width, unsigned int height, float spacing)
+{
+    std::vector<CrowdCharacter> characters;
+    characters.reserve(size_t(width) * height);
+
+    for(unsigned int x = 0; x < width; x++)
+    {
+        for(unsigned int z = 0; z < height; z++)
+        {
+            CrowdCharacter character;
+            character.position = float3(float(x) * spacing, 0.0f, float(z) * spacing);
+            character.heading = randomUniformFloat() * 2.0f * float(M_PI);
+            character.phase = randomUniformFloat() * 2.0f * float(M_PI);
+            character.colour = float4(0.5f + 0.5f * randomUniformFloat(),
+                                      0.5f + 0.5f * randomUniformFloat(),
+                                      0.5f + 0.5f * randomUniformFloat(), 1.0f);
+            characters.push_back(character);
+        }
+    }
+
+    return characters;
+}
+
+// Wraps a coordinate into [0, areaSize)
+static float wrapCoordinate(float value, float areaSize)
+{
+    return value - std::floor(value / areaSize) * areaSize;
+}
+
+float3 getCrowdCharacterPosition(CrowdCharacter const &character, float areaSize, float time)
+{
+    // Walk straight ahead, wrapping around the edges of the area
+    float distance = walkSpeed * time;
+    return float3(wrapCoordinate(character.position.x + std::sin(character.heading) * distance, areaSize),
+                  0.0f,
+                  wrapCoordinate(character.position.z + std::cos(character.heading) * distance, areaSize));
+}
+
+void computeCrowdInstances(CrowdCharacter const *characters, unsigned int begin, unsigned int end,
+                           unsigned int characterCount, float areaSize, float time,
+                           InstanceData *instances)
+{
+    // The local transformation of each part only depends on the swing angle,
+    // so the translations around the reference points are built once
+    glm::mat4 toReference[BODY_PART_COUNT];
+    glm::mat4 fromReference[BODY_PART_COUNT];
+    for(int part = 0; part < BODY_PART_COUNT; part++)
+    {
+        float3 reference = getBodyPartReferencePoint(BodyPart(part));
+        toReference[part] = glm::translate(glm::vec3(reference.x, reference.y, reference.z));
+        fromReference[part] = glm::translate(glm::vec3(-reference.x, -reference.y, -reference.z));
+    }
+
+    for(unsigned int i = begin; i < end; i++)
+    {
+        CrowdCharacter const &character = characters[i];
+
+        float3 position = getCrowdCharacterPosition(character, areaSize, time);
+        glm::mat4 root = glm::translate(glm::vec3(position.x, 0.0f, position.z)) *
+                         glm::rotate(character.heading, glm::vec3(0.0f, 1.0f, 0.0f));
+
+        float swing = walkCycleAmplitude * std::sin(walkCycleSpeed * time + character.phase);
+        glm::vec4 colour(character.colour.x, character.colour.y, character.colour.z, character.colour.w);
+
+        for(int part = 0; part < BODY_PART_COUNT; part++)
+        {
+            InstanceData &instance = instances[size_t(part) * characterCount + i];
+
+            float direction = getBodyPartSwingDirection(BodyPart(part));
+            if(direction == 0.0f)
+            {
+                instance.model = root;
+            }
+            else
+            {
+                glm::mat4 rotation = glm::rotate(direction * swing, glm::vec3(1.0f, 0.0f, 0.0f));
+                instance.model = root * toReference[part] * rotation * fromReference[part];
+            }
+            instance.colour = colour;
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+#include <vector>
+#include "floats.hpp"
+#include "mesh.hpp"
+#include "OBJLoader.hpp"
+
+// The body parts of a Minecraft character, in the order their instances are stored
+enum BodyPart {
+    BODY_TORSO = 0,
+    BODY_HEAD,
+    BODY_LEFT_ARM,
+    BODY_RIGHT_ARM,
+    BODY_LEFT_LEG,
+    BODY_RIGHT_LEG,
+    BODY_PART_COUNT
+};
+
+// Returns the mesh of one body part of a character
+Mesh const & getBodyPartMesh(MinecraftCharacter const &character, BodyPart part);
+
+// The point around which a body part rotates, relative to the character
+float3 getBodyPartReferencePoint(BodyPart part);
+
+// Per-instance data of one body part, read by instanced.vert
+struct InstanceData {
+    glm::mat4 model;
+    glm::vec4 colour;
+};
+
+// The state of one character of a crowd
+struct CrowdCharacter {
+    // Position at time 0 and walking direction
+    float3 position;
+    float heading;
+
+    // Offset into the walk cycle, so that the characters do not move in lockstep
+    float phase;
+
+    // Tint applied to the vertex colours
+    float4 colour;
+};
+
+// Places width * height characters on a grid, with random headings, phases and colours
+std::vector<CrowdCharacter> generateCrowd(unsigned int width, unsigned int height, float spacing);
+
+// Position of the feet of a character at the given time, see computeCrowdInstances()
+float3 getCrowdCharacterPosition(CrowdCharacter const &character, float areaSize, float time);
+
+// Computes the instance data of the characters in [begin, end) at the given time.
+// Characters walk straight ahead and wrap around a square of side areaSize.
+// The instance of body part p of character i is written at instances[p * characterCount + i],
+// so that the instances of each part are contiguous. Safe to call from several threads
+// on disjoint ranges.
+void computeCrowdInstances(CrowdCharacter const *characters, unsigned int begin, unsigned int end,
+                           unsigned int characterCount, float areaSize, float time,
+                           InstanceData *instances);
@@ -0,0 +1,211 @@
+#include "debugLayer.hpp"
+#include "program.hpp"
+#include "gloom/gloom.hpp"
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+// A message as received by the callback, formatted later on the render thread
+struct GLDebugMessage {
+    GLenum source;
+    GLenum type;
+    GLuint id;
+    GLenum severity;
+    std::string text;
+};
+
+static bool debugLayerActive = false;
+
+// Filled by the callback, which may run on a driver thread
+static std::mutex messageMutex;
+static std::vector<GLDebugMessage> pendingMessages;
+static GLDebugStats debugStats;
+
+// Only used by flushGLDebugMessages(), kept to avoid allocating every frame
+static std::vector<GLDebugMessage> flushedMessages;
+
+static void APIENTRY debugMessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity,
+                                          GLsizei length, const GLchar *message, const void *)
+{
+    // Keep the callback short, it runs in the middle of the driver
+    std::lock_guard<std::mutex> lock(messageMutex);
+
+    if (type == GL_DEBUG_TYPE_ERROR)
+    {
+        debugStats.errors++;
+    }
+    else if (type == GL_DEBUG_TYPE_PERFORMANCE)
+    {
+        debugStats.performanceWarnings++;
+    }
+    else
+    {
+        debugStats.otherMessages++;
+    }
+
+    GLDebugMessage received;
+    received.source = source;
+    received.type = type;
+    received.id = id;
+    received.severity = severity;
+    received.text = (length >= 0) ? std::string(message, size_t(length)) : std::string(message);
+    pendingMessages.push_back(received);
+}
+
+static const char* debugSourceName(GLenum source)
+{
+    switch(source)
+    {
+    case GL_DEBUG_SOURCE_API:             return "API";
+    case GL_DEBUG_SOURCE_WINDOW_SYSTEM:   return "window system";
+    case GL_DEBUG_SOURCE_SHADER_COMPILER: return "shader compiler";
+    case GL_DEBUG_SOURCE_THIRD_PARTY:     return "third party";
+    case GL_DEBUG_SOURCE_APPLICATION:     return "application";
+    default:                              return "other";
+    }
+}
+
+static const char* debugTypeName(GLenum type)
+{
+    switch(type)
+    {
+    case GL_DEBUG_TYPE_ERROR:               return "error";
+    case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated behaviour";
+    case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:  return "undefined behaviour";
+    case GL_DEBUG_TYPE_PORTABILITY:         return "portability";
+    case GL_DEBUG_TYPE_PERFORMANCE:         return "performance";
+    case GL_DEBUG_TYPE_MARKER:              return "marker";
+    default:                                return "other";
+    }
+}
+
+static const char* debugSeverityName(GLenum severity)
+{
+    switch(severity)
+    {
+    case GL_DEBUG_SEVERITY_HIGH:   return "high";
+    case GL_DEBUG_SEVERITY_MEDIUM: return "medium";
+    case GL_DEBUG_SEVERITY_LOW:    return "low";
+    default:                       return "notification";
+    }
+}
+
+// KHR_debug brings the same entry points as OpenGL 4.3 to older contexts. The check is only
+// compiled when the glad loader was generated with the extension.
+static bool isDebugOutputSupported()
+{
+    if (isGLVersionAtLeast(4, 3))
+    {
+        return true;
+    }
+#ifdef GL_KHR_debug
+    return GLAD_GL_KHR_debug != 0;
+#else
+    return false;
+#endif
+}
+
+bool initialiseGLDebugLayer()
+{
+    if (!enableDebugOutput || !isDebugOutputSupported())
+    {
+        return false;
+    }
+
+    // Without a debug context the driver may not report anything
+    GLint contextFlags = 0;
+    glGetIntegerv(GL_CONTEXT_FLAGS, &contextFlags);
+    if ((contextFlags & GL_CONTEXT_FLAG_DEBUG_BIT) == 0)
+    {
+        fprintf(stderr, "The OpenGL context is not a debug context, the driver may not report all messages\n");
+    }
+
+    // GL_DEBUG_OUTPUT_SYNCHRONOUS is left disabled, so that reporting does not serialise the driver
+    glEnable(GL_DEBUG_OUTPUT);
+    glDebugMessageCallback(debugMessageCallback, nullptr);
+
+    // Notifications, which include the debug group markers, are far too frequent to be printed
+    glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, nullptr, GL_FALSE);
+
+    debugLayerActive = true;
+    return true;
+}
+
+bool isGLDebugLayerActive()
+{
+    return debugLayerActive;
+}
+
+void flushGLDebugMessages()
+{
+    if (!debugLayerActive)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(messageMutex);
+        flushedMessages.swap(pendingMessages);
+    }
+
+    for (size_t i = 0; i < flushedMessages.size();)
+    {
+        GLDebugMessage const &message = flushedMessages[i];
+
+        // Count the identical messages which follow
+        size_t repeats = 1;
+        while (i + repeats < flushedMessages.size() &&
+               flushedMessages[i + repeats].id == message.id &&
+               flushedMessages[i + repeats].text == message.text)
+        {
+            repeats++;
+        }
+
+        fprintf(stderr, "OpenGL %s (%s, %s severity, id %u): %s",
+                debugTypeName(message.type), debugSourceName(message.source),
+                debugSeverityName(message.severity), message.id, message.text.c_str());
+        if (repeats > 1)
+        {
+            fprintf(stderr, " (repeated %u times)", unsigned(repeats));
+        }
+        fprintf(stderr, "\n");
+
+        i += repeats;
+    }
+
+    flushedMessages.clear();
+}
+
+GLDebugStats getGLDebugStats()
+{
+    std::lock_guard<std::mutex> lock(messageMutex);
+    return debugStats;
+}
+
+void setGLObjectLabel(GLenum identifier, GLuint name, std::string const &label)
+{
+    if (!debugLayerActive || label.empty())
+    {
+        return;
+    }
+
+    // GL_MAX_LABEL_LENGTH is at least 256, including the terminating null character
+    std::string truncated = label.substr(0, 255);
+    glObjectLabel(identifier, name, GLsizei(truncated.size()), truncated.c_str());
+}
+
+GLDebugGroup::GLDebugGroup(const char *name) : pushed(debugLayerActive)
+{
+    if (pushed)
+    {
+        glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, name);
+    }
+}
+
+GLDebugGroup::~GLDebugGroup()
+{
+    if (pushed)
+    {
+        glPopDebugGroup();
+    }
+}
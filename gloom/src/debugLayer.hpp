@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <string>
+
+// Counters of the messages reported since the debug layer was initialised
+struct GLDebugStats {
+    unsigned int errors = 0;
+    unsigned int performanceWarnings = 0;
+    unsigned int otherMessages = 0;
+};
+
+// Installs a debug message callback when the context supports it (OpenGL 4.3 or KHR_debug)
+// and enableDebugOutput is set. Returns whether the debug layer is active.
+//
+// Unlike glGetError, the callback does not synchronise the CPU with the GPU: the output is
+// left asynchronous, so the driver may report a message from any thread, some time after
+// the call which caused it. The messages are queued and printed by flushGLDebugMessages().
+bool initialiseGLDebugLayer();
+
+bool isGLDebugLayerActive();
+
+// Prints the messages received since the last call to stderr, must be called once per frame.
+// Identical messages are only printed once, with the number of times they were received.
+void flushGLDebugMessages();
+
+GLDebugStats getGLDebugStats();
+
+// Names an object, so that the driver messages about it mention its label.
+// identifier is the type of the object: GL_BUFFER, GL_VERTEX_ARRAY, GL_PROGRAM, ...
+// Does nothing when the debug layer is not active.
+void setGLObjectLabel(GLenum identifier, GLuint name, std::string const &label);
+
+// Marks the GL calls made during its lifetime as one group, which shows up in the driver
+// messages and in frame debuggers. Only costs a branch when the debug layer is not active.
+class GLDebugGroup {
+public:
+    explicit GLDebugGroup(const char *name);
+    ~GLDebugGroup();
+
+private:
+    GLDebugGroup(GLDebugGroup const &) = delete;
+    GLDebugGroup & operator =(GLDebugGroup const &) = delete;
+
+    bool pushed;
+};
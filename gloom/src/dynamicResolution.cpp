@@ -0,0 +1,144 @@
+#include "dynamicResolution.hpp"
+#include "program.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Results arrive a few frames after the queries, this covers the usual driver latency
+static const unsigned int queryCount = 5;
+
+// The scale aims a little below the budget so that it does not oscillate around it
+static const double budgetHeadroom = 0.9;
+
+// Largest change of the scale in one frame, and weight of a new measurement in the average
+static const float maximumScaleStep = 0.05f;
+static const double averageWeight = 0.2;
+
+DynamicResolution::DynamicResolution(double budgetMilliseconds, float minimumScale, float maximumScale)
+    : budget(budgetMilliseconds), minimumScale(minimumScale), maximumScale(maximumScale), scale(maximumScale)
+{
+    supported = isGLVersionAtLeast(3, 3);
+    if (!supported)
+    {
+        return;
+    }
+
+    queries.resize(queryCount);
+    for (Query &query : queries)
+    {
+        glGenQueries(1, &query.query);
+        query.pending = false;
+    }
+}
+
+DynamicResolution::~DynamicResolution()
+{
+    for (Query &query : queries)
+    {
+        glDeleteQueries(1, &query.query);
+    }
+}
+
+void DynamicResolution::beginFrame()
+{
+    if (!supported)
+    {
+        return;
+    }
+
+    // All the queries are still waiting for the GPU, this frame goes unmeasured
+    Query &query = queries[nextQuery];
+    if (query.pending)
+    {
+        stats.skippedMeasurements++;
+        return;
+    }
+
+    glBeginQuery(GL_TIME_ELAPSED, query.query);
+    query.scale = scale;
+    activeQuery = int(nextQuery);
+    nextQuery = (nextQuery + 1) % queryCount;
+}
+
+void DynamicResolution::endFrame()
+{
+    if (!supported)
+    {
+        return;
+    }
+
+    if (activeQuery >= 0)
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        queries[activeQuery].pending = true;
+        activeQuery = -1;
+    }
+
+    collectResults();
+}
+
+void DynamicResolution::collectResults()
+{
+    // The queries complete in order, so the oldest pending one is the first to check
+    for (unsigned int i = 0; i < queryCount; i++)
+    {
+        Query &query = queries[(nextQuery + i) % queryCount];
+        if (!query.pending)
+        {
+            continue;
+        }
+
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(query.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available == GL_FALSE)
+        {
+            break;
+        }
+
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(query.query, GL_QUERY_RESULT, &nanoseconds);
+        query.pending = false;
+
+        updateScale(double(nanoseconds) * 1e-6, query.scale);
+    }
+}
+
+void DynamicResolution::updateScale(double gpuMilliseconds, float measuredScale)
+{
+    stats.lastGpuMilliseconds = gpuMilliseconds;
+    if (stats.averageGpuMilliseconds <= 0.0)
+    {
+        stats.averageGpuMilliseconds = gpuMilliseconds;
+    }
+    else
+    {
+        stats.averageGpuMilliseconds += averageWeight * (gpuMilliseconds - stats.averageGpuMilliseconds);
+    }
+
+    // The cost grows with the number of pixels, the square of the scale. Comparing the
+    // frames at the same scale keeps the controller from chasing its own delayed results.
+    double fullScale = gpuMilliseconds / double(measuredScale * measuredScale);
+    if (fullScaleMilliseconds <= 0.0)
+    {
+        fullScaleMilliseconds = fullScale;
+    }
+    else
+    {
+        fullScaleMilliseconds += averageWeight * (fullScale - fullScaleMilliseconds);
+    }
+
+    float wanted = float(std::sqrt(budget * budgetHeadroom / std::max(fullScaleMilliseconds, 1e-3)));
+
+    // Small steps hide the change of resolution, and smooth out single slow frames
+    wanted = std::min(std::max(wanted, scale - maximumScaleStep), scale + maximumScaleStep);
+    scale = std::min(std::max(wanted, minimumScale), maximumScale);
+}
+
+int DynamicResolution::getRenderWidth(int outputWidth) const
+{
+    return std::max(1, int(float(outputWidth) * scale + 0.5f));
+}
+
+int DynamicResolution::getRenderHeight(int outputHeight) const
+{
+    return std::max(1, int(float(outputHeight) * scale + 0.5f));
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <vector>
+
+// Counters of the resolution controller
+struct DynamicResolutionStats {
+    // GPU time of the last measured frame, and its running average, in milliseconds
+    double lastGpuMilliseconds = 0.0;
+    double averageGpuMilliseconds = 0.0;
+
+    // Frames which could not be measured because all the queries were still in flight
+    unsigned int skippedMeasurements = 0;
+};
+
+// Scales the resolution the scene is rendered at so that the GPU time of a frame stays
+// within a budget. The frame is rendered into the corner of render targets the size of
+// the window, then stretched over the window, so changing the scale never reallocates.
+//
+//    resolution.beginFrame();
+//    ... render at getRenderWidth(width) x getRenderHeight(height) ...
+//    resolution.endFrame();
+//
+// The GPU time is measured with GL_TIME_ELAPSED queries. Their results arrive a few
+// frames late, so the queries go round a ring and are only read once available, which
+// never stalls the CPU. The rendering cost is taken as proportional to the number of
+// pixels: each measurement is divided by the square of the scale it was taken at, which
+// estimates the cost of a full resolution frame, and the scale moves a little every frame
+// towards the one expected to meet the budget.
+//
+// Timer queries are core since OpenGL 3.3, on older contexts the scale stays fixed.
+class DynamicResolution {
+public:
+    DynamicResolution(double budgetMilliseconds, float minimumScale, float maximumScale = 1.0f);
+    ~DynamicResolution();
+
+    // Starts and stops measuring the GPU work of a frame, the scale is updated by
+    // endFrame() from the oldest measurement available
+    void beginFrame();
+    void endFrame();
+
+    float getScale() const { return scale; }
+
+    // Size of the rendered image for an output of the given size
+    int getRenderWidth(int outputWidth) const;
+    int getRenderHeight(int outputHeight) const;
+
+    DynamicResolutionStats const & getStats() const { return stats; }
+
+private:
+    DynamicResolution(DynamicResolution const &) = delete;
+    DynamicResolution & operator =(DynamicResolution const &) = delete;
+
+    // Reads the queries whose result has arrived, oldest first
+    void collectResults();
+
+    // Moves the scale towards the one expected to fit the budget
+    void updateScale(double gpuMilliseconds, float measuredScale);
+
+    struct Query {
+        GLuint query;
+        bool pending;
+
+        // Scale of the frame measured, the result arrives after the scale has moved on
+        float scale;
+    };
+
+    double budget;
+    float minimumScale;
+    float maximumScale;
+    float scale;
+
+    // Running average of the GPU time a frame would take at full resolution
+    double fullScaleMilliseconds = 0.0;
+
+    bool supported;
+    std::vector<Query> queries;
+    unsigned int nextQuery = 0;
+    int activeQuery = -1;
+
+    DynamicResolutionStats stats;
+};
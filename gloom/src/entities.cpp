@@ -0,0 +1,74 @@
+#include "entities.hpp"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+
+unsigned int allocateComponentTypeId()
+{
+    static std::atomic<unsigned int> nextId(0);
+    unsigned int id = nextId++;
+    if (id >= maxComponentTypes)
+    {
+        fprintf(stderr, "EntityWorld: more than %u component types.\n", maxComponentTypes);
+        abort();
+    }
+    return id;
+}
+
+unsigned int EntityWorld::findArchetype(uint32_t mask, std::initializer_list<unsigned int> typeIds,
+                                        std::initializer_list<size_t> sizes)
+{
+    for (unsigned int i = 0; i < archetypes.size(); i++)
+    {
+        if (archetypes[i]->mask == mask)
+        {
+            return i;
+        }
+    }
+
+    std::unique_ptr<Archetype> archetype(new Archetype());
+    archetype->mask = mask;
+    for (unsigned int type = 0; type < maxComponentTypes; type++)
+    {
+        archetype->columns[type] = -1;
+    }
+
+    std::initializer_list<size_t>::const_iterator size = sizes.begin();
+    for (unsigned int typeId : typeIds)
+    {
+        archetype->columns[typeId] = int(archetype->componentSizes.size());
+        archetype->componentSizes.push_back(*size++);
+    }
+
+    archetypes.push_back(std::move(archetype));
+    return unsigned(archetypes.size() - 1);
+}
+
+unsigned int EntityWorld::findChunk(Archetype &archetype)
+{
+    // Only the last chunk can have room, entities are never removed
+    if (!archetype.chunks.empty() && archetype.chunks.back()->count < entitiesPerChunk)
+    {
+        return unsigned(archetype.chunks.size() - 1);
+    }
+
+    std::unique_ptr<Chunk> chunk(new Chunk());
+    for (size_t size : archetype.componentSizes)
+    {
+        chunk->columns.emplace_back(new unsigned char[size * entitiesPerChunk]);
+    }
+    archetype.chunks.push_back(std::move(chunk));
+    return unsigned(archetype.chunks.size() - 1);
+}
+
+EntityStats EntityWorld::getStats() const
+{
+    EntityStats stats;
+    stats.entities = unsigned(locations.size());
+    stats.archetypes = unsigned(archetypes.size());
+    for (std::unique_ptr<Archetype> const &archetype : archetypes)
+    {
+        stats.chunks += unsigned(archetype->chunks.size());
+    }
+    return stats;
+}
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "threadPool.hpp"
+
+// Identifies an entity of an EntityWorld
+typedef uint32_t Entity;
+
+// Component types are numbered on first use, and archetypes are sets of them stored as bits
+const unsigned int maxComponentTypes = 32;
+
+// Number of entities stored together in a chunk, enough for the components of a chunk to
+// fill a few pages while keeping many chunks to share between threads
+const unsigned int entitiesPerChunk = 128;
+
+// Smallest number of chunks given to one thread by parallelForEachChunk(). Worlds with
+// fewer chunks are updated on the calling thread, without waking up the pool.
+const unsigned int chunksPerRange = 4;
+
+// Returns the next free component type number, see getComponentTypeId()
+unsigned int allocateComponentTypeId();
+
+template <class Component>
+unsigned int getComponentTypeId()
+{
+    static const unsigned int id = allocateComponentTypeId();
+    return id;
+}
+
+// Counters of an entity world
+struct EntityStats {
+    unsigned int entities = 0;
+    unsigned int archetypes = 0;
+    unsigned int chunks = 0;
+};
+
+// Stores entities made of plain components, grouped by archetype: all the entities with
+// the same set of component types live in the chunks of one archetype. A chunk holds one
+// array per component type, so a system reading two components of a thousand entities
+// walks two packed arrays instead of a thousand objects.
+//
+// Systems run on every chunk containing the components they read:
+//
+//    world.forEachChunk<Transform, WalkCycle>([&](unsigned int count, Transform *transforms, WalkCycle *cycles)
+//    {
+//        for (unsigned int i = 0; i < count; i++) ...
+//    });
+//
+// The chunks are independent, so parallelForEachChunk() gives them to the threads of a pool.
+// Components are copied into the chunks and never destroyed, they must have trivial destructors.
+class EntityWorld {
+public:
+    EntityWorld() {}
+
+    template <class... Components>
+    Entity create(Components const &... components);
+
+    // The component of an entity, nullptr if the entity does not have one
+    template <class Component>
+    Component * get(Entity entity);
+
+    template <class... Components, class Function>
+    void forEachChunk(Function const &function);
+
+    template <class... Components, class Function>
+    void parallelForEachChunk(ThreadPool &threadPool, Function const &function);
+
+    EntityStats getStats() const;
+
+private:
+    EntityWorld(EntityWorld const &) = delete;
+    EntityWorld & operator =(EntityWorld const &) = delete;
+
+    struct Chunk {
+        unsigned int count = 0;
+        Entity entities[entitiesPerChunk];
+
+        // One array of entitiesPerChunk components for each component type of the archetype
+        std::vector<std::unique_ptr<unsigned char[]>> columns;
+    };
+
+    struct Archetype {
+        uint32_t mask = 0;
+
+        // Column of each component type in the chunks, -1 for the types not in the archetype
+        int columns[maxComponentTypes];
+        std::vector<size_t> componentSizes;
+
+        std::vector<std::unique_ptr<Chunk>> chunks;
+    };
+
+    struct Location {
+        unsigned int archetype;
+        unsigned int chunk;
+        unsigned int row;
+    };
+
+    template <class... Components>
+    static uint32_t makeMask();
+
+    template <class Component>
+    static Component * getColumn(Archetype &archetype, Chunk &chunk)
+    {
+        return reinterpret_cast<Component *>(chunk.columns[archetype.columns[getComponentTypeId<Component>()]].get());
+    }
+
+    template <class Component>
+    static int writeComponent(Archetype &archetype, Chunk &chunk, unsigned int row, Component const &component)
+    {
+        static_assert(std::is_trivially_destructible<Component>::value, "components are never destroyed");
+        new (&getColumn<Component>(archetype, chunk)[row]) Component(component);
+        return 0;
+    }
+
+    // The archetype of the given component types, created on first use
+    unsigned int findArchetype(uint32_t mask, std::initializer_list<unsigned int> typeIds,
+                               std::initializer_list<size_t> sizes);
+
+    // A chunk of the archetype with room for one more entity
+    unsigned int findChunk(Archetype &archetype);
+
+    std::vector<std::unique_ptr<Archetype>> archetypes;
+    std::vector<Location> locations;
+
+    // The chunks visited by parallelForEachChunk()
+    std::vector<std::pair<Archetype *, Chunk *>> matchingChunks;
+};
+
+template <class... Components>
+uint32_t EntityWorld::makeMask()
+{
+    uint32_t mask = 0;
+    for (unsigned int id : {getComponentTypeId<Components>()...})
+    {
+        mask |= 1u << id;
+    }
+    return mask;
+}
+
+template <class... Components>
+Entity EntityWorld::create(Components const &... components)
+{
+    unsigned int archetypeIndex = findArchetype(makeMask<Components...>(), {getComponentTypeId<Components>()...},
+                                                {sizeof(Components)...});
+    Archetype &archetype = *archetypes[archetypeIndex];
+    unsigned int chunkIndex = findChunk(archetype);
+    Chunk &chunk = *archetype.chunks[chunkIndex];
+
+    Entity entity = Entity(locations.size());
+    unsigned int row = chunk.count++;
+    chunk.entities[row] = entity;
+    int written[] = {0, writeComponent(archetype, chunk, row, components)...};
+    (void) written;
+
+    locations.push_back(Location{archetypeIndex, chunkIndex, row});
+    return entity;
+}
+
+template <class Component>
+Component * EntityWorld::get(Entity entity)
+{
+    Location const &location = locations[entity];
+    Archetype &archetype = *archetypes[location.archetype];
+    if (archetype.columns[getComponentTypeId<Component>()] < 0)
+    {
+        return nullptr;
+    }
+    return &getColumn<Component>(archetype, *archetype.chunks[location.chunk])[location.row];
+}
+
+template <class... Components, class Function>
+void EntityWorld::forEachChunk(Function const &function)
+{
+    uint32_t mask = makeMask<Components...>();
+    for (std::unique_ptr<Archetype> &archetype : archetypes)
+    {
+        if ((archetype->mask & mask) != mask)
+        {
+            continue;
+        }
+        for (std::unique_ptr<Chunk> &chunk : archetype->chunks)
+        {
+            function(chunk->count, getColumn<Components>(*archetype, *chunk)...);
+        }
+    }
+}
+
+template <class... Components, class Function>
+void EntityWorld::parallelForEachChunk(ThreadPool &threadPool, Function const &function)
+{
+    uint32_t mask = makeMask<Components...>();
+    matchingChunks.clear();
+    for (std::unique_ptr<Archetype> &archetype : archetypes)
+    {
+        if ((archetype->mask & mask) != mask)
+        {
+            continue;
+        }
+        for (std::unique_ptr<Chunk> &chunk : archetype->chunks)
+        {
+            matchingChunks.push_back(std::make_pair(archetype.get(), chunk.get()));
+        }
+    }
+
+    threadPool.parallelFor(unsigned(matchingChunks.size()), [&](unsigned int begin, unsigned int end, unsigned int)
+    {
+        for (unsigned int i = begin; i < end; i++)
+        {
+            Archetype &archetype = *matchingChunks[i].first;
+            Chunk &chunk = *matchingChunks[i].second;
+            function(chunk.count, getColumn<Components>(archetype, chunk)...);
+        }
+    }, chunksPerRange);
+}
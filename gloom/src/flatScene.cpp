@@ -0,0 +1,309 @@
+#include "flatScene.hpp"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <utility>
+
+FlatScene::FlatScene(SceneNode *root)
+{
+    appendSubtree(root, noFlatNode);
+}
+
+void FlatScene::appendSubtree(SceneNode *node, FlatNodeIndex parent)
+{
+    if (node->isStatic)
+    {
+        return;
+    }
+
+    // Each node is queued with the index its parent was given
+    std::deque<std::pair<SceneNode *, FlatNodeIndex>> queue;
+    queue.push_back(std::make_pair(node, parent));
+    while (!queue.empty())
+    {
+        SceneNode *current = queue.front().first;
+        FlatNodeIndex currentParent = queue.front().second;
+        queue.pop_front();
+
+        FlatNodeIndex index = FlatNodeIndex(parents.size());
+        unsigned int depth = currentParent == noFlatNode ? 0 : depths[currentParent] + 1;
+        if (!levels.empty() && levels.back().second == index && depths[levels.back().first] == depth)
+        {
+            levels.back().second++;
+        }
+        else
+        {
+            levels.push_back(std::make_pair(index, index + 1));
+        }
+
+        depths.push_back(depth);
+        positions.push_back(current->position);
+        rotations.push_back(current->rotation);
+        referencePoints.push_back(current->referencePoint);
+        localMatrices.push_back(glm::mat4());
+        worldMatrices.push_back(current->currentTransformationMatrix);
+        localDirty.push_back(1);
+        worldDirty.push_back(1);
+        boundsDirty.push_back(1);
+        parents.push_back(currentParent);
+        children.emplace_back();
+        if (currentParent != noFlatNode)
+        {
+            children[currentParent].push_back(index);
+        }
+        meshes.push_back(current->mesh);
+        names.push_back(current->name);
+        sceneNodes.push_back(current);
+
+        for (SceneNode *child : current->children)
+        {
+            if (!child->isStatic)
+            {
+                queue.push_back(std::make_pair(child, index));
+            }
+        }
+    }
+}
+
+FlatNodeIndex FlatScene::find(std::string const &name) const
+{
+    for (FlatNodeIndex node = 0; node < names.size(); node++)
+    {
+        if (names[node] == name)
+        {
+            return node;
+        }
+    }
+    return noFlatNode;
+}
+
+FlatNodeIndex FlatScene::find(SceneNode const *sceneNode) const
+{
+    for (FlatNodeIndex node = 0; node < sceneNodes.size(); node++)
+    {
+        if (sceneNodes[node] == sceneNode)
+        {
+            return node;
+        }
+    }
+    return noFlatNode;
+}
+
+FlatNodeIndex FlatScene::addChild(FlatNodeIndex parent, SceneNode *node)
+{
+    ::addChild(sceneNodes[parent], node);
+
+    // Appending keeps every parent before its children
+    FlatNodeIndex index = FlatNodeIndex(parents.size());
+    appendSubtree(node, parent);
+    return index;
+}
+
+void FlatScene::setPosition(FlatNodeIndex node, float3 const &position)
+{
+    if (positions[node] != position)
+    {
+        positions[node] = position;
+        localDirty[node] = 1;
+    }
+}
+
+void FlatScene::setRotation(FlatNodeIndex node, float3 const &rotation)
+{
+    if (rotations[node] != rotation)
+    {
+        rotations[node] = rotation;
+        localDirty[node] = 1;
+    }
+}
+
+void FlatScene::setReferencePoint(FlatNodeIndex node, float3 const &referencePoint)
+{
+    if (referencePoints[node] != referencePoint)
+    {
+        referencePoints[node] = referencePoint;
+        localDirty[node] = 1;
+    }
+}
+
+void FlatScene::setLocalTransform(FlatNodeIndex node, float3 const &position, float3 const &rotation, float3 const &referencePoint)
+{
+    setPosition(node, position);
+    setRotation(node, rotation);
+    setReferencePoint(node, referencePoint);
+}
+
+void FlatScene::propagateNode(FlatNodeIndex node, bool &localUpdated, bool &worldUpdated)
+{
+    FlatNodeIndex parent = parents[node];
+    bool parentChanged = parent != noFlatNode && worldDirty[parent] != 0;
+    localUpdated = localDirty[node] != 0;
+    worldUpdated = localUpdated || parentChanged;
+
+    if (localUpdated)
+    {
+        localMatrices[node] = computeLocalTransformation(positions[node], rotations[node], referencePoints[node]);
+        localDirty[node] = 0;
+    }
+
+    if (worldUpdated)
+    {
+        worldMatrices[node] = parent == noFlatNode ? localMatrices[node] : worldMatrices[parent] * localMatrices[node];
+    }
+    worldDirty[node] = worldUpdated ? 1 : 0;
+}
+
+void FlatScene::propagateTransforms()
+{
+    unsigned int count = getNodeCount();
+    stats.nodes = count;
+    stats.levels = unsigned(levels.size());
+    stats.localUpdates = 0;
+    stats.worldUpdates = 0;
+
+    // The parents come first, so their flag is already set for this frame when read
+    for (FlatNodeIndex node = 0; node < count; node++)
+    {
+        bool localUpdated, worldUpdated;
+        propagateNode(node, localUpdated, worldUpdated);
+        stats.localUpdates += localUpdated ? 1 : 0;
+        stats.worldUpdates += worldUpdated ? 1 : 0;
+    }
+}
+
+void FlatScene::propagateTransforms(ThreadPool &threadPool)
+{
+    stats.nodes = getNodeCount();
+    stats.levels = unsigned(levels.size());
+    std::atomic<unsigned int> localUpdates(0);
+    std::atomic<unsigned int> worldUpdates(0);
+
+    // parallelFor() returns once the whole level is done, so the parents of the next level
+    // are ready. A node only writes its own entries, the threads never share one.
+    for (std::pair<FlatNodeIndex, FlatNodeIndex> const &level : levels)
+    {
+        FlatNodeIndex first = level.first;
+        threadPool.parallelFor(level.second - first, [&](unsigned int begin, unsigned int end, unsigned int)
+        {
+            unsigned int rangeLocalUpdates = 0;
+            unsigned int rangeWorldUpdates = 0;
+            for (FlatNodeIndex node = first + begin; node < first + end; node++)
+            {
+                bool localUpdated, worldUpdated;
+                propagateNode(node, localUpdated, worldUpdated);
+                rangeLocalUpdates += localUpdated ? 1 : 0;
+                rangeWorldUpdates += worldUpdated ? 1 : 0;
+            }
+            localUpdates += rangeLocalUpdates;
+            worldUpdates += rangeWorldUpdates;
+        }, flatSceneRangeSize);
+    }
+
+    stats.localUpdates = localUpdates;
+    stats.worldUpdates = worldUpdates;
+}
+
+unsigned int FlatScene::verifyTransforms() const
+{
+    unsigned int count = getNodeCount();
+    std::vector<glm::mat4> expected(count);
+    unsigned int mismatches = 0;
+    for (FlatNodeIndex node = 0; node < count; node++)
+    {
+        glm::mat4 local = computeLocalTransformation(positions[node], rotations[node], referencePoints[node]);
+        FlatNodeIndex parent = parents[node];
+        expected[node] = parent == noFlatNode ? local : expected[parent] * local;
+        if (memcmp(&expected[node], &worldMatrices[node], sizeof(glm::mat4)) != 0)
+        {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+bool FlatScene::writeBackNode(FlatNodeIndex node)
+{
+    SceneNode *sceneNode = sceneNodes[node];
+    bool boundsChanged = false;
+    if (worldDirty[node] != 0)
+    {
+        sceneNode->position = positions[node];
+        sceneNode->rotation = rotations[node];
+        sceneNode->referencePoint = referencePoints[node];
+        sceneNode->currentTransformationMatrix = worldMatrices[node];
+        boundsChanged = true;
+    }
+
+    // The mesh may have arrived from the upload thread since the last frame
+    if (meshes[node] != sceneNode->mesh)
+    {
+        meshes[node] = sceneNode->mesh;
+        boundsChanged = true;
+    }
+
+    for (FlatNodeIndex child : children[node])
+    {
+        boundsChanged = boundsChanged || boundsDirty[child] != 0;
+    }
+
+    if (boundsChanged)
+    {
+        updateWorldBounds(sceneNode);
+    }
+    boundsDirty[node] = boundsChanged ? 1 : 0;
+    return boundsChanged;
+}
+
+void FlatScene::writeBack()
+{
+    stats.boundsUpdates = 0;
+
+    // In reverse order the children are done before their parent, whose bounds contain theirs
+    for (FlatNodeIndex node = getNodeCount(); node-- > 0;)
+    {
+        stats.boundsUpdates += writeBackNode(node) ? 1 : 0;
+    }
+}
+
+void FlatScene::writeBack(ThreadPool &threadPool)
+{
+    std::atomic<unsigned int> boundsUpdates(0);
+
+    // From the deepest level, so that the children of a level are done before it. A node
+    // only writes its own SceneNode and entries, and reads those of its children.
+    for (size_t level = levels.size(); level-- > 0;)
+    {
+        FlatNodeIndex first = levels[level].first;
+        threadPool.parallelFor(levels[level].second - first, [&](unsigned int begin, unsigned int end, unsigned int)
+        {
+            unsigned int rangeBoundsUpdates = 0;
+            for (FlatNodeIndex node = first + begin; node < first + end; node++)
+            {
+                rangeBoundsUpdates += writeBackNode(node) ? 1 : 0;
+            }
+            boundsUpdates += rangeBoundsUpdates;
+        }, flatSceneRangeSize);
+    }
+
+    stats.boundsUpdates = boundsUpdates;
+}
+
+void FlatScene::printNode(FlatNodeIndex node) const
+{
+    printf(
+        "SceneNode {\n"
+        "    name: %s\n"
+        "    Child count: %i\n"
+        "    Rotation: (%f, %f, %f)\n"
+        "    Location: (%f, %f, %f)\n"
+        "    Reference point: (%f, %f, %f)\n"
+        "    VAO ID: %i\n"
+        "}\n",
+        names[node].c_str(),
+        int(sceneNodes[node]->children.size()),
+        rotations[node].x, rotations[node].y, rotations[node].z,
+        positions[node].x, positions[node].y, positions[node].z,
+        referencePoints[node].x, referencePoints[node].y, referencePoints[node].z,
+        sceneNodes[node]->vertexArrayObjectID);
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <glm/mat4x4.hpp>
+#include <string>
+#include <utility>
+#include <vector>
+#include "floats.hpp"
+#include "sceneGraph.hpp"
+#include "threadPool.hpp"
+
+class GpuMesh;
+
+// Smallest number of nodes of a level given to one thread by the parallel propagation and
+// write back, smaller levels are done on the calling thread
+const unsigned int flatSceneRangeSize = 256;
+
+// Counters of the last propagateTransforms() and writeBack()
+struct FlatSceneStats {
+    unsigned int nodes = 0;
+
+    // Runs of nodes at the same depth, which the parallel propagateTransforms() and
+    // writeBack() go through one after the other
+    unsigned int levels = 0;
+
+    // Local matrices rebuilt because the node was edited, and world matrices recomputed
+    // because the node or one of its ancestors was
+    unsigned int localUpdates = 0;
+    unsigned int worldUpdates = 0;
+
+    // SceneNodes whose bounds were merged again by writeBack()
+    unsigned int boundsUpdates = 0;
+};
+
+// Index of a node in a FlatScene
+typedef unsigned int FlatNodeIndex;
+const FlatNodeIndex noFlatNode = ~0u;
+
+// The dynamic part of a scene graph stored as arrays, one per field, in breadth first
+// order. A parent always comes before its children, so the world matrices are computed
+// by a single loop over the arrays, with no recursion and no pointer to follow:
+//
+//    world[i] = world[parents[i]] * local(positions[i], rotations[i], referencePoints[i])
+//
+// The nodes are copied from a SceneNode graph, which stays the interface of the rest of the
+// renderer: writeBack() hands the results over to the SceneNodes once per frame. Static
+// subtrees are drawn by their command lists and not copied.
+//
+// The local transformations are only changed through the setters, which flag the nodes
+// whose values actually changed. Only the flagged nodes and the nodes below them are
+// computed again, so a scene standing still costs a loop over the flags.
+//
+// The nodes at the same depth do not depend on each other, so large hierarchies are
+// computed level by level, each level split between the threads of a pool, and written
+// back level by level from the deepest one. Every node goes through the same code in both
+// versions, so their results are bit-identical.
+class FlatScene {
+public:
+    // Copies the dynamic nodes below root, root included
+    explicit FlatScene(SceneNode *root);
+
+    unsigned int getNodeCount() const { return unsigned(parents.size()); }
+
+    // The first node with this name, or noFlatNode
+    FlatNodeIndex find(std::string const &name) const;
+
+    // The node copied from sceneNode, or noFlatNode
+    FlatNodeIndex find(SceneNode const *sceneNode) const;
+
+    // Like addChild(): appends node, and the dynamic nodes below it, under parent.
+    // The SceneNodes are linked as well. Returns the index of node.
+    FlatNodeIndex addChild(FlatNodeIndex parent, SceneNode *node);
+
+    // The local transformation, relative to the parent, see computeLocalTransformation()
+    float3 const & getPosition(FlatNodeIndex node) const       { return positions[node]; }
+    float3 const & getRotation(FlatNodeIndex node) const       { return rotations[node]; }
+    float3 const & getReferencePoint(FlatNodeIndex node) const { return referencePoints[node]; }
+
+    void setPosition(FlatNodeIndex node, float3 const &position);
+    void setRotation(FlatNodeIndex node, float3 const &rotation);
+    void setReferencePoint(FlatNodeIndex node, float3 const &referencePoint);
+    void setLocalTransform(FlatNodeIndex node, float3 const &position, float3 const &rotation, float3 const &referencePoint);
+
+    // Computes the world matrices of the edited nodes and of the nodes below them
+    void propagateTransforms();
+
+    // Same result, with each level shared between the threads of threadPool
+    void propagateTransforms(ThreadPool &threadPool);
+
+    // Computes every world matrix again from scratch on the calling thread, and returns the
+    // number of nodes whose stored matrix differs by any bit
+    unsigned int verifyTransforms() const;
+
+    // Copies the changed transformations into the SceneNodes, and updates the world bounds
+    // of the changed nodes and of their ancestors, the children first
+    void writeBack();
+
+    // Same result, with each level shared between the threads of threadPool
+    void writeBack(ThreadPool &threadPool);
+
+    // Same output as printNode()
+    void printNode(FlatNodeIndex node) const;
+
+    FlatSceneStats const & getStats() const { return stats; }
+
+    std::vector<glm::mat4> worldMatrices;
+
+    // Index of the parent of each node, noFlatNode for the root
+    std::vector<FlatNodeIndex> parents;
+
+    std::vector<GpuMesh *> meshes;
+
+    // Only read when editing and printing, kept away from the hot arrays
+    std::vector<std::string> names;
+    std::vector<SceneNode *> sceneNodes;
+
+private:
+    FlatScene(FlatScene const &) = delete;
+    FlatScene & operator =(FlatScene const &) = delete;
+
+    // Appends node and the dynamic nodes below it, in breadth first order
+    void appendSubtree(SceneNode *node, FlatNodeIndex parent);
+
+    // Updates the matrices of a node whose parent is done, returns whether the local and
+    // the world matrix were computed
+    void propagateNode(FlatNodeIndex node, bool &localUpdated, bool &worldUpdated);
+
+    // Writes back a node whose children are done, returns whether its bounds were updated
+    bool writeBackNode(FlatNodeIndex node);
+
+    std::vector<float3> positions;
+    std::vector<float3> rotations;
+    std::vector<float3> referencePoints;
+    std::vector<glm::mat4> localMatrices;
+
+    // Set by the setters, cleared once the local matrix is rebuilt
+    std::vector<unsigned char> localDirty;
+
+    // Set by propagateTransforms() on the nodes whose world matrix changed, read by their
+    // children in the same pass and by writeBack()
+    std::vector<unsigned char> worldDirty;
+
+    // Set by writeBack() on the nodes whose bounds changed, read by their parent in the
+    // same pass, so that the bounds of the ancestors of changed nodes are merged again
+    std::vector<unsigned char> boundsDirty;
+
+    // Indices of the children of each node. The parents read the flags of their children,
+    // rather than the children setting the flag of a parent they may share.
+    std::vector<std::vector<FlatNodeIndex>> children;
+
+    std::vector<unsigned int> depths;
+
+    // Runs [first, end) of consecutive nodes at the same depth. A parent is at a smaller
+    // depth and index, so it is in an earlier run. Breadth first order gives one run per
+    // depth, the subtrees appended by addChild() add some more.
+    std::vector<std::pair<FlatNodeIndex, FlatNodeIndex>> levels;
+
+    FlatSceneStats stats;
+};
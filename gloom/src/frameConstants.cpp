@@ -0,0 +1,72 @@
+#include "frameConstants.hpp"
+#include "glStateCache.hpp"
+#include <algorithm>
+#include <cstring>
+
+void bindSceneUniformBlocks(GLuint program)
+{
+    GLuint frameConstantsIndex = glGetUniformBlockIndex(program, "FrameConstants");
+    if (frameConstantsIndex != GL_INVALID_INDEX)
+    {
+        glUniformBlockBinding(program, frameConstantsIndex, frameConstantsBinding);
+    }
+
+    GLuint nodeTransformsIndex = glGetUniformBlockIndex(program, "NodeTransforms");
+    if (nodeTransformsIndex != GL_INVALID_INDEX)
+    {
+        glUniformBlockBinding(program, nodeTransformsIndex, nodeTransformsBinding);
+    }
+}
+
+GLsizeiptr getUniformBufferAlignment()
+{
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    return std::max(GLsizeiptr(alignment), GLsizeiptr(16));
+}
+
+GLsizeiptr getSceneUniformBytesPerFrame(unsigned int transformCount)
+{
+    unsigned int windowCount = (transformCount + maxNodeTransforms - 1) / maxNodeTransforms;
+    GLsizeiptr alignment = getUniformBufferAlignment();
+
+    // Each upload may need up to one alignment of padding
+    return sizeof(FrameConstants) + alignment + std::max(windowCount, 1u) * nodeTransformWindowBytes + alignment;
+}
+
+void uploadFrameConstants(StreamBuffer &uniformBuffer, FrameConstants const &constants)
+{
+    GLintptr offset = uniformBuffer.upload(&constants, sizeof(FrameConstants), getUniformBufferAlignment());
+    if (offset >= 0)
+    {
+        getGLStateCache().bindBufferRange(GL_UNIFORM_BUFFER, frameConstantsBinding, uniformBuffer.get(), offset, sizeof(FrameConstants));
+    }
+}
+
+GLintptr uploadNodeTransforms(StreamBuffer &uniformBuffer, std::vector<glm::mat4> const &transforms)
+{
+    // Round up to whole windows, every window is bound with its full size
+    unsigned int windowCount = unsigned((transforms.size() + maxNodeTransforms - 1) / maxNodeTransforms);
+    GLsizeiptr size = std::max(windowCount, 1u) * nodeTransformWindowBytes;
+
+    GLintptr offset;
+    void *destination = uniformBuffer.map(size, getUniformBufferAlignment(), offset);
+    if (destination == nullptr)
+    {
+        return -1;
+    }
+
+    memcpy(destination, transforms.data(), transforms.size() * sizeof(glm::mat4));
+    uniformBuffer.unmap();
+
+    return offset;
+}
+
+int bindNodeTransformWindow(GLuint buffer, GLintptr transformsOffset, unsigned int transformIndex)
+{
+    unsigned int window = transformIndex / maxNodeTransforms;
+    getGLStateCache().bindBufferRange(GL_UNIFORM_BUFFER, nodeTransformsBinding, buffer,
+                                      transformsOffset + GLintptr(window) * nodeTransformWindowBytes, nodeTransformWindowBytes);
+
+    return int(transformIndex % maxNodeTransforms);
+}
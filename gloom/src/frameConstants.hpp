@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/mat4x4.hpp>
+#include <vector>
+#include "streamBuffer.hpp"
+
+// Matches the std140 layout of the FrameConstants block in scene.vert
+struct FrameConstants {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+};
+
+// Uniform buffer binding points shared by the scene shaders
+const GLuint frameConstantsBinding = 0;
+const GLuint nodeTransformsBinding = 1;
+
+// Number of world matrices visible to a draw at once. 256 matrices take 16 KB,
+// which is the smallest uniform block size every implementation has to support.
+// Larger scenes bind the transform buffer one window of maxNodeTransforms at a time.
+const unsigned int maxNodeTransforms = 256;
+const GLsizeiptr nodeTransformWindowBytes = maxNodeTransforms * sizeof(glm::mat4);
+
+// Connects the uniform blocks of a program to the binding points above
+void bindSceneUniformBlocks(GLuint program);
+
+// Offset alignment required by glBindBufferRange for uniform buffers
+GLsizeiptr getUniformBufferAlignment();
+
+// Size of a stream buffer region able to hold the frame constants and transformCount matrices
+GLsizeiptr getSceneUniformBytesPerFrame(unsigned int transformCount);
+
+// Uploads the frame constants into the stream buffer and binds them
+void uploadFrameConstants(StreamBuffer &uniformBuffer, FrameConstants const &constants);
+
+// Uploads all the world matrices of a frame at once. Returns the offset of the first one,
+// to be given to bindNodeTransformWindow(), or -1 if the buffer is full.
+GLintptr uploadNodeTransforms(StreamBuffer &uniformBuffer, std::vector<glm::mat4> const &transforms);
+
+// Binds the window of maxNodeTransforms matrices containing transformIndex
+// and returns the index of the matrix within that window
+int bindNodeTransformWindow(GLuint buffer, GLintptr transformsOffset, unsigned int transformIndex);
@@ -0,0 +1,630 @@
+#include "frameGraph.hpp"
+#include "glStateCache.hpp"
+#include "debugLayer.hpp"
+#include "program.hpp"
+#include <algorithm>
+#include <cstdio>
+
+static bool isDepthFormat(GLenum format)
+{
+    return format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24 ||
+           format == GL_DEPTH_COMPONENT32F || format == GL_DEPTH24_STENCIL8 ||
+           format == GL_DEPTH32F_STENCIL8;
+}
+
+static bool hasStencil(GLenum format)
+{
+    return format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+}
+
+static long long getBytesPerPixel(GLenum format)
+{
+    switch (format)
+    {
+    case GL_R8:                 return 1;
+    case GL_R16F:
+    case GL_DEPTH_COMPONENT16:  return 2;
+    case GL_RGBA16F:
+    case GL_DEPTH32F_STENCIL8:  return 8;
+    case GL_RGBA32F:            return 16;
+    default:                    return 4;
+    }
+}
+
+// --- Builder and context ---
+
+FrameGraphResource FrameGraphBuilder::create(const char *name, FrameGraphTextureDescription const &description)
+{
+    FrameGraph::Resource resource;
+    resource.name = name;
+    resource.description = description;
+    graph.resourceList.push_back(resource);
+    return FrameGraphResource(graph.resourceList.size() - 1);
+}
+
+FrameGraphResource FrameGraphBuilder::read(FrameGraphResource resource, FrameGraphAccess access)
+{
+    graph.passes[pass].reads.push_back({resource, access});
+    return resource;
+}
+
+FrameGraphResource FrameGraphBuilder::write(FrameGraphResource resource, FrameGraphAccess access)
+{
+    graph.passes[pass].writes.push_back({resource, access});
+    return resource;
+}
+
+void FrameGraphBuilder::setSideEffect()
+{
+    graph.passes[pass].sideEffect = true;
+}
+
+FrameGraphResource FrameGraphContext::getRead(unsigned int index) const
+{
+    return graph.passes[pass].reads.at(index).resource;
+}
+
+FrameGraphResource FrameGraphContext::getWrite(unsigned int index) const
+{
+    return graph.passes[pass].writes.at(index).resource;
+}
+
+GLuint FrameGraphContext::getTexture(FrameGraphResource resource) const
+{
+    return graph.getTexture(resource);
+}
+
+FrameGraphTextureDescription const & FrameGraphContext::getDescription(FrameGraphResource resource) const
+{
+    return graph.resourceList.at(resource).description;
+}
+
+GLuint FrameGraphContext::getPassFramebuffer() const
+{
+    return graph.passes[pass].framebuffer;
+}
+
+GLuint FrameGraphContext::getFramebuffer(std::vector<FrameGraphResource> const &attachments) const
+{
+    return graph.getFramebuffer(attachments);
+}
+
+// --- Graph ---
+
+FrameGraph::FrameGraph(GpuResourceManager &resources) : resources(resources), emptyVertexArray(&resources)
+{
+}
+
+FrameGraph::~FrameGraph()
+{
+    for (auto const &framebuffer : framebuffers)
+    {
+        glDeleteFramebuffers(1, &framebuffer.second);
+    }
+    for (Texture &texture : textures)
+    {
+        glDeleteTextures(1, &texture.texture);
+        getGLStateCache().forgetTexture(texture.texture);
+        resources.recordRelease(CATEGORY_TEXTURE, texture.bytes);
+    }
+}
+
+void FrameGraph::reset()
+{
+    passes.clear();
+    resourceList.clear();
+}
+
+FrameGraphResource FrameGraph::importFramebuffer(const char *name, GLuint framebuffer, int width, int height)
+{
+    Resource resource;
+    resource.name = name;
+    resource.description.width = width;
+    resource.description.height = height;
+    resource.imported = true;
+    resource.importedFramebuffer = framebuffer;
+    resourceList.push_back(resource);
+    return FrameGraphResource(resourceList.size() - 1);
+}
+
+void FrameGraph::addPass(const char *name, std::function<void(FrameGraphBuilder &)> const &setup,
+                         std::function<void(FrameGraphContext &)> const &execute)
+{
+    Pass pass;
+    pass.name = name;
+    pass.execute = execute;
+    passes.push_back(pass);
+
+    FrameGraphBuilder builder(*this, unsigned(passes.size() - 1));
+    setup(builder);
+}
+
+void FrameGraph::addPresentPass(FrameGraphResource colour, FrameGraphResource target,
+                                int sourceWidth, int sourceHeight)
+{
+    FrameGraphTextureDescription description = resourceList.at(colour).description;
+    FrameGraphTextureDescription const &targetDescription = resourceList.at(target).description;
+    if (sourceWidth <= 0 || sourceHeight <= 0)
+    {
+        sourceWidth = description.width;
+        sourceHeight = description.height;
+    }
+
+    // Resolve the samples first, a multisampled texture cannot be read with texelFetch on a sampler2D
+    FrameGraphResource presented = colour;
+    if (description.samples > 1)
+    {
+        description.samples = 1;
+        addPass("Resolve", [&](FrameGraphBuilder &builder)
+        {
+            builder.read(colour);
+            presented = builder.write(builder.create("resolved colour", description));
+        },
+        [sourceWidth, sourceHeight](FrameGraphContext &context)
+        {
+            // Only the part holding the image is resolved
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, context.getFramebuffer({context.getRead(0)}));
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, context.getPassFramebuffer());
+            glBlitFramebuffer(0, 0, sourceWidth, sourceHeight, 0, 0, sourceWidth, sourceHeight,
+                              GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        });
+    }
+
+    if (presentProgram == nullptr)
+    {
+        presentProgram = resources.createProgram("../gloom/shaders/fullscreenTriangle.vert", "../gloom/shaders/present.frag");
+        presentMappingLocation = glGetUniformLocation(presentProgram->get(), "sourceMapping");
+    }
+
+    // Texture coordinates of the source for each pixel of the target, and those of the
+    // centre of the last texel of the image, beyond which the filter would read garbage
+    glm::vec4 mapping(float(sourceWidth) / float(description.width * targetDescription.width),
+                      float(sourceHeight) / float(description.height * targetDescription.height),
+                      (float(sourceWidth) - 0.5f) / float(description.width),
+                      (float(sourceHeight) - 0.5f) / float(description.height));
+
+    GpuProgram *program = presentProgram;
+    GLint mappingLocation = presentMappingLocation;
+    GLuint vao = emptyVertexArray.get();
+    addPass("Present", [&](FrameGraphBuilder &builder)
+    {
+        builder.read(presented);
+        builder.write(target);
+    },
+    [program, mappingLocation, mapping, vao](FrameGraphContext &context)
+    {
+        GLStateCache &state = getGLStateCache();
+        state.disable(GL_DEPTH_TEST);
+        state.disable(GL_BLEND);
+
+        state.useProgram(program->get());
+        state.uniform4f(mappingLocation, mapping);
+        state.bindTexture(0, GL_TEXTURE_2D, context.getTexture(context.getRead(0)));
+        state.bindVertexArray(vao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        state.enable(GL_DEPTH_TEST);
+    });
+}
+
+void FrameGraph::compile()
+{
+    frame++;
+    stats = FrameGraphStats();
+    stats.passes = unsigned(passes.size());
+
+    cullPasses();
+    assignTextures();
+    placeBarriers();
+    createFramebuffers();
+}
+
+void FrameGraph::cullPasses()
+{
+    for (Resource &resource : resourceList)
+    {
+        resource.writers.clear();
+        resource.referenceCount = 0;
+    }
+
+    // A pass is needed by the resources it writes, a resource by the passes reading it
+    for (unsigned int i = 0; i < passes.size(); i++)
+    {
+        Pass &pass = passes[i];
+        pass.referenceCount = unsigned(pass.writes.size());
+        for (ResourceAccess const &read : pass.reads)
+        {
+            resourceList[read.resource].referenceCount++;
+        }
+        for (ResourceAccess const &write : pass.writes)
+        {
+            resourceList[write.resource].writers.push_back(i);
+
+            // What reaches an imported framebuffer is visible outside of the graph
+            if (resourceList[write.resource].imported)
+            {
+                pass.sideEffect = true;
+            }
+        }
+    }
+
+    // Release the passes nothing depends on, which may leave their inputs unused in turn
+    std::vector<unsigned int> unusedPasses;
+    for (unsigned int i = 0; i < passes.size(); i++)
+    {
+        passes[i].culled = false;
+    }
+    std::vector<FrameGraphResource> unusedResources;
+    for (unsigned int i = 0; i < resourceList.size(); i++)
+    {
+        if (resourceList[i].referenceCount == 0)
+        {
+            unusedResources.push_back(i);
+        }
+    }
+    for (unsigned int i = 0; i < passes.size(); i++)
+    {
+        if (passes[i].referenceCount == 0 && !passes[i].sideEffect)
+        {
+            unusedPasses.push_back(i);
+        }
+    }
+
+    while (!unusedResources.empty() || !unusedPasses.empty())
+    {
+        if (!unusedResources.empty())
+        {
+            Resource &resource = resourceList[unusedResources.back()];
+            unusedResources.pop_back();
+            for (unsigned int writer : resource.writers)
+            {
+                Pass &pass = passes[writer];
+                if (pass.referenceCount > 0 && --pass.referenceCount == 0 && !pass.sideEffect)
+                {
+                    unusedPasses.push_back(writer);
+                }
+            }
+            continue;
+        }
+
+        Pass &pass = passes[unusedPasses.back()];
+        unusedPasses.pop_back();
+        pass.culled = true;
+        stats.culledPasses++;
+        for (ResourceAccess const &read : pass.reads)
+        {
+            if (--resourceList[read.resource].referenceCount == 0)
+            {
+                unusedResources.push_back(read.resource);
+            }
+        }
+    }
+}
+
+void FrameGraph::assignTextures()
+{
+    // Lifetime of each resource, in passes which are executed
+    for (unsigned int i = 0; i < passes.size(); i++)
+    {
+        if (passes[i].culled)
+        {
+            continue;
+        }
+        for (std::vector<ResourceAccess> const *accesses : {&passes[i].reads, &passes[i].writes})
+        {
+            for (ResourceAccess const &access : *accesses)
+            {
+                Resource &resource = resourceList[access.resource];
+                resource.firstPass = std::min(resource.firstPass, i);
+                resource.lastPass = std::max(resource.lastPass, i);
+            }
+        }
+    }
+
+    for (Texture &texture : textures)
+    {
+        texture.busyUntil = -1;
+    }
+
+    // Hand out the textures in execution order, a texture is free again once the last
+    // pass using its previous resource is done
+    for (unsigned int i = 0; i < passes.size(); i++)
+    {
+        for (Resource &resource : resourceList)
+        {
+            if (resource.imported || resource.firstPass != i)
+            {
+                continue;
+            }
+            stats.transientTextures++;
+
+            int chosen = -1;
+            for (unsigned int t = 0; t < textures.size(); t++)
+            {
+                if (textures[t].busyUntil < int(i) && textures[t].description == resource.description)
+                {
+                    chosen = int(t);
+                    break;
+                }
+            }
+
+            if (chosen < 0)
+            {
+                Texture texture;
+                texture.description = resource.description;
+                FrameGraphTextureDescription const &description = resource.description;
+
+                glGenTextures(1, &texture.texture);
+                if (description.samples > 1)
+                {
+                    getGLStateCache().bindTexture(0, GL_TEXTURE_2D_MULTISAMPLE, texture.texture);
+                    glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, description.samples, description.format,
+                                            description.width, description.height, GL_TRUE);
+                }
+                else
+                {
+                    // The format and type only describe the data passed in, of which there is none,
+                    // but they must still be compatible with the internal format
+                    GLenum format = GL_RGBA;
+                    GLenum type = GL_UNSIGNED_BYTE;
+                    if (isDepthFormat(description.format))
+                    {
+                        format = hasStencil(description.format) ? GL_DEPTH_STENCIL : GL_DEPTH_COMPONENT;
+                        type = hasStencil(description.format) ? GL_UNSIGNED_INT_24_8 : GL_FLOAT;
+                        if (description.format == GL_DEPTH32F_STENCIL8)
+                        {
+                            type = GL_FLOAT_32_UNSIGNED_INT_24_8_REV;
+                        }
+                    }
+
+                    getGLStateCache().bindTexture(0, GL_TEXTURE_2D, texture.texture);
+                    glTexImage2D(GL_TEXTURE_2D, 0, description.format, description.width, description.height,
+                                 0, format, type, nullptr);
+                    // texelFetch ignores the filter, the linear one is for the upscaling present
+                    GLint filter = isDepthFormat(description.format) ? GL_NEAREST : GL_LINEAR;
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+                }
+                setGLObjectLabel(GL_TEXTURE, texture.texture, "frame graph " + resource.name);
+
+                texture.bytes = (long long) description.width * description.height *
+                                getBytesPerPixel(description.format) * description.samples;
+                resources.recordAllocation(CATEGORY_TEXTURE, texture.bytes);
+
+                textures.push_back(texture);
+                chosen = int(textures.size() - 1);
+            }
+
+            resource.texture = chosen;
+            textures[chosen].busyUntil = int(resource.lastPass);
+            textures[chosen].lastUsedFrame = frame;
+        }
+    }
+
+    for (Texture const &texture : textures)
+    {
+        if (texture.lastUsedFrame == frame)
+        {
+            stats.physicalTextures++;
+        }
+    }
+}
+
+void FrameGraph::placeBarriers()
+{
+    // Whether the last access to each resource wrote it as an image
+    std::vector<bool> storageWritten(resourceList.size(), false);
+
+    for (Pass &pass : passes)
+    {
+        pass.barriers = 0;
+        if (pass.culled)
+        {
+            continue;
+        }
+
+        // Image writes are not ordered with the accesses which follow, unlike rendering
+        for (std::vector<ResourceAccess> const *accesses : {&pass.reads, &pass.writes})
+        {
+            for (ResourceAccess const &access : *accesses)
+            {
+                if (!storageWritten[access.resource])
+                {
+                    continue;
+                }
+                switch (access.access)
+                {
+                case ACCESS_RENDER_TARGET: pass.barriers |= GL_FRAMEBUFFER_BARRIER_BIT; break;
+                case ACCESS_SAMPLED:       pass.barriers |= GL_TEXTURE_FETCH_BARRIER_BIT; break;
+                case ACCESS_STORAGE:       pass.barriers |= GL_SHADER_IMAGE_ACCESS_BARRIER_BIT; break;
+                }
+            }
+        }
+
+        for (ResourceAccess const &read : pass.reads)
+        {
+            storageWritten[read.resource] = false;
+        }
+        for (ResourceAccess const &write : pass.writes)
+        {
+            storageWritten[write.resource] = (write.access == ACCESS_STORAGE);
+        }
+
+        if (pass.barriers != 0)
+        {
+            stats.barriers++;
+        }
+    }
+}
+
+void FrameGraph::createFramebuffers()
+{
+    for (Pass &pass : passes)
+    {
+        pass.framebuffer = 0;
+        if (pass.culled)
+        {
+            continue;
+        }
+
+        std::vector<FrameGraphResource> attachments;
+        for (ResourceAccess const &write : pass.writes)
+        {
+            if (write.access != ACCESS_RENDER_TARGET)
+            {
+                continue;
+            }
+            if (resourceList[write.resource].imported)
+            {
+                pass.framebuffer = resourceList[write.resource].importedFramebuffer;
+                attachments.clear();
+                break;
+            }
+            attachments.push_back(write.resource);
+        }
+
+        if (!attachments.empty())
+        {
+            pass.framebuffer = getFramebuffer(attachments);
+        }
+    }
+}
+
+GLuint FrameGraph::getTexture(FrameGraphResource resource) const
+{
+    int texture = resourceList.at(resource).texture;
+    return (texture < 0) ? 0 : textures[texture].texture;
+}
+
+GLuint FrameGraph::getFramebuffer(std::vector<FrameGraphResource> const &attachments)
+{
+    std::vector<GLuint> key;
+    for (FrameGraphResource attachment : attachments)
+    {
+        key.push_back(getTexture(attachment));
+    }
+
+    auto cached = framebuffers.find(key);
+    if (cached != framebuffers.end())
+    {
+        return cached->second;
+    }
+
+    GLuint framebuffer = 0;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+    std::vector<GLenum> drawBuffers;
+    for (FrameGraphResource attachment : attachments)
+    {
+        FrameGraphTextureDescription const &description = resourceList[attachment].description;
+        GLenum target = (description.samples > 1) ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+
+        GLenum point = GL_COLOR_ATTACHMENT0 + GLenum(drawBuffers.size());
+        if (isDepthFormat(description.format))
+        {
+            point = hasStencil(description.format) ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+        }
+        else
+        {
+            drawBuffers.push_back(point);
+        }
+        glFramebufferTexture2D(GL_FRAMEBUFFER, point, target, getTexture(attachment), 0);
+    }
+
+    if (drawBuffers.empty())
+    {
+        glDrawBuffer(GL_NONE);
+    }
+    else
+    {
+        glDrawBuffers(GLsizei(drawBuffers.size()), drawBuffers.data());
+    }
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        fprintf(stderr, "Frame graph framebuffer with %u attachments is incomplete\n", unsigned(attachments.size()));
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    framebuffers[key] = framebuffer;
+    return framebuffer;
+}
+
+void FrameGraph::execute()
+{
+    for (unsigned int i = 0; i < passes.size(); i++)
+    {
+        Pass &pass = passes[i];
+        if (pass.culled)
+        {
+            continue;
+        }
+
+        GLDebugGroup group(pass.name.c_str());
+
+        if (pass.barriers != 0)
+        {
+            glMemoryBarrier(pass.barriers);
+        }
+
+        // Draw over the whole of the first render target
+        glBindFramebuffer(GL_FRAMEBUFFER, pass.framebuffer);
+        for (ResourceAccess const &write : pass.writes)
+        {
+            if (write.access == ACCESS_RENDER_TARGET)
+            {
+                FrameGraphTextureDescription const &description = resourceList[write.resource].description;
+                glViewport(0, 0, description.width, description.height);
+                break;
+            }
+        }
+
+        FrameGraphContext context(*this, i);
+        pass.execute(context);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    releaseUnusedTextures();
+
+    for (Texture const &texture : textures)
+    {
+        stats.textureBytes += texture.bytes;
+    }
+}
+
+void FrameGraph::releaseUnusedTextures()
+{
+    for (size_t t = 0; t < textures.size();)
+    {
+        Texture &texture = textures[t];
+        if (texture.lastUsedFrame == frame)
+        {
+            t++;
+            continue;
+        }
+
+        // The framebuffers using the texture go with it
+        for (auto framebuffer = framebuffers.begin(); framebuffer != framebuffers.end();)
+        {
+            std::vector<GLuint> const &attached = framebuffer->first;
+            if (std::find(attached.begin(), attached.end(), texture.texture) != attached.end())
+            {
+                glDeleteFramebuffers(1, &framebuffer->second);
+                framebuffer = framebuffers.erase(framebuffer);
+            }
+            else
+            {
+                ++framebuffer;
+            }
+        }
+
+        glDeleteTextures(1, &texture.texture);
+        getGLStateCache().forgetTexture(texture.texture);
+        resources.recordRelease(CATEGORY_TEXTURE, texture.bytes);
+        textures.erase(textures.begin() + t);
+    }
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+#include "gpuResources.hpp"
+
+// Handle of a resource of a frame graph, only valid until the next reset()
+typedef unsigned int FrameGraphResource;
+
+// Size and format of a render target
+struct FrameGraphTextureDescription {
+    int width = 0;
+    int height = 0;
+
+    // Internal format: GL_RGBA8, GL_RGBA16F, GL_DEPTH24_STENCIL8, ...
+    GLenum format = GL_RGBA8;
+
+    // More than one sample gives a multisampled texture, see addPresentPass()
+    int samples = 1;
+
+    bool operator ==(FrameGraphTextureDescription const &other) const {
+        return width == other.width && height == other.height &&
+               format == other.format && samples == other.samples;
+    }
+};
+
+// How a pass accesses a resource, which decides the barriers placed between passes
+enum FrameGraphAccess {
+    // Attached to the framebuffer the pass draws into
+    ACCESS_RENDER_TARGET = 0,
+
+    // Read through a sampler, or as the source of a blit
+    ACCESS_SAMPLED,
+
+    // Read or written as an image by shaders (OpenGL 4.2). Unlike the other accesses,
+    // the next pass using the resource must wait for the writes with glMemoryBarrier.
+    ACCESS_STORAGE
+};
+
+// Counters of the last executed frame
+struct FrameGraphStats {
+    unsigned int passes = 0;
+    unsigned int culledPasses = 0;
+
+    // Transient textures declared by the passes, and the textures actually used for them
+    unsigned int transientTextures = 0;
+    unsigned int physicalTextures = 0;
+
+    unsigned int barriers = 0;
+
+    // Memory of all the textures kept by the graph
+    long long textureBytes = 0;
+};
+
+class FrameGraph;
+
+// Given to the setup function of a pass, to declare the resources it uses
+class FrameGraphBuilder {
+public:
+    // Declares a texture which only lives during the frame
+    FrameGraphResource create(const char *name, FrameGraphTextureDescription const &description);
+
+    FrameGraphResource read(FrameGraphResource resource, FrameGraphAccess access = ACCESS_SAMPLED);
+    FrameGraphResource write(FrameGraphResource resource, FrameGraphAccess access = ACCESS_RENDER_TARGET);
+
+    // Keeps the pass even when nothing reads what it writes, for instance because it
+    // reads data back to the CPU
+    void setSideEffect();
+
+private:
+    friend class FrameGraph;
+    FrameGraphBuilder(FrameGraph &graph, unsigned int pass) : graph(graph), pass(pass) {}
+
+    FrameGraph &graph;
+    unsigned int pass;
+};
+
+// Given to the execute function of a pass, to find the OpenGL objects of its resources
+class FrameGraphContext {
+public:
+    // The resources declared by the pass, in declaration order
+    FrameGraphResource getRead(unsigned int index) const;
+    FrameGraphResource getWrite(unsigned int index) const;
+
+    GLuint getTexture(FrameGraphResource resource) const;
+    FrameGraphTextureDescription const & getDescription(FrameGraphResource resource) const;
+
+    // The framebuffer holding the render targets written by the pass, bound before the
+    // pass is executed. Imported framebuffers are returned as they are.
+    GLuint getPassFramebuffer() const;
+
+    // A framebuffer with the given textures attached, colours first, then depth
+    GLuint getFramebuffer(std::vector<FrameGraphResource> const &attachments) const;
+
+private:
+    friend class FrameGraph;
+    FrameGraphContext(FrameGraph &graph, unsigned int pass) : graph(graph), pass(pass) {}
+
+    FrameGraph &graph;
+    unsigned int pass;
+};
+
+// Describes the passes of a frame and the render targets they read and write, then
+// schedules them. The graph is rebuilt every frame:
+//
+//    graph.reset();
+//    FrameGraphResource backbuffer = graph.importFramebuffer("backbuffer", 0, width, height);
+//    graph.addPass("Scene", setup, execute);  // setup declares the resources, execute draws
+//    graph.addPresentPass(colour, backbuffer);
+//    graph.compile();
+//    graph.execute();
+//
+// compile() culls the passes whose results are never used, places the memory barriers
+// and assigns a texture to every transient resource. Transients whose lifetimes do not
+// overlap share a texture when their descriptions match. OpenGL cannot alias the memory
+// of textures of different formats, so reusing whole texture objects is as far as the
+// aliasing goes. The textures are kept between frames and released once unused.
+//
+// The passes run in the order they were added, which always respects their dependencies
+// since a pass can only use the resources declared before it.
+class FrameGraph {
+public:
+    explicit FrameGraph(GpuResourceManager &resources);
+    ~FrameGraph();
+
+    // Forgets the passes and resources of the previous frame, keeping the textures
+    void reset();
+
+    // Makes a framebuffer created elsewhere usable as a render target. The passes writing it
+    // are never culled. 0 is the default framebuffer.
+    FrameGraphResource importFramebuffer(const char *name, GLuint framebuffer, int width, int height);
+
+    // Calls setup right away to declare the resources of the pass. execute is called by
+    // execute() if the pass is not culled.
+    void addPass(const char *name, std::function<void(FrameGraphBuilder &)> const &setup,
+                 std::function<void(FrameGraphContext &)> const &execute);
+
+    // Adds the passes copying colour to target, typically the imported default framebuffer.
+    //
+    // About multisampling: the default framebuffer may be multisampled (windowSamples), and
+    // OpenGL does not allow blitting into a multisampled framebuffer. So a multisampled
+    // colour is first resolved by a blit into a transient single-sampled texture, which is
+    // then drawn with a full-screen triangle. Rendering the scene into multisampled
+    // transients makes the samples of the window redundant; they are only kept for the
+    // demos which draw directly to the window.
+    //
+    // When a source size is given, only that lower left corner of colour holds the image,
+    // which is stretched over the whole target with bilinear filtering. This is how a frame
+    // rendered at a lower resolution is upscaled to the window.
+    void addPresentPass(FrameGraphResource colour, FrameGraphResource target,
+                        int sourceWidth = 0, int sourceHeight = 0);
+
+    void compile();
+    void execute();
+
+    FrameGraphStats const & getStats() const { return stats; }
+
+private:
+    friend class FrameGraphBuilder;
+    friend class FrameGraphContext;
+
+    FrameGraph(FrameGraph const &) = delete;
+    FrameGraph & operator =(FrameGraph const &) = delete;
+
+    struct ResourceAccess {
+        FrameGraphResource resource;
+        FrameGraphAccess access;
+    };
+
+    struct Pass {
+        std::string name;
+        std::function<void(FrameGraphContext &)> execute;
+        std::vector<ResourceAccess> reads;
+        std::vector<ResourceAccess> writes;
+        bool sideEffect = false;
+
+        // Filled by compile()
+        unsigned int referenceCount = 0;
+        bool culled = false;
+        GLbitfield barriers = 0;
+        GLuint framebuffer = 0;
+    };
+
+    struct Resource {
+        std::string name;
+        FrameGraphTextureDescription description;
+        bool imported = false;
+        GLuint importedFramebuffer = 0;
+
+        // Filled by compile()
+        std::vector<unsigned int> writers;
+        unsigned int referenceCount = 0;
+        unsigned int firstPass = ~0u;
+        unsigned int lastPass = 0;
+        int texture = -1;
+    };
+
+    // A texture owned by the graph, shared by the transients whose lifetimes do not overlap
+    struct Texture {
+        FrameGraphTextureDescription description;
+        GLuint texture = 0;
+        long long bytes = 0;
+
+        // Last pass of the current frame using the texture, or -1 when it is free
+        int busyUntil = -1;
+        unsigned long lastUsedFrame = 0;
+    };
+
+    void cullPasses();
+    void assignTextures();
+    void placeBarriers();
+    void createFramebuffers();
+
+    // Deletes the textures the last frame did not use, with their framebuffers
+    void releaseUnusedTextures();
+
+    GLuint getFramebuffer(std::vector<FrameGraphResource> const &attachments);
+    GLuint getTexture(FrameGraphResource resource) const;
+
+    GpuResourceManager &resources;
+
+    std::vector<Pass> passes;
+    std::vector<Resource> resourceList;
+    std::vector<Texture> textures;
+
+    // Framebuffers of the attachment combinations used so far, keyed by texture names
+    std::map<std::vector<GLuint>, GLuint> framebuffers;
+
+    // Used by the present pass
+    GpuProgram *presentProgram = nullptr;
+    GLint presentMappingLocation = -1;
+    GpuVertexArray emptyVertexArray;
+
+    unsigned long frame = 0;
+    FrameGraphStats stats;
+};
@@ -0,0 +1,147 @@
+#include "frustumCulling.hpp"
+#include "toolbox.hpp"
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FRUSTUM_SSE 1
+#endif
+
+FrustumPlanes computeFrustumPlanes(glm::mat4 const &viewProjection)
+{
+    glm::vec4 planes[6];
+    extractFrustumPlanes(viewProjection, planes);
+
+    FrustumPlanes frustum;
+    for (int i = 0; i < 8; i++)
+    {
+        glm::vec4 plane = i < 6 ? planes[i] : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        frustum.normalX[i] = plane.x;
+        frustum.normalY[i] = plane.y;
+        frustum.normalZ[i] = plane.z;
+        frustum.distance[i] = plane.w;
+        frustum.absoluteX[i] = std::fabs(plane.x);
+        frustum.absoluteY[i] = std::fabs(plane.y);
+        frustum.absoluteZ[i] = std::fabs(plane.z);
+    }
+    return frustum;
+}
+
+FrustumTest testBoxAgainstFrustum(FrustumPlanes const &frustum, float3 const &boundsMin, float3 const &boundsMax,
+                                  int &planeHint, FrustumCullingStats &stats)
+{
+    float centreX = (boundsMin.x + boundsMax.x) * 0.5f;
+    float centreY = (boundsMin.y + boundsMax.y) * 0.5f;
+    float centreZ = (boundsMin.z + boundsMax.z) * 0.5f;
+    float extentX = (boundsMax.x - boundsMin.x) * 0.5f;
+    float extentY = (boundsMax.y - boundsMin.y) * 0.5f;
+    float extentZ = (boundsMax.z - boundsMin.z) * 0.5f;
+
+    // A box outside of the view usually stays behind the same plane for many frames
+    int hint = planeHint;
+    stats.planeTests++;
+    if (frustum.normalX[hint] * centreX + frustum.normalY[hint] * centreY + frustum.normalZ[hint] * centreZ +
+        frustum.distance[hint] + frustum.absoluteX[hint] * extentX + frustum.absoluteY[hint] * extentY +
+        frustum.absoluteZ[hint] * extentZ < 0.0f)
+    {
+        stats.hintRejections++;
+        return FRUSTUM_OUTSIDE;
+    }
+
+    // Signed distance of the centre to each plane, and extent of the box along its normal
+    stats.planeTests += 6;
+    int outsideMask = 0;
+    int insideMask = 0;
+#ifdef FRUSTUM_SSE
+    __m128 zero = _mm_setzero_ps();
+    for (int group = 0; group < 8; group += 4)
+    {
+        __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&frustum.normalX[group]), _mm_set1_ps(centreX)),
+                                                _mm_mul_ps(_mm_loadu_ps(&frustum.normalY[group]), _mm_set1_ps(centreY))),
+                                     _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&frustum.normalZ[group]), _mm_set1_ps(centreZ)),
+                                                _mm_loadu_ps(&frustum.distance[group])));
+        __m128 extent = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&frustum.absoluteX[group]), _mm_set1_ps(extentX)),
+                                              _mm_mul_ps(_mm_loadu_ps(&frustum.absoluteY[group]), _mm_set1_ps(extentY))),
+                                   _mm_mul_ps(_mm_loadu_ps(&frustum.absoluteZ[group]), _mm_set1_ps(extentZ)));
+        outsideMask |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, extent), zero)) << group;
+        insideMask |= _mm_movemask_ps(_mm_cmpge_ps(_mm_sub_ps(distance, extent), zero)) << group;
+    }
+#else
+    for (int plane = 0; plane < 8; plane++)
+    {
+        float distance = frustum.normalX[plane] * centreX + frustum.normalY[plane] * centreY +
+                         frustum.normalZ[plane] * centreZ + frustum.distance[plane];
+        float extent = frustum.absoluteX[plane] * extentX + frustum.absoluteY[plane] * extentY +
+                       frustum.absoluteZ[plane] * extentZ;
+        outsideMask |= int(distance + extent < 0.0f) << plane;
+        insideMask |= int(distance - extent >= 0.0f) << plane;
+    }
+#endif
+
+    if (outsideMask != 0)
+    {
+        int plane = 0;
+        while ((outsideMask & (1 << plane)) == 0)
+        {
+            plane++;
+        }
+        planeHint = plane;
+        return FRUSTUM_OUTSIDE;
+    }
+    return insideMask == 0xff ? FRUSTUM_INSIDE : FRUSTUM_INTERSECTING;
+}
+
+// Marks the dynamic nodes of a subtree, without testing them
+static void setSubtreeInFrustum(SceneNode *node, bool isInFrustum)
+{
+    if (node->isStatic)
+    {
+        return;
+    }
+
+    node->isInFrustum = isInFrustum;
+    for (SceneNode *child : node->children)
+    {
+        setSubtreeInFrustum(child, isInFrustum);
+    }
+}
+
+static void cullSubtree(SceneNode *node, FrustumPlanes const &frustum, FrustumCullingStats &stats)
+{
+    if (node->isStatic)
+    {
+        return;
+    }
+
+    // Nodes without bounds are kept, the nodes below them may have some
+    FrustumTest result = FRUSTUM_INTERSECTING;
+    if (node->hasWorldBounds)
+    {
+        stats.testedNodes++;
+        result = testBoxAgainstFrustum(frustum, node->worldBoundsMin, node->worldBoundsMax, node->frustumPlaneHint, stats);
+    }
+
+    if (result == FRUSTUM_OUTSIDE)
+    {
+        stats.culledSubtrees++;
+        setSubtreeInFrustum(node, false);
+        return;
+    }
+    if (result == FRUSTUM_INSIDE)
+    {
+        setSubtreeInFrustum(node, true);
+        return;
+    }
+
+    node->isInFrustum = true;
+    for (SceneNode *child : node->children)
+    {
+        cullSubtree(child, frustum, stats);
+    }
+}
+
+void cullSceneGraph(SceneNode *root, FrustumPlanes const &frustum, FrustumCullingStats &stats)
+{
+    stats = FrustumCullingStats();
+    cullSubtree(root, frustum, stats);
+}
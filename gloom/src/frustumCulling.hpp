@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glm/mat4x4.hpp>
+#include "floats.hpp"
+#include "sceneGraph.hpp"
+
+// The 6 planes of a view frustum, one array per component so that 4 planes are tested at
+// once. The last two entries are padding planes which contain everything.
+struct FrustumPlanes {
+    float normalX[8];
+    float normalY[8];
+    float normalZ[8];
+    float distance[8];
+
+    // Absolute values of the normals, to project the extent of a box on them
+    float absoluteX[8];
+    float absoluteY[8];
+    float absoluteZ[8];
+};
+
+FrustumPlanes computeFrustumPlanes(glm::mat4 const &viewProjection);
+
+enum FrustumTest {
+    FRUSTUM_OUTSIDE = 0,
+    FRUSTUM_INTERSECTING,
+    FRUSTUM_INSIDE
+};
+
+// Counters of the last cullSceneGraph()
+struct FrustumCullingStats {
+    unsigned int testedNodes = 0;
+    unsigned int culledSubtrees = 0;
+
+    // Planes tested, and rejections by the plane which rejected the subtree the frame before
+    unsigned int planeTests = 0;
+    unsigned int hintRejections = 0;
+};
+
+// Tests the box [boundsMin, boundsMax] against the frustum. planeHint is tested first, and
+// replaced by the plane rejecting the box when another one does.
+FrustumTest testBoxAgainstFrustum(FrustumPlanes const &frustum, float3 const &boundsMin, float3 const &boundsMax,
+                                  int &planeHint, FrustumCullingStats &stats);
+
+// Sets isInFrustum on every dynamic node, from the world bounds computed while visiting the
+// graph. A subtree entirely outside is rejected with a single test, and the nodes below a
+// subtree entirely inside are not tested at all. Static subtrees are drawn by their command
+// lists and left alone.
+void cullSceneGraph(SceneNode *root, FrustumPlanes const &frustum, FrustumCullingStats &stats);
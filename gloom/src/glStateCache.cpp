@@ -0,0 +1,333 @@
+#include "glStateCache.hpp"
+#include <cstring>
+#include <iterator>
+#include <glm/gtc/type_ptr.hpp>
+
+// Value of the names and enums which have not been set through the cache yet
+static const GLuint unknownName = ~0u;
+static const GLenum unknownEnum = ~0u;
+static const GLint unknownFlag = -1;
+
+static uint64_t makeKey(GLuint high, GLuint low)
+{
+    return (uint64_t(high) << 32) | uint64_t(low);
+}
+
+GLStateCache::GLStateCache()
+{
+    invalidate();
+}
+
+void GLStateCache::invalidate()
+{
+    program = unknownName;
+    vao = unknownName;
+    activeTextureUnit = unknownName;
+
+    blendSource = unknownEnum;
+    blendDestination = unknownEnum;
+    blendSourceAlpha = unknownEnum;
+    blendDestinationAlpha = unknownEnum;
+    depthFunction = unknownEnum;
+    cullFaceMode = unknownEnum;
+    depthWrite = unknownFlag;
+    colourWrite = unknownFlag;
+
+    buffers.clear();
+    bufferRanges.clear();
+    textures.clear();
+    capabilities.clear();
+    uniforms.clear();
+}
+
+void GLStateCache::beginFrame()
+{
+    lastFrameStats = frameStats;
+    frameStats = GLStateStats();
+}
+
+bool GLStateCache::update(bool changed)
+{
+    if (changed)
+    {
+        frameStats.issued++;
+    }
+    else
+    {
+        frameStats.skipped++;
+    }
+    return changed;
+}
+
+// --- Objects ---
+
+void GLStateCache::useProgram(GLuint newProgram)
+{
+    if (update(newProgram != program))
+    {
+        glUseProgram(newProgram);
+        program = newProgram;
+    }
+}
+
+void GLStateCache::bindVertexArray(GLuint newVao)
+{
+    if (update(newVao != vao))
+    {
+        glBindVertexArray(newVao);
+        vao = newVao;
+
+        // The index buffer binding is part of the VAO state
+        buffers.erase(GL_ELEMENT_ARRAY_BUFFER);
+    }
+}
+
+void GLStateCache::bindBuffer(GLenum target, GLuint buffer)
+{
+    auto bound = buffers.find(target);
+    if (update(bound == buffers.end() || bound->second != buffer))
+    {
+        glBindBuffer(target, buffer);
+        buffers[target] = buffer;
+    }
+}
+
+void GLStateCache::bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+    // A size of 0 stands for the whole buffer
+    auto bound = bufferRanges.find(makeKey(target, index));
+    if (update(bound == bufferRanges.end() || bound->second.buffer != buffer ||
+               bound->second.offset != 0 || bound->second.size != 0))
+    {
+        glBindBufferBase(target, index, buffer);
+        bufferRanges[makeKey(target, index)] = BufferRange{buffer, 0, 0};
+
+        // Binding to an indexed target also binds the generic target
+        buffers[target] = buffer;
+    }
+}
+
+void GLStateCache::bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    auto bound = bufferRanges.find(makeKey(target, index));
+    if (update(bound == bufferRanges.end() || bound->second.buffer != buffer ||
+               bound->second.offset != offset || bound->second.size != size))
+    {
+        glBindBufferRange(target, index, buffer, offset, size);
+        bufferRanges[makeKey(target, index)] = BufferRange{buffer, offset, size};
+        buffers[target] = buffer;
+    }
+}
+
+void GLStateCache::bindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+    auto bound = textures.find(makeKey(unit, target));
+    if (!update(bound == textures.end() || bound->second != texture))
+    {
+        return;
+    }
+
+    if (unit != activeTextureUnit)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        activeTextureUnit = unit;
+    }
+
+    glBindTexture(target, texture);
+    textures[makeKey(unit, target)] = texture;
+}
+
+// --- Fixed function state ---
+
+void GLStateCache::setEnabled(GLenum capability, bool enabled)
+{
+    auto current = capabilities.find(capability);
+    if (update(current == capabilities.end() || current->second != enabled))
+    {
+        if (enabled)
+        {
+            glEnable(capability);
+        }
+        else
+        {
+            glDisable(capability);
+        }
+        capabilities[capability] = enabled;
+    }
+}
+
+void GLStateCache::blendFunc(GLenum source, GLenum destination)
+{
+    // glBlendFunc sets the same factors for the colour and the alpha
+    if (update(source != blendSource || destination != blendDestination ||
+               source != blendSourceAlpha || destination != blendDestinationAlpha))
+    {
+        glBlendFunc(source, destination);
+        blendSource = source;
+        blendDestination = destination;
+        blendSourceAlpha = source;
+        blendDestinationAlpha = destination;
+    }
+}
+
+void GLStateCache::blendFuncSeparate(GLenum sourceColour, GLenum destinationColour,
+                                     GLenum sourceAlpha, GLenum destinationAlpha)
+{
+    if (update(sourceColour != blendSource || destinationColour != blendDestination ||
+               sourceAlpha != blendSourceAlpha || destinationAlpha != blendDestinationAlpha))
+    {
+        glBlendFuncSeparate(sourceColour, destinationColour, sourceAlpha, destinationAlpha);
+        blendSource = sourceColour;
+        blendDestination = destinationColour;
+        blendSourceAlpha = sourceAlpha;
+        blendDestinationAlpha = destinationAlpha;
+    }
+}
+
+void GLStateCache::depthFunc(GLenum function)
+{
+    if (update(function != depthFunction))
+    {
+        glDepthFunc(function);
+        depthFunction = function;
+    }
+}
+
+void GLStateCache::depthMask(GLboolean enabled)
+{
+    if (update(GLint(enabled) != depthWrite))
+    {
+        glDepthMask(enabled);
+        depthWrite = GLint(enabled);
+    }
+}
+
+void GLStateCache::colorMask(GLboolean enabled)
+{
+    // All the channels are masked together
+    if (update(GLint(enabled) != colourWrite))
+    {
+        glColorMask(enabled, enabled, enabled, enabled);
+        colourWrite = GLint(enabled);
+    }
+}
+
+void GLStateCache::cullFace(GLenum face)
+{
+    if (update(face != cullFaceMode))
+    {
+        glCullFace(face);
+        cullFaceMode = face;
+    }
+}
+
+// --- Uniforms ---
+
+bool GLStateCache::updateUniform(GLint location, const void *value, unsigned int size)
+{
+    // Inactive uniforms, and uniforms set while the program is unknown, are never cached
+    if (location < 0 || program == unknownName)
+    {
+        return update(location >= 0);
+    }
+
+    uint64_t key = makeKey(program, GLuint(location));
+    auto cached = uniforms.find(key);
+    if (update(cached == uniforms.end() || memcmp(cached->second.words, value, size) != 0))
+    {
+        memcpy(uniforms[key].words, value, size);
+        return true;
+    }
+    return false;
+}
+
+void GLStateCache::uniform1i(GLint location, GLint value)
+{
+    if (updateUniform(location, &value, sizeof(value)))
+    {
+        glUniform1i(location, value);
+    }
+}
+
+void GLStateCache::uniform1ui(GLint location, GLuint value)
+{
+    if (updateUniform(location, &value, sizeof(value)))
+    {
+        glUniform1ui(location, value);
+    }
+}
+
+void GLStateCache::uniform1f(GLint location, GLfloat value)
+{
+    if (updateUniform(location, &value, sizeof(value)))
+    {
+        glUniform1f(location, value);
+    }
+}
+
+void GLStateCache::uniform4f(GLint location, glm::vec4 const &value)
+{
+    if (updateUniform(location, glm::value_ptr(value), sizeof(value)))
+    {
+        glUniform4fv(location, 1, glm::value_ptr(value));
+    }
+}
+
+void GLStateCache::uniformMatrix4(GLint location, glm::mat4 const &value)
+{
+    if (updateUniform(location, glm::value_ptr(value), sizeof(value)))
+    {
+        glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+    }
+}
+
+// --- Deleted objects ---
+
+void GLStateCache::forgetProgram(GLuint deletedProgram)
+{
+    if (program == deletedProgram)
+    {
+        program = unknownName;
+    }
+
+    for (auto uniform = uniforms.begin(); uniform != uniforms.end();)
+    {
+        uniform = (GLuint(uniform->first >> 32) == deletedProgram) ? uniforms.erase(uniform) : std::next(uniform);
+    }
+}
+
+void GLStateCache::forgetVertexArray(GLuint deletedVao)
+{
+    if (vao == deletedVao)
+    {
+        vao = unknownName;
+        buffers.erase(GL_ELEMENT_ARRAY_BUFFER);
+    }
+}
+
+void GLStateCache::forgetBuffer(GLuint deletedBuffer)
+{
+    for (auto buffer = buffers.begin(); buffer != buffers.end();)
+    {
+        buffer = (buffer->second == deletedBuffer) ? buffers.erase(buffer) : std::next(buffer);
+    }
+
+    for (auto range = bufferRanges.begin(); range != bufferRanges.end();)
+    {
+        range = (range->second.buffer == deletedBuffer) ? bufferRanges.erase(range) : std::next(range);
+    }
+}
+
+void GLStateCache::forgetTexture(GLuint deletedTexture)
+{
+    for (auto texture = textures.begin(); texture != textures.end();)
+    {
+        texture = (texture->second == deletedTexture) ? textures.erase(texture) : std::next(texture);
+    }
+}
+
+GLStateCache & getGLStateCache()
+{
+    static GLStateCache cache;
+    return cache;
+}
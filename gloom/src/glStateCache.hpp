@@ -0,0 +1,126 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+#include <cstdint>
+#include <unordered_map>
+
+// Counters of the calls which went through the cache during one frame
+struct GLStateStats {
+    // Calls forwarded to OpenGL
+    unsigned int issued = 0;
+
+    // Calls dropped because the state was already set
+    unsigned int skipped = 0;
+};
+
+// Remembers the OpenGL state set through it and drops the calls which would not change
+// anything. Every piece of state starts unknown, so the first call always reaches OpenGL.
+//
+// Code which changes the state directly with gl* calls must either go through the cache
+// or call invalidate() afterwards, otherwise the cache could skip a call which is needed.
+// This lets call sites move to the cache one at a time.
+//
+// The cache tracks the state of one context and must only be used from the thread
+// which owns that context.
+class GLStateCache {
+public:
+    GLStateCache();
+
+    // Forgets all the cached state, the next call of each kind reaches OpenGL
+    void invalidate();
+
+    // Starts counting the calls of a new frame
+    void beginFrame();
+
+    // Objects
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vao);
+    void bindBuffer(GLenum target, GLuint buffer);
+    void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+    void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+    void bindTexture(GLuint unit, GLenum target, GLuint texture);
+
+    // Fixed function state
+    void setEnabled(GLenum capability, bool enabled);
+    void enable(GLenum capability)  { setEnabled(capability, true); }
+    void disable(GLenum capability) { setEnabled(capability, false); }
+    void blendFunc(GLenum source, GLenum destination);
+    void blendFuncSeparate(GLenum sourceColour, GLenum destinationColour,
+                           GLenum sourceAlpha, GLenum destinationAlpha);
+    void depthFunc(GLenum function);
+    void depthMask(GLboolean enabled);
+    void colorMask(GLboolean enabled);
+    void cullFace(GLenum face);
+
+    // Uniforms of the current program
+    void uniform1i(GLint location, GLint value);
+    void uniform1ui(GLint location, GLuint value);
+    void uniform1f(GLint location, GLfloat value);
+    void uniform4f(GLint location, glm::vec4 const &value);
+    void uniformMatrix4(GLint location, glm::mat4 const &value);
+
+    // Must be called when an object is deleted, as OpenGL may reuse its name
+    void forgetProgram(GLuint program);
+    void forgetVertexArray(GLuint vao);
+    void forgetBuffer(GLuint buffer);
+    void forgetTexture(GLuint texture);
+
+    // Counters of the current frame and of the last complete frame
+    GLStateStats const & getFrameStats() const     { return frameStats; }
+    GLStateStats const & getLastFrameStats() const { return lastFrameStats; }
+
+private:
+    GLStateCache(GLStateCache const &) = delete;
+    GLStateCache & operator =(GLStateCache const &) = delete;
+
+    // Counts the call and returns whether it has to be issued
+    bool update(bool changed);
+
+    // Caches a uniform value of the current program, returns whether it changed
+    bool updateUniform(GLint location, const void *value, unsigned int size);
+
+    struct BufferRange {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+
+    struct UniformValue {
+        uint32_t words[16];
+    };
+
+    GLuint program;
+    GLuint vao;
+    GLuint activeTextureUnit;
+
+    GLenum blendSource;
+    GLenum blendDestination;
+    GLenum blendSourceAlpha;
+    GLenum blendDestinationAlpha;
+    GLenum depthFunction;
+    GLenum cullFaceMode;
+    GLint depthWrite;
+    GLint colourWrite;
+
+    // Keyed by target
+    std::unordered_map<GLenum, GLuint> buffers;
+
+    // Keyed by target and binding index
+    std::unordered_map<uint64_t, BufferRange> bufferRanges;
+
+    // Keyed by texture unit and target
+    std::unordered_map<uint64_t, GLuint> textures;
+
+    std::unordered_map<GLenum, bool> capabilities;
+
+    // Keyed by program and uniform location
+    std::unordered_map<uint64_t, UniformValue> uniforms;
+
+    GLStateStats frameStats;
+    GLStateStats lastFrameStats;
+};
+
+// The cache of the main rendering context
+GLStateCache & getGLStateCache();
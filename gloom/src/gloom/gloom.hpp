@@ -16,4 +16,70 @@ const std::string windowTitle     = "Minecraft";
 const GLint       windowResizable = GL_TRUE;
 const int         windowSamples   = 4;
 
+// Depth range of the scene camera, shared by the projection, the depth of the sort keys and
+// the slices of the clustered lighting
+const float       sceneNearPlane  = 1.0f;
+const float       sceneFarPlane   = 150.0f;
+
+// Memory the scene meshes may use on the GPU before the coldest ones get evicted
+const long long   gpuMemoryBudget = 64ll * 1024 * 1024;
+
+// Cull the crowd with a compute shader when the context supports OpenGL 4.3
+const bool        useGpuCulling   = true;
+
+// Draw the characters of the crowd farther than impostorDistance as textured quads
+const bool        useImpostors     = true;
+const float       impostorDistance = 250.0f;
+
+// Store the dynamic nodes of the scene graph in arrays, in breadth first order, and compute
+// their world matrices in a single loop instead of a recursive visit
+const bool        useFlatScene = true;
+
+// Compute the world matrices and bounds of the flat scene level by level on all cores. Only
+// the levels larger than flatSceneRangeSize nodes are actually split between the threads.
+const bool        useParallelPropagation = true;
+
+// Check, with the statistics, that the world matrices match a serial computation bit for bit
+const bool        verifyParallelPropagation = false;
+
+// Skip the subtrees of the scene graph whose bounds are outside of the view
+const bool        useFrustumCulling = true;
+
+// Skip the nodes hidden behind the occluders, found with a depth buffer of
+// occlusionBufferWidth x occlusionBufferHeight pixels rasterized on the CPU
+const bool        useOcclusionCulling   = true;
+const int         occlusionBufferWidth  = 256;
+const int         occlusionBufferHeight = 256;
+
+// Lay down the depth of the opaque geometry first, so that each pixel is shaded at most once
+const bool        useDepthPrepass = true;
+
+// Draw the translucent geometry with weighted blended order-independent transparency,
+// in any order, instead of sorting it back to front
+const bool        useWeightedTransparency = true;
+
+// Light the scene with torches, binned into clusters so that each fragment only
+// evaluates the lights close to it
+const bool        useClusteredLighting = true;
+const unsigned    torchCount           = 4000;
+
+// Render the scene at a lower resolution when the GPU takes longer than the budget for a
+// frame, and stretch it over the window
+const bool        useDynamicResolution       = true;
+const double      gpuFrameBudgetMilliseconds = 12.0;
+const float       minimumResolutionScale     = 0.5f;
+
+// Generate the terrain in the vertex shader instead of storing it in vertex buffers
+const bool        useProceduralTerrain = true;
+
+// Upload the scene meshes from a second context on a background thread
+const bool        useUploadThread = true;
+
+// Request a debug context and report the driver messages through the debug layer
+const bool        enableDebugOutput = false;
+
+// Print the renderer counters to stdout every statisticsInterval frames
+const bool        printStatistics    = false;
+const int         statisticsInterval = 300;
+
 #endif
@@ -0,0 +1,144 @@
+#include "gpuCulling.hpp"
+#include "program.hpp"
+#include "toolbox.hpp"
+#include "glStateCache.hpp"
+#include <algorithm>
+#include <glm/gtc/type_ptr.hpp>
+
+// Must match local_size_x in cullInstances.comp
+const unsigned int cullGroupSize = 64;
+
+// Bounding sphere of a mesh: centre of its bounding box and distance to the furthest vertex
+static glm::vec4 computeBoundingSphere(Mesh const &mesh)
+{
+    if(mesh.vertices.empty())
+    {
+        return glm::vec4(0.0f);
+    }
+
+    float3 minimum(mesh.vertices.at(0).x, mesh.vertices.at(0).y, mesh.vertices.at(0).z);
+    float3 maximum = minimum;
+    for(float4 const &vertex : mesh.vertices)
+    {
+        minimum = float3(std::min(minimum.x, vertex.x), std::min(minimum.y, vertex.y), std::min(minimum.z, vertex.z));
+        maximum = float3(std::max(maximum.x, vertex.x), std::max(maximum.y, vertex.y), std::max(maximum.z, vertex.z));
+    }
+
+    float3 centre = (minimum + maximum) * 0.5f;
+    float radius = 0.0f;
+    for(float4 const &vertex : mesh.vertices)
+    {
+        radius = std::max(radius, centre.distance(float3(vertex.x, vertex.y, vertex.z)));
+    }
+
+    return glm::vec4(centre.x, centre.y, centre.z, radius);
+}
+
+bool GpuCrowdCuller::isSupported()
+{
+    return isGLVersionAtLeast(4, 3);
+}
+
+GLsizeiptr GpuCrowdCuller::getInstanceAlignment()
+{
+    GLint alignment = 16;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    return std::max(GLsizeiptr(alignment), GLsizeiptr(16));
+}
+
+GpuCrowdCuller::GpuCrowdCuller(GpuResourceManager &resources, MinecraftCharacter const &character,
+                               unsigned int characterCount)
+    : characterCount(characterCount)
+{
+    // Merge the body parts into a single mesh, so that one VAO serves all the draw commands
+    Mesh merged("Crowd body parts");
+    merged.hasNormals = false;
+
+    for(int part = 0; part < BODY_PART_COUNT; part++)
+    {
+        Mesh const &partMesh = getBodyPartMesh(character, BodyPart(part));
+        unsigned int baseVertex = unsigned(merged.vertices.size());
+
+        DrawElementsIndirectCommand &command = commandTemplate[part];
+        command.count = unsigned(partMesh.indices.size());
+        command.instanceCount = 0;
+        command.firstIndex = unsigned(merged.indices.size());
+        command.baseVertex = 0;
+        command.baseInstance = part * characterCount;
+
+        merged.vertices.insert(merged.vertices.end(), partMesh.vertices.begin(), partMesh.vertices.end());
+        merged.colours.insert(merged.colours.end(), partMesh.colours.begin(), partMesh.colours.end());
+        for(unsigned int index : partMesh.indices)
+        {
+            merged.indices.push_back(baseVertex + index);
+        }
+
+        partBounds[part] = computeBoundingSphere(partMesh);
+    }
+
+    mesh = resources.createMesh(merged);
+
+    cullProgram = resources.createComputeProgram("../gloom/shaders/cullInstances.comp");
+    frustumPlanesLocation = glGetUniformLocation(cullProgram->get(), "frustumPlanes");
+    partBoundsLocation = glGetUniformLocation(cullProgram->get(), "partBounds");
+    characterCountLocation = glGetUniformLocation(cullProgram->get(), "characterCount");
+    partCountLocation = glGetUniformLocation(cullProgram->get(), "partCount");
+
+    // Room for every instance to be visible
+    visibleInstances = GpuBuffer(&resources, CATEGORY_STREAMING, GL_SHADER_STORAGE_BUFFER,
+                                 GLsizeiptr(characterCount) * BODY_PART_COUNT * sizeof(InstanceData),
+                                 nullptr, GL_DYNAMIC_COPY);
+    drawCommands = GpuBuffer(&resources, CATEGORY_STREAMING, GL_DRAW_INDIRECT_BUFFER,
+                             sizeof(commandTemplate), commandTemplate, GL_DYNAMIC_DRAW);
+}
+
+GpuCrowdCuller::~GpuCrowdCuller()
+{
+}
+
+void GpuCrowdCuller::cull(GLuint instanceBuffer, GLintptr offset, unsigned int count, glm::mat4 const &viewProjection)
+{
+    // Reset the instance counts of the commands
+    GLStateCache &state = getGLStateCache();
+    state.bindBuffer(GL_DRAW_INDIRECT_BUFFER, drawCommands.get());
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(commandTemplate), commandTemplate);
+
+    // Nothing to draw, the commands are left empty
+    count = std::min(count, characterCount);
+    if (count == 0)
+    {
+        return;
+    }
+
+    glm::vec4 frustumPlanes[6];
+    extractFrustumPlanes(viewProjection, frustumPlanes);
+
+    state.useProgram(cullProgram->get());
+    glUniform4fv(frustumPlanesLocation, 6, glm::value_ptr(frustumPlanes[0]));
+    glUniform4fv(partBoundsLocation, BODY_PART_COUNT, glm::value_ptr(partBounds[0]));
+    state.uniform1ui(characterCountLocation, count);
+    state.uniform1ui(partCountLocation, BODY_PART_COUNT);
+
+    GLsizeiptr instanceBytes = GLsizeiptr(count) * BODY_PART_COUNT * sizeof(InstanceData);
+    state.bindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer, offset, instanceBytes);
+    state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visibleInstances.get());
+    state.bindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, drawCommands.get());
+
+    unsigned int invocations = count * BODY_PART_COUNT;
+    glDispatchCompute((invocations + cullGroupSize - 1) / cullGroupSize, 1, 1);
+
+    // The commands and the visible instances are read by the next draw
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+void GpuCrowdCuller::draw()
+{
+    GLStateCache &state = getGLStateCache();
+    state.bindVertexArray(mesh->use());
+
+    // The base instance of each command selects the visible instances of its part
+    setInstanceAttributes(visibleInstances.get(), 0);
+
+    state.bindBuffer(GL_DRAW_INDIRECT_BUFFER, drawCommands.get());
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, BODY_PART_COUNT, 0);
+}
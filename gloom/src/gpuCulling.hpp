@@ -0,0 +1,66 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/mat4x4.hpp>
+#include "crowd.hpp"
+#include "gpuResources.hpp"
+
+// Layout of the commands consumed by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLuint baseVertex;
+    GLuint baseInstance;
+};
+
+// Culls the instances of a crowd against the view frustum on the GPU.
+// A compute shader tests the bounding sphere of every body part instance and appends the
+// visible ones to one indirect draw command per part. All the body parts live in a single
+// VAO, so the whole crowd is then drawn with one glMultiDrawElementsIndirect call and the
+// CPU cost does not depend on the number of characters.
+// Requires OpenGL 4.3, see isSupported().
+class GpuCrowdCuller {
+public:
+    GpuCrowdCuller(GpuResourceManager &resources, MinecraftCharacter const &character,
+                   unsigned int characterCount);
+    ~GpuCrowdCuller();
+
+    // Whether the current context supports compute shaders and indirect draws
+    static bool isSupported();
+
+    // Alignment required for the offset of the instances given to cull()
+    static GLsizeiptr getInstanceAlignment();
+
+    // Culls the instances of count characters laid out as by computeCrowdInstances(),
+    // starting at offset in instanceBuffer. count may be lower than the characterCount given
+    // to the constructor. The visible instances and the draw commands stay on the GPU.
+    void cull(GLuint instanceBuffer, GLintptr offset, unsigned int count, glm::mat4 const &viewProjection);
+
+    // Draws the visible instances with the currently active program
+    void draw();
+
+private:
+    GpuCrowdCuller(GpuCrowdCuller const &) = delete;
+    GpuCrowdCuller & operator =(GpuCrowdCuller const &) = delete;
+
+    unsigned int characterCount;
+
+    // All body parts merged into a single mesh
+    GpuMesh *mesh;
+
+    GpuProgram *cullProgram;
+    GLint frustumPlanesLocation;
+    GLint partBoundsLocation;
+    GLint characterCountLocation;
+    GLint partCountLocation;
+
+    // Bounding sphere of each part in model space
+    glm::vec4 partBounds[BODY_PART_COUNT];
+
+    // Commands with an instance count of 0, copied over the draw commands before culling
+    DrawElementsIndirectCommand commandTemplate[BODY_PART_COUNT];
+
+    GpuBuffer visibleInstances;
+    GpuBuffer drawCommands;
+};
@@ -0,0 +1,384 @@
+#include "gpuResources.hpp"
+#include "debugLayer.hpp"
+#include <algorithm>
+#include <cstdio>
+
+// The vertex data is uploaded straight from the float4 vectors of the meshes
+static_assert(sizeof(float4) == 4 * sizeof(float), "float4 must be tightly packed");
+
+const char* resourceCategoryName(ResourceCategory category)
+{
+    switch(category)
+    {
+    case CATEGORY_VERTEX_DATA:  return "vertex data";
+    case CATEGORY_INDEX_DATA:   return "index data";
+    case CATEGORY_UNIFORM_DATA: return "uniform data";
+    case CATEGORY_STREAMING:    return "streaming";
+    case CATEGORY_TEXTURE:      return "textures";
+    default:                    return "unknown";
+    }
+}
+
+// --- GpuBuffer ---
+
+GpuBuffer::GpuBuffer(GpuResourceManager *manager, ResourceCategory category, GLenum target,
+                     GLsizeiptr size, const void *data, GLenum usage)
+    : manager(manager), category(category), size(size)
+{
+    glGenBuffers(1, &bufferID);
+    getGLStateCache().bindBuffer(target, bufferID);
+    glBufferData(target, size, data, usage);
+
+    manager->stats.bufferCount++;
+    manager->recordAllocation(category, size);
+}
+
+GpuBuffer::GpuBuffer(GpuResourceManager *manager, ResourceCategory category, GLuint bufferID, GLsizeiptr size)
+    : manager(manager), category(category), bufferID(bufferID), size(size)
+{
+    manager->stats.bufferCount++;
+    manager->recordAllocation(category, size);
+}
+
+GpuBuffer::GpuBuffer(GpuBuffer &&other)
+    : manager(other.manager), category(other.category), bufferID(other.bufferID), size(other.size)
+{
+    other.bufferID = 0;
+    other.size = 0;
+}
+
+GpuBuffer & GpuBuffer::operator =(GpuBuffer &&other)
+{
+    if (this != &other)
+    {
+        release();
+        manager = other.manager;
+        category = other.category;
+        bufferID = other.bufferID;
+        size = other.size;
+        other.bufferID = 0;
+        other.size = 0;
+    }
+    return *this;
+}
+
+void GpuBuffer::release()
+{
+    if (bufferID != 0)
+    {
+        glDeleteBuffers(1, &bufferID);
+        getGLStateCache().forgetBuffer(bufferID);
+        manager->stats.bufferCount--;
+        manager->recordRelease(category, size);
+        bufferID = 0;
+        size = 0;
+    }
+}
+
+// --- GpuVertexArray ---
+
+GpuVertexArray::GpuVertexArray(GpuResourceManager *manager) : manager(manager)
+{
+    glGenVertexArrays(1, &vaoID);
+    manager->stats.vertexArrayCount++;
+}
+
+GpuVertexArray::GpuVertexArray(GpuVertexArray &&other) : manager(other.manager), vaoID(other.vaoID)
+{
+    other.vaoID = 0;
+}
+
+GpuVertexArray & GpuVertexArray::operator =(GpuVertexArray &&other)
+{
+    if (this != &other)
+    {
+        release();
+        manager = other.manager;
+        vaoID = other.vaoID;
+        other.vaoID = 0;
+    }
+    return *this;
+}
+
+void GpuVertexArray::release()
+{
+    if (vaoID != 0)
+    {
+        glDeleteVertexArrays(1, &vaoID);
+        getGLStateCache().forgetVertexArray(vaoID);
+        manager->stats.vertexArrayCount--;
+        vaoID = 0;
+    }
+}
+
+// --- GpuProgram ---
+
+GpuProgram::GpuProgram(GpuResourceManager *manager, std::string const &vertexFilename,
+                       std::string const &fragmentFilename)
+    : manager(manager)
+{
+    shader.makeBasicShader(vertexFilename, fragmentFilename);
+    setGLObjectLabel(GL_PROGRAM, shader.get(), vertexFilename + " + " + fragmentFilename);
+    manager->stats.programCount++;
+}
+
+GpuProgram::GpuProgram(GpuResourceManager *manager, std::string const &computeFilename)
+    : manager(manager)
+{
+    shader.attach(computeFilename);
+    shader.link();
+    setGLObjectLabel(GL_PROGRAM, shader.get(), computeFilename);
+    manager->stats.programCount++;
+}
+
+GpuProgram::~GpuProgram()
+{
+    getGLStateCache().forgetProgram(shader.get());
+    shader.destroy();
+    manager->stats.programCount--;
+}
+
+// --- GpuMesh ---
+
+GpuMesh::GpuMesh(GpuResourceManager *manager, Mesh const &source)
+    : manager(manager), source(source)
+{
+    upload();
+}
+
+GpuMesh::GpuMesh(GpuResourceManager *manager, Mesh const &source,
+                 GpuBuffer &&vertexBuffer, GpuBuffer &&colourBuffer, GpuBuffer &&indexBuffer)
+    : manager(manager), source(source), vertexBuffer(std::move(vertexBuffer)),
+      colourBuffer(std::move(colourBuffer)), indexBuffer(std::move(indexBuffer))
+{
+    createVertexArray();
+    manager->stats.uploads++;
+}
+
+GLuint GpuMesh::use()
+{
+    if (!isResident())
+    {
+        upload();
+        manager->stats.reuploads++;
+    }
+
+    lastUsedFrame = manager->currentFrame;
+    return vao.get();
+}
+
+GLuint GpuMesh::usePositionOnly()
+{
+    use();
+
+    // Created the first time it is needed, as most meshes never go through the pre-pass
+    if (positionOnlyVao.get() == 0)
+    {
+        GLStateCache &state = getGLStateCache();
+        positionOnlyVao = GpuVertexArray(manager);
+        state.bindVertexArray(positionOnlyVao.get());
+
+        state.bindBuffer(GL_ARRAY_BUFFER, vertexBuffer.get());
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+        glEnableVertexAttribArray(0);
+
+        state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer.get());
+        state.bindVertexArray(0);
+
+        setGLObjectLabel(GL_VERTEX_ARRAY, positionOnlyVao.get(), source.name + " positions");
+    }
+
+    return positionOnlyVao.get();
+}
+
+GLsizeiptr GpuMesh::getResidentBytes() const
+{
+    return vertexBuffer.getSize() + colourBuffer.getSize() + indexBuffer.getSize();
+}
+
+void GpuMesh::upload()
+{
+    vertexBuffer = GpuBuffer(manager, CATEGORY_VERTEX_DATA, GL_ARRAY_BUFFER,
+                             source.vertices.size() * sizeof(float4), source.vertices.data());
+    colourBuffer = GpuBuffer(manager, CATEGORY_VERTEX_DATA, GL_ARRAY_BUFFER,
+                             source.colours.size() * sizeof(float4), source.colours.data());
+
+    // Created through the copy target, as binding an index buffer requires a VAO
+    indexBuffer = GpuBuffer(manager, CATEGORY_INDEX_DATA, GL_COPY_WRITE_BUFFER,
+                            source.indices.size() * sizeof(unsigned int), source.indices.data());
+
+    createVertexArray();
+
+    manager->stats.uploads++;
+}
+
+void GpuMesh::createVertexArray()
+{
+    GLStateCache &state = getGLStateCache();
+    vao = GpuVertexArray(manager);
+    state.bindVertexArray(vao.get());
+
+    // Vertex positions
+    state.bindBuffer(GL_ARRAY_BUFFER, vertexBuffer.get());
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(0);
+
+    // Vertex colours
+    state.bindBuffer(GL_ARRAY_BUFFER, colourBuffer.get());
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(1);
+
+    // Indices, the binding is stored in the VAO
+    state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer.get());
+
+    state.bindVertexArray(0);
+
+    // Name the objects after the mesh, for the driver messages
+    setGLObjectLabel(GL_VERTEX_ARRAY, vao.get(), source.name);
+    setGLObjectLabel(GL_BUFFER, vertexBuffer.get(), source.name + " vertices");
+    setGLObjectLabel(GL_BUFFER, colourBuffer.get(), source.name + " colours");
+    setGLObjectLabel(GL_BUFFER, indexBuffer.get(), source.name + " indices");
+}
+
+void GpuMesh::evict()
+{
+    vao.release();
+    positionOnlyVao.release();
+    vertexBuffer.release();
+    colourBuffer.release();
+    indexBuffer.release();
+
+    manager->stats.evictions++;
+}
+
+// --- GpuResourceManager ---
+
+GpuResourceManager::GpuResourceManager(long long budgetBytes)
+{
+    stats.budgetBytes = budgetBytes;
+}
+
+GpuResourceManager::~GpuResourceManager()
+{
+    // The handles report back to the manager, so release them while it is still alive
+    meshes.clear();
+    programs.clear();
+}
+
+GpuMesh* GpuResourceManager::createMesh(Mesh const &mesh)
+{
+    meshes.emplace_back(new GpuMesh(this, mesh));
+    meshes.back()->id = unsigned(meshes.size() - 1);
+    return meshes.back().get();
+}
+
+GpuMesh* GpuResourceManager::adoptMesh(Mesh const &mesh, GLuint vertexBuffer, GLuint colourBuffer, GLuint indexBuffer)
+{
+    GpuBuffer vertices(this, CATEGORY_VERTEX_DATA, vertexBuffer, mesh.vertices.size() * sizeof(float4));
+    GpuBuffer colours(this, CATEGORY_VERTEX_DATA, colourBuffer, mesh.colours.size() * sizeof(float4));
+    GpuBuffer indices(this, CATEGORY_INDEX_DATA, indexBuffer, mesh.indices.size() * sizeof(unsigned int));
+
+    meshes.emplace_back(new GpuMesh(this, mesh, std::move(vertices), std::move(colours), std::move(indices)));
+    meshes.back()->id = unsigned(meshes.size() - 1);
+    return meshes.back().get();
+}
+
+GpuProgram* GpuResourceManager::createProgram(std::string const &vertexFilename,
+                                              std::string const &fragmentFilename)
+{
+    programs.emplace_back(new GpuProgram(this, vertexFilename, fragmentFilename));
+    return programs.back().get();
+}
+
+GpuProgram* GpuResourceManager::createComputeProgram(std::string const &computeFilename)
+{
+    programs.emplace_back(new GpuProgram(this, computeFilename));
+    return programs.back().get();
+}
+
+void GpuResourceManager::beginFrame()
+{
+    currentFrame++;
+}
+
+void GpuResourceManager::endFrame()
+{
+    enforceBudget();
+
+    // Refresh the mesh counters
+    stats.residentMeshCount = 0;
+    stats.evictedMeshCount = 0;
+    for (std::unique_ptr<GpuMesh> const &mesh : meshes)
+    {
+        if (mesh->isResident())
+        {
+            stats.residentMeshCount++;
+        }
+        else
+        {
+            stats.evictedMeshCount++;
+        }
+    }
+}
+
+void GpuResourceManager::enforceBudget()
+{
+    if (getMeshBytes() <= stats.budgetBytes)
+    {
+        return;
+    }
+
+    // Candidates are the resident meshes which were not drawn in the current frame
+    std::vector<GpuMesh*> candidates;
+    for (std::unique_ptr<GpuMesh> const &mesh : meshes)
+    {
+        if (mesh->isResident() && mesh->lastUsedFrame != currentFrame)
+        {
+            candidates.push_back(mesh.get());
+        }
+    }
+
+    // Coldest meshes first
+    std::sort(candidates.begin(), candidates.end(), [](GpuMesh *a, GpuMesh *b) {
+        return a->lastUsedFrame < b->lastUsedFrame;
+    });
+
+    for (GpuMesh *mesh : candidates)
+    {
+        if (getMeshBytes() <= stats.budgetBytes)
+        {
+            break;
+        }
+        mesh->evict();
+    }
+}
+
+void GpuResourceManager::recordAllocation(ResourceCategory category, long long bytes)
+{
+    stats.bytes[category] += bytes;
+    stats.totalBytes += bytes;
+}
+
+void GpuResourceManager::recordRelease(ResourceCategory category, long long bytes)
+{
+    stats.bytes[category] -= bytes;
+    stats.totalBytes -= bytes;
+}
+
+void GpuResourceManager::printStats()
+{
+    printf("GPU resources {\n");
+    for (int category = 0; category < CATEGORY_COUNT; category++)
+    {
+        printf("    %-13s %10lld bytes\n", resourceCategoryName(ResourceCategory(category)),
+               stats.bytes[category]);
+    }
+    printf("    total:        %10lld bytes\n", stats.totalBytes);
+    printf("    meshes:       %10lld bytes (budget %lld)\n", getMeshBytes(), stats.budgetBytes);
+    printf("    buffers: %u, VAOs: %u, programs: %u\n",
+           stats.bufferCount, stats.vertexArrayCount, stats.programCount);
+    printf("    meshes: %u resident, %u evicted\n", stats.residentMeshCount, stats.evictedMeshCount);
+    printf("    uploads: %u, reuploads: %u, evictions: %u\n",
+           stats.uploads, stats.reuploads, stats.evictions);
+    printf("}\n");
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "mesh.hpp"
+#include "gloom/shader.hpp"
+#include "glStateCache.hpp"
+
+// Categories used to account for the GPU memory of a scene
+enum ResourceCategory {
+    CATEGORY_VERTEX_DATA = 0,
+    CATEGORY_INDEX_DATA,
+    CATEGORY_UNIFORM_DATA,
+    CATEGORY_STREAMING,
+    CATEGORY_TEXTURE,
+    CATEGORY_COUNT
+};
+
+const char* resourceCategoryName(ResourceCategory category);
+
+class GpuResourceManager;
+
+// Owns an OpenGL buffer object and releases it when it goes out of scope.
+// Handles can be moved but not copied.
+class GpuBuffer {
+public:
+    GpuBuffer() {}
+    GpuBuffer(GpuResourceManager *manager, ResourceCategory category, GLenum target,
+              GLsizeiptr size, const void *data, GLenum usage = GL_STATIC_DRAW);
+
+    // Takes ownership of a buffer created elsewhere, for instance by the upload thread
+    GpuBuffer(GpuResourceManager *manager, ResourceCategory category, GLuint bufferID, GLsizeiptr size);
+
+    GpuBuffer(GpuBuffer &&other);
+    GpuBuffer & operator =(GpuBuffer &&other);
+    ~GpuBuffer() { release(); }
+
+    // Deletes the buffer object, the handle becomes empty
+    void release();
+
+    GLuint     get() const     { return bufferID; }
+    GLsizeiptr getSize() const { return size; }
+
+private:
+    GpuBuffer(GpuBuffer const &) = delete;
+    GpuBuffer & operator =(GpuBuffer const &) = delete;
+
+    GpuResourceManager *manager = nullptr;
+    ResourceCategory category = CATEGORY_VERTEX_DATA;
+    GLuint bufferID = 0;
+    GLsizeiptr size = 0;
+};
+
+// Owns an OpenGL vertex array object
+class GpuVertexArray {
+public:
+    GpuVertexArray() {}
+    explicit GpuVertexArray(GpuResourceManager *manager);
+    GpuVertexArray(GpuVertexArray &&other);
+    GpuVertexArray & operator =(GpuVertexArray &&other);
+    ~GpuVertexArray() { release(); }
+
+    void release();
+
+    GLuint get() const { return vaoID; }
+
+private:
+    GpuVertexArray(GpuVertexArray const &) = delete;
+    GpuVertexArray & operator =(GpuVertexArray const &) = delete;
+
+    GpuResourceManager *manager = nullptr;
+    GLuint vaoID = 0;
+};
+
+// Owns a linked shader program
+class GpuProgram {
+public:
+    GpuProgram(GpuResourceManager *manager, std::string const &vertexFilename,
+               std::string const &fragmentFilename);
+    GpuProgram(GpuResourceManager *manager, std::string const &computeFilename);
+    ~GpuProgram();
+
+    void   activate() { getGLStateCache().useProgram(shader.get()); }
+    GLuint get()      { return shader.get(); }
+
+private:
+    GpuProgram(GpuProgram const &) = delete;
+    GpuProgram & operator =(GpuProgram const &) = delete;
+
+    GpuResourceManager *manager;
+    Gloom::Shader shader;
+};
+
+// A mesh whose vertex, colour and index data live on the GPU.
+// A copy of the data is kept on the CPU, so that the mesh can be evicted when the scene
+// goes over its memory budget and uploaded again the next time it is drawn.
+class GpuMesh {
+public:
+    GpuMesh(GpuResourceManager *manager, Mesh const &source);
+
+    // Creates a mesh from buffers which already hold the data of source
+    GpuMesh(GpuResourceManager *manager, Mesh const &source,
+            GpuBuffer &&vertexBuffer, GpuBuffer &&colourBuffer, GpuBuffer &&indexBuffer);
+
+    // Returns the VAO of the mesh, uploading it first if it is not resident.
+    // Marks the mesh as used in the current frame.
+    GLuint use();
+
+    // Same as use(), but returns a VAO which only reads the vertex positions, for the depth
+    // pre-pass. The positions live in their own buffer, so the pass does not fetch anything else.
+    GLuint usePositionOnly();
+
+    bool isResident() const            { return vao.get() != 0; }
+    unsigned int getIndexCount() const { return unsigned(source.indices.size()); }
+
+    // Number of the mesh in its manager. Unlike the VAO, it stays the same when the mesh is
+    // evicted and uploaded again.
+    unsigned int getId() const         { return id; }
+    GLsizeiptr getResidentBytes() const;
+
+    // The CPU copy of the mesh data
+    Mesh const & getSource() const     { return source; }
+
+private:
+    friend class GpuResourceManager;
+
+    void upload();
+    void evict();
+
+    // Creates the VAO describing the layout of the buffers
+    void createVertexArray();
+
+    GpuResourceManager *manager;
+    unsigned int id = 0;
+    Mesh source;
+
+    GpuVertexArray vao;
+    GpuVertexArray positionOnlyVao;
+    GpuBuffer vertexBuffer;
+    GpuBuffer colourBuffer;
+    GpuBuffer indexBuffer;
+
+    // Frame in which the mesh was last drawn, used to pick the coldest meshes to evict
+    unsigned long lastUsedFrame = 0;
+};
+
+// Live counters describing the GPU memory of a scene, meant to be shown on dashboards
+struct GpuResourceStats {
+    long long bytes[CATEGORY_COUNT] = {};
+    long long totalBytes = 0;
+    long long budgetBytes = 0;
+
+    unsigned int bufferCount = 0;
+    unsigned int vertexArrayCount = 0;
+    unsigned int programCount = 0;
+
+    unsigned int residentMeshCount = 0;
+    unsigned int evictedMeshCount = 0;
+
+    // Totals since the manager was created
+    unsigned int evictions = 0;
+    unsigned int uploads = 0;
+    unsigned int reuploads = 0;
+};
+
+// Keeps track of every GPU resource of a scene and of the memory they use.
+// When the resident meshes go over the budget, the meshes which have not been drawn
+// for the longest time are evicted at the end of the frame. Only the vertex and index data
+// of the meshes count towards the budget, the stream buffers and the textures can never
+// be evicted and are only reported.
+class GpuResourceManager {
+public:
+    explicit GpuResourceManager(long long budgetBytes);
+    ~GpuResourceManager();
+
+    // Creates a mesh owned by the manager and uploads it
+    GpuMesh* createMesh(Mesh const &mesh);
+
+    // Creates a mesh owned by the manager from buffers which already hold its data,
+    // and takes ownership of the buffers
+    GpuMesh* adoptMesh(Mesh const &mesh, GLuint vertexBuffer, GLuint colourBuffer, GLuint indexBuffer);
+
+    // Compiles and links a program owned by the manager
+    GpuProgram* createProgram(std::string const &vertexFilename, std::string const &fragmentFilename);
+    GpuProgram* createComputeProgram(std::string const &computeFilename);
+
+    // Must be called at the start and at the end of each frame
+    void beginFrame();
+    void endFrame();
+
+    void setBudget(long long budgetBytes) { stats.budgetBytes = budgetBytes; }
+    unsigned long getCurrentFrame() const { return currentFrame; }
+    GpuResourceStats const & getStats() const { return stats; }
+
+    // Pretty prints the counters to stdout
+    void printStats();
+
+    // Records memory which is allocated outside of the handles above (stream buffers, ...)
+    void recordAllocation(ResourceCategory category, long long bytes);
+    void recordRelease(ResourceCategory category, long long bytes);
+
+private:
+    friend class GpuBuffer;
+    friend class GpuVertexArray;
+    friend class GpuProgram;
+    friend class GpuMesh;
+
+    GpuResourceManager(GpuResourceManager const &) = delete;
+    GpuResourceManager & operator =(GpuResourceManager const &) = delete;
+
+    // Evicts the coldest meshes until the resident memory fits in the budget
+    void enforceBudget();
+
+    // Memory of the resident meshes, the only one eviction can free
+    long long getMeshBytes() const
+    {
+        return stats.bytes[CATEGORY_VERTEX_DATA] + stats.bytes[CATEGORY_INDEX_DATA];
+    }
+
+    std::vector<std::unique_ptr<GpuMesh>> meshes;
+    std::vector<std::unique_ptr<GpuProgram>> programs;
+
+    unsigned long currentFrame = 1;
+    GpuResourceStats stats;
+};
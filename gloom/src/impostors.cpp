@@ -0,0 +1,214 @@
+#include "impostors.hpp"
+#include "crowd.hpp"
+#include "glStateCache.hpp"
+#include "debugLayer.hpp"
+#include "program.hpp"
+#include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cmath>
+
+// Highest view baked, the cells are spread evenly from the horizon up to it
+static const float maximumElevation = 1.05f;
+
+// Empty border around the character in each cell, so that the smaller mipmaps do not
+// blend neighbouring cells together
+static const int cellMargin = 4;
+
+// Smallest mipmap, in pixels per cell
+static const int smallestCellSize = 16;
+
+ImpostorRenderer::ImpostorRenderer(GpuResourceManager &resources, MinecraftCharacter const &character,
+                                   unsigned int yawCount, unsigned int elevationCount, int cellSize)
+    : resources(resources), yawCount(yawCount), elevationCount(std::max(elevationCount, 1u)),
+      cellSize(cellSize), vertexArray(&resources)
+{
+    // Bounding box of the character standing, as placed by computeCrowdInstances()
+    glm::vec3 minimum(1e30f, 1e30f, 1e30f);
+    glm::vec3 maximum(-1e30f, -1e30f, -1e30f);
+    for (int part = 0; part < BODY_PART_COUNT; part++)
+    {
+        Mesh const &mesh = getBodyPartMesh(character, BodyPart(part));
+        bodyParts[part] = resources.createMesh(mesh);
+        for (float4 const &vertex : mesh.vertices)
+        {
+            minimum = glm::vec3(std::min(minimum.x, vertex.x), std::min(minimum.y, vertex.y), std::min(minimum.z, vertex.z));
+            maximum = glm::vec3(std::max(maximum.x, vertex.x), std::max(maximum.y, vertex.y), std::max(maximum.z, vertex.z));
+        }
+    }
+    glm::vec3 centre = (minimum + maximum) * 0.5f;
+    bounds = glm::vec4(centre.x, centre.y, centre.z, glm::length(maximum - centre));
+
+    bakeProgram = resources.createProgram("../gloom/shaders/instanced.vert", "../gloom/shaders/simple.frag");
+
+    program = resources.createProgram("../gloom/shaders/impostor.vert", "../gloom/shaders/impostor.frag");
+    viewProjectionLocation = glGetUniformLocation(program->get(), "viewProjection");
+    cameraRightLocation = glGetUniformLocation(program->get(), "cameraRight");
+    cameraUpLocation = glGetUniformLocation(program->get(), "cameraUp");
+    cameraPositionLocation = glGetUniformLocation(program->get(), "cameraPosition");
+    boundsLocation = glGetUniformLocation(program->get(), "bounds");
+    atlasLayoutLocation = glGetUniformLocation(program->get(), "atlasLayout");
+}
+
+ImpostorRenderer::~ImpostorRenderer()
+{
+    if (atlasTexture != 0)
+    {
+        glDeleteTextures(1, &atlasTexture);
+        getGLStateCache().forgetTexture(atlasTexture);
+        resources.recordRelease(CATEGORY_TEXTURE, atlasBytes);
+    }
+}
+
+void ImpostorRenderer::bake()
+{
+    if (baked)
+    {
+        return;
+    }
+    baked = true;
+
+    GLDebugGroup group("Impostor baking");
+    GLStateCache &state = getGLStateCache();
+
+    int width = int(yawCount) * cellSize;
+    int height = int(elevationCount) * cellSize;
+    int levels = 1;
+    while ((cellSize >> levels) >= smallestCellSize)
+    {
+        levels++;
+    }
+
+    glGenTextures(1, &atlasTexture);
+    state.bindTexture(0, GL_TEXTURE_2D, atlasTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    setGLObjectLabel(GL_TEXTURE, atlasTexture, "impostor atlas");
+
+    // The mipmaps add a third to the size of the texture
+    atlasBytes = (long long) width * height * 4 * 4 / 3;
+    resources.recordAllocation(CATEGORY_TEXTURE, atlasBytes);
+
+    GLuint depthBuffer;
+    glGenRenderbuffers(1, &depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+    GLuint framebuffer;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, atlasTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        fprintf(stderr, "ImpostorRenderer: the atlas framebuffer is incomplete.\n");
+    }
+
+    // glClearBuffer leaves the clear colour of the caller alone, the cells are transparent
+    const GLfloat transparent[] = {0.0f, 0.0f, 0.0f, 0.0f};
+    const GLfloat farthest = 1.0f;
+    state.colorMask(GL_TRUE);
+    state.depthMask(GL_TRUE);
+    glClearBufferfv(GL_COLOR, 0, transparent);
+    glClearBufferfv(GL_DEPTH, 0, &farthest);
+
+    // One standing character with white tint at the origin, facing +z
+    CrowdCharacter character;
+    character.position = float3(0.0f, 0.0f, 0.0f);
+    character.heading = 0.0f;
+    character.phase = 0.0f;
+    character.colour = float4(1.0f, 1.0f, 1.0f, 1.0f);
+    InstanceData instances[BODY_PART_COUNT];
+    computeCrowdInstances(&character, 0, 1, 1, 1e6f, 0.0f, instances);
+    GpuBuffer instanceBuffer(&resources, CATEGORY_STREAMING, GL_ARRAY_BUFFER, sizeof(instances), instances, GL_STATIC_DRAW);
+
+    GLint previousViewport[4];
+    glGetIntegerv(GL_VIEWPORT, previousViewport);
+
+    state.enable(GL_DEPTH_TEST);
+    state.disable(GL_BLEND);
+    state.useProgram(bakeProgram->get());
+    GLint bakeViewProjectionLocation = glGetUniformLocation(bakeProgram->get(), "viewProjection");
+
+    // Orthographic views, wide enough for the bounding sphere plus the margin
+    glm::vec3 centre(bounds.x, bounds.y, bounds.z);
+    float radius = bounds.w;
+    float extent = radius * float(cellSize) / float(cellSize - 2 * cellMargin);
+    glm::mat4 projection = glm::ortho(-extent, extent, -extent, extent, 0.0f, 4.0f * radius);
+
+    for (unsigned int row = 0; row < elevationCount; row++)
+    {
+        float elevation = elevationCount > 1 ? maximumElevation * float(row) / float(elevationCount - 1) : 0.0f;
+        for (unsigned int column = 0; column < yawCount; column++)
+        {
+            // Same angles as picked by impostor.vert
+            float yaw = 2.0f * float(M_PI) * float(column) / float(yawCount);
+            glm::vec3 direction(std::sin(yaw) * std::cos(elevation), std::sin(elevation), std::cos(yaw) * std::cos(elevation));
+            glm::mat4 view = glm::lookAt(centre + direction * (2.0f * radius), centre, glm::vec3(0.0f, 1.0f, 0.0f));
+
+            glViewport(int(column) * cellSize, int(row) * cellSize, cellSize, cellSize);
+            state.uniformMatrix4(bakeViewProjectionLocation, projection * view);
+
+            for (int part = 0; part < BODY_PART_COUNT; part++)
+            {
+                state.bindVertexArray(bodyParts[part]->use());
+                setInstanceAttributes(instanceBuffer.get(), GLintptr(part) * sizeof(InstanceData));
+                glDrawElementsInstanced(GL_TRIANGLES, bodyParts[part]->getIndexCount(), GL_UNSIGNED_INT, 0, 1);
+            }
+        }
+    }
+
+    state.bindTexture(0, GL_TEXTURE_2D, atlasTexture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &depthBuffer);
+    glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+}
+
+void ImpostorRenderer::draw(GLuint instanceBuffer, GLintptr offset, unsigned int count,
+                            glm::mat4 const &view, glm::mat4 const &viewProjection)
+{
+    bake();
+
+    stats = ImpostorStats();
+    stats.impostors = count;
+    if (count == 0)
+    {
+        return;
+    }
+
+    // The quads face the camera: its axes are the rows of the rotation part of the view matrix
+    glm::vec4 cameraRight(view[0][0], view[1][0], view[2][0], 0.0f);
+    glm::vec4 cameraUp(view[0][1], view[1][1], view[2][1], 0.0f);
+    glm::mat4 cameraMatrix = glm::inverse(view);
+    glm::vec4 cameraPosition(cameraMatrix[3][0], cameraMatrix[3][1], cameraMatrix[3][2], 1.0f);
+
+    GLStateCache &state = getGLStateCache();
+    state.useProgram(program->get());
+    state.uniformMatrix4(viewProjectionLocation, viewProjection);
+    state.uniform4f(cameraRightLocation, cameraRight);
+    state.uniform4f(cameraUpLocation, cameraUp);
+    state.uniform4f(cameraPositionLocation, cameraPosition);
+    state.uniform4f(boundsLocation, bounds);
+    state.uniform4f(atlasLayoutLocation, glm::vec4(float(yawCount), float(elevationCount), maximumElevation,
+                                                   float(cellSize) / float(cellSize - 2 * cellMargin)));
+    state.bindTexture(0, GL_TEXTURE_2D, atlasTexture);
+
+    // The corners of the quads come from gl_VertexID, only the instances have attributes
+    state.bindVertexArray(vertexArray.get());
+    state.bindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(ImpostorInstance), (void *) offset);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(ImpostorInstance), (void *) (offset + sizeof(glm::vec4)));
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(0, 1);
+    glVertexAttribDivisor(1, 1);
+
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, GLsizei(count));
+    stats.drawCalls = 1;
+}
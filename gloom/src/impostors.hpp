@@ -0,0 +1,76 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include "OBJLoader.hpp"
+#include "gpuResources.hpp"
+
+// Per-instance data of an impostor, read by impostor.vert
+struct ImpostorInstance {
+    // Position of the feet of the character in xyz, heading around the y axis in w
+    glm::vec4 positionAndHeading;
+    glm::vec4 colour;
+};
+
+// Counters of the last draw
+struct ImpostorStats {
+    unsigned int impostors = 0;
+    unsigned int drawCalls = 0;
+};
+
+// Draws distant characters as camera facing quads.
+//
+// The character is rendered once, standing, from yawCount directions around it times
+// elevationCount heights above the horizon, into the cells of a texture atlas. The atlas
+// is baked on the first draw and kept from then on. Each impostor then picks the cell
+// closest to the direction it is seen from, so a whole crowd of impostors is one instanced
+// draw of four vertices per character, whatever the complexity of the character mesh.
+class ImpostorRenderer {
+public:
+    ImpostorRenderer(GpuResourceManager &resources, MinecraftCharacter const &character,
+                     unsigned int yawCount = 16, unsigned int elevationCount = 4, int cellSize = 128);
+    ~ImpostorRenderer();
+
+    // Renders the views of the character into the atlas, if not done yet
+    void bake();
+
+    // Draws count impostors stored at offset in instanceBuffer, with one draw call
+    void draw(GLuint instanceBuffer, GLintptr offset, unsigned int count,
+              glm::mat4 const &view, glm::mat4 const &viewProjection);
+
+    // Bounding sphere of the character, relative to its feet
+    glm::vec4 const & getBounds() const { return bounds; }
+
+    ImpostorStats const & getStats() const { return stats; }
+
+private:
+    ImpostorRenderer(ImpostorRenderer const &) = delete;
+    ImpostorRenderer & operator =(ImpostorRenderer const &) = delete;
+
+    GpuResourceManager &resources;
+    unsigned int yawCount;
+    unsigned int elevationCount;
+    int cellSize;
+
+    GpuMesh *bodyParts[6];
+    glm::vec4 bounds;
+
+    GLuint atlasTexture = 0;
+    long long atlasBytes = 0;
+    bool baked = false;
+
+    GpuProgram *bakeProgram;
+    GpuProgram *program;
+    GLint viewProjectionLocation;
+    GLint cameraRightLocation;
+    GLint cameraUpLocation;
+    GLint cameraPositionLocation;
+    GLint boundsLocation;
+    GLint atlasLayoutLocation;
+
+    GpuVertexArray vertexArray;
+
+    ImpostorStats stats;
+};
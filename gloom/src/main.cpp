@@ -17,6 +17,14 @@ static void glfwErrorCallback(int error, const char *description)
 }
 
 
+// A callback which keeps the viewport covering the window when it is resized. The scene
+// renderer sets its own viewports, this is for the demos drawing straight to the window.
+static void glfwFramebufferSizeCallback(GLFWwindow *, int width, int height)
+{
+    glViewport(0, 0, width, height);
+}
+
+
 GLFWwindow* initialise()
 {
     // Initialise GLFW
@@ -39,6 +47,7 @@ GLFWwindow* initialise()
     // Set additional window options
     glfwWindowHint(GLFW_RESIZABLE, windowResizable);
     glfwWindowHint(GLFW_SAMPLES, windowSamples);  // MSAA
+    glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, enableDebugOutput ? GL_TRUE : GL_FALSE);
 
     // Create window using GLFW
     GLFWwindow* window = glfwCreateWindow(windowWidth,
@@ -59,6 +68,8 @@ GLFWwindow* initialise()
     glfwMakeContextCurrent(window);
     gladLoadGL();
 
+    glfwSetFramebufferSizeCallback(window, glfwFramebufferSizeCallback);
+
     // Print various OpenGL information to stdout
     printf("%s: %s\n", glGetString(GL_VENDOR), glGetString(GL_RENDERER));
     printf("GLFW\t %s\n", glfwGetVersionString());
@@ -18,6 +18,39 @@ public:
 
 	bool hasNormals;
 
+	// Axis aligned bounding box of the vertices, and a sphere around them centred in the box,
+	// see computeBounds()
+	float3 boundsMin;
+	float3 boundsMax;
+	float3 boundsCentre;
+	float boundsRadius = 0.0f;
+
+	// Must be called again whenever the vertices change
+	void computeBounds() {
+		boundsMin = float3(0, 0, 0);
+		boundsMax = float3(0, 0, 0);
+		for(size_t i = 0; i < vertices.size(); i++) {
+			float4 const &vertex = vertices[i];
+			if(i == 0) {
+				boundsMin = float3(vertex.x, vertex.y, vertex.z);
+				boundsMax = boundsMin;
+			}
+			boundsMin = float3(std::min(boundsMin.x, vertex.x), std::min(boundsMin.y, vertex.y), std::min(boundsMin.z, vertex.z));
+			boundsMax = float3(std::max(boundsMax.x, vertex.x), std::max(boundsMax.y, vertex.y), std::max(boundsMax.z, vertex.z));
+		}
+
+		// Tighter than the half diagonal of the box for most shapes
+		boundsCentre = float3((boundsMin.x + boundsMax.x) * 0.5f, (boundsMin.y + boundsMax.y) * 0.5f, (boundsMin.z + boundsMax.z) * 0.5f);
+		float radiusSquared = 0.0f;
+		for(float4 const &vertex : vertices) {
+			float dx = vertex.x - boundsCentre.x;
+			float dy = vertex.y - boundsCentre.y;
+			float dz = vertex.z - boundsCentre.z;
+			radiusSquared = std::max(radiusSquared, dx * dx + dy * dy + dz * dz);
+		}
+		boundsRadius = std::sqrt(radiusSquared);
+	}
+
 	unsigned long faceCount() {
 		return (this->vertices.size() / 3);
 	}
@@ -0,0 +1,431 @@
+#include "meshlets.hpp"
+#include "glStateCache.hpp"
+#include "toolbox.hpp"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MESHLETS_SSE 1
+#endif
+
+// Number of floats compared when welding a vertex: position, colour and normal
+static const unsigned int weldKeySize = 11;
+
+// Number of bits set in the 4 bit mask of an SSE comparison
+static unsigned int countLanes(int mask)
+{
+    return unsigned((mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1));
+}
+
+// Merges the vertices with the same position, colour and normal. The OBJ loader duplicates
+// the vertices of every triangle, which would limit a meshlet to 21 triangles.
+static Mesh weldVertices(Mesh const &source, std::vector<unsigned int> &indices)
+{
+    size_t count = source.vertices.size();
+    bool hasColours = source.colours.size() == count;
+    bool hasNormals = source.normals.size() == count;
+
+    std::vector<float> keys(count * weldKeySize, 0.0f);
+    for (size_t i = 0; i < count; i++)
+    {
+        float *key = &keys[i * weldKeySize];
+        float4 const &position = source.vertices[i];
+        key[0] = position.x; key[1] = position.y; key[2] = position.z; key[3] = position.w;
+        if (hasColours)
+        {
+            float4 const &colour = source.colours[i];
+            key[4] = colour.x; key[5] = colour.y; key[6] = colour.z; key[7] = colour.w;
+        }
+        if (hasNormals)
+        {
+            float3 const &normal = source.normals[i];
+            key[8] = normal.x; key[9] = normal.y; key[10] = normal.z;
+        }
+    }
+
+    // Sorting brings the equal vertices together
+    std::vector<unsigned int> order(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        order[i] = unsigned(i);
+    }
+    std::sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b)
+    {
+        return std::memcmp(&keys[a * weldKeySize], &keys[b * weldKeySize], weldKeySize * sizeof(float)) < 0;
+    });
+
+    Mesh welded(source.name);
+    welded.hasNormals = source.hasNormals;
+    std::vector<unsigned int> remap(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        unsigned int vertex = order[i];
+        bool duplicate = i > 0 && std::memcmp(&keys[vertex * weldKeySize], &keys[order[i - 1] * weldKeySize],
+                                              weldKeySize * sizeof(float)) == 0;
+        if (!duplicate)
+        {
+            welded.vertices.push_back(source.vertices[vertex]);
+            if (hasColours)
+            {
+                welded.colours.push_back(source.colours[vertex]);
+            }
+            if (hasNormals)
+            {
+                welded.normals.push_back(source.normals[vertex]);
+            }
+        }
+        remap[vertex] = unsigned(welded.vertices.size() - 1);
+    }
+
+    indices.resize(source.indices.size());
+    for (size_t i = 0; i < source.indices.size(); i++)
+    {
+        indices[i] = remap[source.indices[i]];
+    }
+    return welded;
+}
+
+static glm::vec3 toVec3(float4 const &v)
+{
+    return glm::vec3(v.x, v.y, v.z);
+}
+
+static MeshletBounds computeBounds(Mesh const &mesh, unsigned int const *indices, unsigned int triangleCount)
+{
+    MeshletBounds bounds;
+
+    // Sphere around the centre of the bounding box
+    glm::vec3 minimum = toVec3(mesh.vertices[indices[0]]);
+    glm::vec3 maximum = minimum;
+    for (unsigned int i = 0; i < triangleCount * 3; i++)
+    {
+        glm::vec3 p = toVec3(mesh.vertices[indices[i]]);
+        minimum = glm::vec3(std::min(minimum.x, p.x), std::min(minimum.y, p.y), std::min(minimum.z, p.z));
+        maximum = glm::vec3(std::max(maximum.x, p.x), std::max(maximum.y, p.y), std::max(maximum.z, p.z));
+    }
+    bounds.centre = (minimum + maximum) * 0.5f;
+    bounds.radius = 0.0f;
+    for (unsigned int i = 0; i < triangleCount * 3; i++)
+    {
+        bounds.radius = std::max(bounds.radius, glm::length(toVec3(mesh.vertices[indices[i]]) - bounds.centre));
+    }
+
+    // The cone axis is the average of the face normals, its spread the largest angle
+    // between the axis and a normal. Counter-clockwise triangles face their normal.
+    std::vector<glm::vec3> normals;
+    glm::vec3 sum(0.0f, 0.0f, 0.0f);
+    for (unsigned int t = 0; t < triangleCount; t++)
+    {
+        glm::vec3 a = toVec3(mesh.vertices[indices[t * 3]]);
+        glm::vec3 b = toVec3(mesh.vertices[indices[t * 3 + 1]]);
+        glm::vec3 c = toVec3(mesh.vertices[indices[t * 3 + 2]]);
+        glm::vec3 normal = glm::cross(b - a, c - a);
+        float length = glm::length(normal);
+        if (length > 0.0f)
+        {
+            normals.push_back(normal / length);
+            sum = sum + normal / length;
+        }
+    }
+
+    bounds.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+    bounds.coneCutoff = 1.0f;
+    float sumLength = glm::length(sum);
+    if (normals.empty() || sumLength <= 0.0f)
+    {
+        return bounds;
+    }
+
+    bounds.coneAxis = sum / sumLength;
+    float minimumDot = 1.0f;
+    for (glm::vec3 const &normal : normals)
+    {
+        minimumDot = std::min(minimumDot, glm::dot(normal, bounds.coneAxis));
+    }
+
+    // Past about 84 degrees the cone would hardly ever reject anything
+    if (minimumDot > 0.1f)
+    {
+        bounds.coneCutoff = std::sqrt(1.0f - minimumDot * minimumDot);
+    }
+    return bounds;
+}
+
+MeshletMesh buildMeshlets(Mesh const &source, unsigned int maxVertices, unsigned int maxTriangles)
+{
+    MeshletMesh result;
+    std::vector<unsigned int> indices;
+    result.mesh = weldVertices(source, indices);
+
+    unsigned int vertexCount = unsigned(result.mesh.vertices.size());
+    unsigned int triangleCount = unsigned(indices.size() / 3);
+
+    // Triangles using each vertex, as offsets into one array
+    std::vector<unsigned int> adjacencyOffsets(vertexCount + 1, 0);
+    for (unsigned int index : indices)
+    {
+        adjacencyOffsets[index + 1]++;
+    }
+    for (unsigned int v = 0; v < vertexCount; v++)
+    {
+        adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+    }
+    std::vector<unsigned int> adjacency(indices.size());
+    std::vector<unsigned int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (unsigned int t = 0; t < triangleCount; t++)
+    {
+        for (unsigned int corner = 0; corner < 3; corner++)
+        {
+            adjacency[fill[indices[t * 3 + corner]]++] = t;
+        }
+    }
+
+    std::vector<bool> emitted(triangleCount, false);
+    std::vector<bool> inMeshlet(vertexCount, false);
+    std::vector<unsigned int> meshletVertices;
+    unsigned int nextSeed = 0;
+
+    result.mesh.indices.reserve(indices.size());
+    while (true)
+    {
+        while (nextSeed < triangleCount && emitted[nextSeed])
+        {
+            nextSeed++;
+        }
+        if (nextSeed == triangleCount)
+        {
+            break;
+        }
+
+        Meshlet meshlet;
+        meshlet.indexOffset = unsigned(result.mesh.indices.size());
+        meshlet.triangleCount = 0;
+
+        unsigned int triangle = nextSeed;
+        while (true)
+        {
+            emitted[triangle] = true;
+            meshlet.triangleCount++;
+            for (unsigned int corner = 0; corner < 3; corner++)
+            {
+                unsigned int vertex = indices[triangle * 3 + corner];
+                result.mesh.indices.push_back(vertex);
+                if (!inMeshlet[vertex])
+                {
+                    inMeshlet[vertex] = true;
+                    meshletVertices.push_back(vertex);
+                }
+            }
+
+            if (meshlet.triangleCount == maxTriangles)
+            {
+                break;
+            }
+
+            // The neighbour bringing the fewest new vertices keeps the meshlet compact
+            int best = -1;
+            unsigned int bestNewVertices = 4;
+            for (unsigned int vertex : meshletVertices)
+            {
+                for (unsigned int a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; a++)
+                {
+                    unsigned int candidate = adjacency[a];
+                    if (emitted[candidate])
+                    {
+                        continue;
+                    }
+                    unsigned int newVertices = 0;
+                    for (unsigned int corner = 0; corner < 3; corner++)
+                    {
+                        newVertices += inMeshlet[indices[candidate * 3 + corner]] ? 0 : 1;
+                    }
+                    if (newVertices < bestNewVertices)
+                    {
+                        best = int(candidate);
+                        bestNewVertices = newVertices;
+                    }
+                }
+                if (bestNewVertices == 0)
+                {
+                    break;
+                }
+            }
+
+            if (best < 0 || meshletVertices.size() + bestNewVertices > maxVertices)
+            {
+                break;
+            }
+            triangle = unsigned(best);
+        }
+
+        meshlet.vertexCount = unsigned(meshletVertices.size());
+        for (unsigned int vertex : meshletVertices)
+        {
+            inMeshlet[vertex] = false;
+        }
+        meshletVertices.clear();
+
+        result.meshlets.push_back(meshlet);
+        result.bounds.push_back(computeBounds(result.mesh, &result.mesh.indices[meshlet.indexOffset], meshlet.triangleCount));
+    }
+
+    return result;
+}
+
+MeshletRenderer::MeshletRenderer(GpuResourceManager &resources, MeshletMesh const &source)
+    : meshlets(source.meshlets)
+{
+    mesh = resources.createMesh(source.mesh);
+
+    size_t padded = (source.bounds.size() + 3) & ~size_t(3);
+
+    // The padding meshlets have a huge negative radius, which fails the frustum test
+    centresX.resize(padded, 0.0f);
+    centresY.resize(padded, 0.0f);
+    centresZ.resize(padded, 0.0f);
+    radii.resize(padded, -1e30f);
+    axesX.resize(padded, 0.0f);
+    axesY.resize(padded, 0.0f);
+    axesZ.resize(padded, 0.0f);
+    cutoffs.resize(padded, 1.0f);
+
+    for (size_t i = 0; i < source.bounds.size(); i++)
+    {
+        MeshletBounds const &bounds = source.bounds[i];
+        centresX[i] = bounds.centre.x;
+        centresY[i] = bounds.centre.y;
+        centresZ[i] = bounds.centre.z;
+        radii[i] = bounds.radius;
+        axesX[i] = bounds.coneAxis.x;
+        axesY[i] = bounds.coneAxis.y;
+        axesZ[i] = bounds.coneAxis.z;
+        cutoffs[i] = bounds.coneCutoff;
+    }
+
+    visible.resize((padded + 31) / 32);
+}
+
+void MeshletRenderer::cull(glm::vec4 const planes[6], glm::vec3 const &camera)
+{
+    std::fill(visible.begin(), visible.end(), 0u);
+
+    for (unsigned int first = 0; first < centresX.size(); first += 4)
+    {
+        int frustumMask;
+        int coneMask;
+
+#ifdef MESHLETS_SSE
+        __m128 x = _mm_loadu_ps(&centresX[first]);
+        __m128 y = _mm_loadu_ps(&centresY[first]);
+        __m128 z = _mm_loadu_ps(&centresZ[first]);
+        __m128 r = _mm_loadu_ps(&radii[first]);
+        __m128 minusR = _mm_sub_ps(_mm_setzero_ps(), r);
+
+        // Outside when the sphere lies entirely behind one of the planes
+        __m128 outside = _mm_setzero_ps();
+        for (int p = 0; p < 6; p++)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].x), x),
+                                                    _mm_mul_ps(_mm_set1_ps(planes[p].y), y)),
+                                         _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].z), z),
+                                                    _mm_set1_ps(planes[p].w)));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, minusR));
+        }
+        frustumMask = _mm_movemask_ps(outside);
+
+        __m128 dx = _mm_sub_ps(x, _mm_set1_ps(camera.x));
+        __m128 dy = _mm_sub_ps(y, _mm_set1_ps(camera.y));
+        __m128 dz = _mm_sub_ps(z, _mm_set1_ps(camera.z));
+        __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+        __m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_loadu_ps(&axesX[first])),
+                                             _mm_mul_ps(dy, _mm_loadu_ps(&axesY[first]))),
+                                  _mm_mul_ps(dz, _mm_loadu_ps(&axesZ[first])));
+        __m128 limit = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&cutoffs[first]), distance), r);
+        coneMask = _mm_movemask_ps(_mm_cmpge_ps(along, limit));
+#else
+        frustumMask = 0;
+        coneMask = 0;
+        for (unsigned int lane = 0; lane < 4; lane++)
+        {
+            unsigned int i = first + lane;
+            for (int p = 0; p < 6; p++)
+            {
+                float distance = planes[p].x * centresX[i] + planes[p].y * centresY[i] + planes[p].z * centresZ[i] + planes[p].w;
+                if (distance < -radii[i])
+                {
+                    frustumMask |= 1 << lane;
+                }
+            }
+
+            float dx = centresX[i] - camera.x;
+            float dy = centresY[i] - camera.y;
+            float dz = centresZ[i] - camera.z;
+            float distance = std::sqrt(dx * dx + dy * dy + dz * dz);
+            if (dx * axesX[i] + dy * axesY[i] + dz * axesZ[i] >= cutoffs[i] * distance + radii[i])
+            {
+                coneMask |= 1 << lane;
+            }
+        }
+#endif
+
+        // The padding only counts as frustum culled, and is dropped from the counters below
+        stats.frustumCulled += countLanes(frustumMask);
+        stats.backfaceCulled += countLanes(coneMask & ~frustumMask);
+
+        unsigned int survivors = unsigned(~(frustumMask | coneMask)) & 15u;
+        visible[first / 32] |= survivors << (first % 32);
+    }
+
+    stats.frustumCulled -= unsigned(centresX.size() - meshlets.size());
+}
+
+void MeshletRenderer::draw(glm::mat4 const &model, glm::mat4 const &viewProjection, glm::vec3 const &cameraPosition)
+{
+    stats = MeshletStats();
+    stats.meshlets = unsigned(meshlets.size());
+
+    // The bounds are tested in the space of the mesh: the planes of the model-view-projection
+    // matrix are the frustum planes in that space, the camera is brought back with the
+    // inverse model matrix. The radii are exact for uniform scales.
+    glm::vec4 planes[6];
+    extractFrustumPlanes(viewProjection * model, planes);
+    glm::vec4 camera = glm::inverse(model) * glm::vec4(cameraPosition, 1.0f);
+    cull(planes, glm::vec3(camera.x, camera.y, camera.z));
+
+    // Consecutive meshlets are contiguous in the index buffer and merge into one range
+    rangeCounts.clear();
+    rangeOffsets.clear();
+    int lastVisible = -2;
+    for (unsigned int i = 0; i < meshlets.size(); i++)
+    {
+        if ((visible[i / 32] & (1u << (i % 32))) == 0)
+        {
+            continue;
+        }
+
+        Meshlet const &meshlet = meshlets[i];
+        stats.drawnTriangles += meshlet.triangleCount;
+        if (int(i) == lastVisible + 1)
+        {
+            rangeCounts.back() += GLsizei(meshlet.triangleCount * 3);
+        }
+        else
+        {
+            rangeCounts.push_back(GLsizei(meshlet.triangleCount * 3));
+            rangeOffsets.push_back((const void *) (size_t(meshlet.indexOffset) * sizeof(unsigned int)));
+        }
+        lastVisible = int(i);
+    }
+
+    stats.ranges = unsigned(rangeCounts.size());
+    if (rangeCounts.empty())
+    {
+        return;
+    }
+
+    getGLStateCache().bindVertexArray(mesh->use());
+    glMultiDrawElements(GL_TRIANGLES, rangeCounts.data(), GL_UNSIGNED_INT, rangeOffsets.data(), GLsizei(rangeCounts.size()));
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <vector>
+#include "mesh.hpp"
+#include "gpuResources.hpp"
+
+// Limits of a meshlet, the sizes commonly used for mesh shader workgroups. 64 vertices are
+// also about what the post-transform vertex cache of the GPU holds.
+const unsigned int meshletMaxVertices = 64;
+const unsigned int meshletMaxTriangles = 124;
+
+// A small cluster of neighbouring triangles, drawn or rejected as a whole
+struct Meshlet {
+    // First index of the meshlet in the index buffer of its MeshletMesh
+    unsigned int indexOffset;
+    unsigned int triangleCount;
+    unsigned int vertexCount;
+};
+
+// Bounds of a meshlet, in the space of the mesh
+struct MeshletBounds {
+    glm::vec3 centre;
+    float radius;
+
+    // All the triangles of the meshlet face away from a camera for which
+    // dot(centre - camera, coneAxis) >= coneCutoff * |centre - camera| + radius.
+    // A cutoff of 1 disables the test, for meshlets whose normals spread too much.
+    glm::vec3 coneAxis;
+    float coneCutoff;
+};
+
+// A mesh whose triangles are grouped into meshlets
+struct MeshletMesh {
+    // The source mesh with its duplicated vertices welded together, and its triangles
+    // reordered so that the triangles of each meshlet are contiguous
+    Mesh mesh = Mesh("<missing>");
+
+    std::vector<Meshlet> meshlets;
+    std::vector<MeshletBounds> bounds;
+};
+
+// Splits a mesh into meshlets. The meshlets are grown greedily from a seed triangle,
+// always adding the neighbouring triangle which brings the fewest new vertices, until
+// one of the limits is reached or no neighbour is left.
+MeshletMesh buildMeshlets(Mesh const &source,
+                          unsigned int maxVertices = meshletMaxVertices,
+                          unsigned int maxTriangles = meshletMaxTriangles);
+
+// Counters of the last draw
+struct MeshletStats {
+    unsigned int meshlets = 0;
+    unsigned int frustumCulled = 0;
+    unsigned int backfaceCulled = 0;
+    unsigned int drawnTriangles = 0;
+
+    // Index ranges passed to glMultiDrawElements, after merging adjacent meshlets
+    unsigned int ranges = 0;
+};
+
+// Draws a MeshletMesh, rejecting the meshlets outside the view frustum or facing away from
+// the camera on the CPU. The bounds are kept as structures of arrays, so the tests run on
+// four meshlets at a time with SSE. The surviving meshlets are drawn with one
+// glMultiDrawElements, consecutive ones merged into a single range.
+class MeshletRenderer {
+public:
+    MeshletRenderer(GpuResourceManager &resources, MeshletMesh const &source);
+
+    // Draws with the program currently bound, which must already hold the transformation
+    // matrix. cameraPosition is in world space.
+    void draw(glm::mat4 const &model, glm::mat4 const &viewProjection, glm::vec3 const &cameraPosition);
+
+    MeshletStats const & getStats() const { return stats; }
+
+private:
+    MeshletRenderer(MeshletRenderer const &) = delete;
+    MeshletRenderer & operator =(MeshletRenderer const &) = delete;
+
+    // Sets bit i of visible[i / 32] for the meshlets passing both tests
+    void cull(glm::vec4 const planes[6], glm::vec3 const &camera);
+
+    GpuMesh *mesh;
+    std::vector<Meshlet> meshlets;
+
+    // Bounds as structures of arrays, padded to a multiple of 4 with meshlets always culled
+    std::vector<float> centresX;
+    std::vector<float> centresY;
+    std::vector<float> centresZ;
+    std::vector<float> radii;
+    std::vector<float> axesX;
+    std::vector<float> axesY;
+    std::vector<float> axesZ;
+    std::vector<float> cutoffs;
+
+    std::vector<uint32_t> visible;
+    std::vector<GLsizei> rangeCounts;
+    std::vector<const void *> rangeOffsets;
+
+    MeshletStats stats;
+};
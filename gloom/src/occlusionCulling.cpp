@@ -0,0 +1,326 @@
+#include "occlusionCulling.hpp"
+#include <glm/vec4.hpp>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OCCLUSION_SSE 1
+#endif
+
+// Triangles covering less than this area, in pixels, are not rasterized
+static const float minimumTriangleArea = 1e-6f;
+
+OcclusionCuller::OcclusionCuller(int width, int height)
+    : testedObjects(0), occludedObjects(0)
+{
+    tileCountX = std::max((width + occlusionTileWidth - 1) / occlusionTileWidth, 1);
+    tileCountY = std::max((height + occlusionTileHeight - 1) / occlusionTileHeight, 1);
+    this->width = tileCountX * occlusionTileWidth;
+    this->height = tileCountY * occlusionTileHeight;
+
+    depth.assign(size_t(this->width) * this->height, 1.0f);
+    blockDepth.assign(size_t(this->width / occlusionBlockSize) * (this->height / occlusionBlockSize), 1.0f);
+}
+
+void OcclusionCuller::beginFrame(glm::mat4 const &viewProjection)
+{
+    this->viewProjection = viewProjection;
+    triangles.clear();
+
+    stats = OcclusionStats();
+    testedObjects = 0;
+    occludedObjects = 0;
+}
+
+void OcclusionCuller::addOccluder(Mesh const &mesh, glm::mat4 const &model)
+{
+    glm::mat4 modelViewProjection = viewProjection * model;
+    stats.occluders++;
+
+    for (size_t first = 0; first + 2 < mesh.indices.size(); first += 3)
+    {
+        stats.occluderTriangles++;
+
+        Triangle triangle;
+        float z[3];
+        bool clipped = false;
+        for (int corner = 0; corner < 3; corner++)
+        {
+            float4 const &vertex = mesh.vertices[mesh.indices[first + corner]];
+            glm::vec4 clip = modelViewProjection * glm::vec4(vertex.x, vertex.y, vertex.z, 1.0f);
+
+            // Clipping against the near plane would add triangles, dropping the few
+            // occluders crossing it only makes the culling less effective
+            if (clip.z < -clip.w || clip.w <= 0.0f)
+            {
+                clipped = true;
+                break;
+            }
+
+            float inverseW = 1.0f / clip.w;
+            triangle.x[corner] = (clip.x * inverseW * 0.5f + 0.5f) * float(width);
+            triangle.y[corner] = (clip.y * inverseW * 0.5f + 0.5f) * float(height);
+            z[corner] = clip.z * inverseW * 0.5f + 0.5f;
+        }
+
+        float area = (triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[0]) -
+                     (triangle.x[2] - triangle.x[0]) * (triangle.y[1] - triangle.y[0]);
+        if (clipped || std::fabs(area) < minimumTriangleArea)
+        {
+            stats.rejectedTriangles++;
+            continue;
+        }
+
+        // Both faces are rasterized, the closest one wins anyway
+        if (area < 0.0f)
+        {
+            std::swap(triangle.x[1], triangle.x[2]);
+            std::swap(triangle.y[1], triangle.y[2]);
+            std::swap(z[1], z[2]);
+            area = -area;
+        }
+
+        // Pixels whose centre may be inside the triangle
+        float minX = std::min(std::min(triangle.x[0], triangle.x[1]), triangle.x[2]);
+        float maxX = std::max(std::max(triangle.x[0], triangle.x[1]), triangle.x[2]);
+        float minY = std::min(std::min(triangle.y[0], triangle.y[1]), triangle.y[2]);
+        float maxY = std::max(std::max(triangle.y[0], triangle.y[1]), triangle.y[2]);
+        triangle.minX = std::max(int(std::ceil(minX - 0.5f)), 0);
+        triangle.maxX = std::min(int(std::floor(maxX - 0.5f)), width - 1);
+        triangle.minY = std::max(int(std::ceil(minY - 0.5f)), 0);
+        triangle.maxY = std::min(int(std::floor(maxY - 0.5f)), height - 1);
+        if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+        {
+            stats.rejectedTriangles++;
+            continue;
+        }
+
+        // Depth is linear in screen space after the perspective division
+        float dx1 = triangle.x[1] - triangle.x[0];
+        float dy1 = triangle.y[1] - triangle.y[0];
+        float dx2 = triangle.x[2] - triangle.x[0];
+        float dy2 = triangle.y[2] - triangle.y[0];
+        float dz1 = z[1] - z[0];
+        float dz2 = z[2] - z[0];
+        triangle.depthSlopeX = (dz1 * dy2 - dz2 * dy1) / area;
+        triangle.depthSlopeY = (dz2 * dx1 - dz1 * dx2) / area;
+        triangle.depthOrigin = z[0] - triangle.depthSlopeX * triangle.x[0] - triangle.depthSlopeY * triangle.y[0];
+
+        triangles.push_back(triangle);
+    }
+}
+
+void OcclusionCuller::rasterize(ThreadPool &threadPool)
+{
+    // Each tile is cleared, rasterized and reduced by a single thread
+    threadPool.parallelFor(unsigned(tileCountX * tileCountY), [&](unsigned int begin, unsigned int end, unsigned int)
+    {
+        for (unsigned int tile = begin; tile < end; tile++)
+        {
+            rasterizeTile(int(tile) % tileCountX, int(tile) / tileCountX);
+        }
+    }, 1);
+}
+
+void OcclusionCuller::rasterizeTile(int tileX, int tileY)
+{
+    int minX = tileX * occlusionTileWidth;
+    int minY = tileY * occlusionTileHeight;
+    int maxX = minX + occlusionTileWidth - 1;
+    int maxY = minY + occlusionTileHeight - 1;
+
+    for (int y = minY; y <= maxY; y++)
+    {
+        std::fill(depth.begin() + size_t(y) * width + minX, depth.begin() + size_t(y) * width + maxX + 1, 1.0f);
+    }
+
+    for (Triangle const &triangle : triangles)
+    {
+        if (triangle.maxX < minX || triangle.minX > maxX || triangle.maxY < minY || triangle.minY > maxY)
+        {
+            continue;
+        }
+        rasterizeTriangle(triangle, std::max(triangle.minX, minX), std::max(triangle.minY, minY),
+                          std::min(triangle.maxX, maxX), std::min(triangle.maxY, maxY));
+    }
+
+    // Farthest depth of each block of the tile
+    int blockCountX = width / occlusionBlockSize;
+    for (int blockY = minY; blockY <= maxY; blockY += occlusionBlockSize)
+    {
+        for (int blockX = minX; blockX <= maxX; blockX += occlusionBlockSize)
+        {
+            float farthest = 0.0f;
+            for (int y = blockY; y < blockY + occlusionBlockSize; y++)
+            {
+                float const *row = &depth[size_t(y) * width + blockX];
+                farthest = std::max(farthest, *std::max_element(row, row + occlusionBlockSize));
+            }
+            blockDepth[size_t(blockY / occlusionBlockSize) * blockCountX + blockX / occlusionBlockSize] = farthest;
+        }
+    }
+}
+
+void OcclusionCuller::rasterizeTriangle(Triangle const &triangle, int minX, int minY, int maxX, int maxY)
+{
+    // Edge functions, positive inside: e = a * x + b * y + c
+    float edgeA[3], edgeB[3], edgeC[3];
+    for (int edge = 0; edge < 3; edge++)
+    {
+        int next = (edge + 1) % 3;
+        edgeA[edge] = triangle.y[edge] - triangle.y[next];
+        edgeB[edge] = triangle.x[next] - triangle.x[edge];
+        edgeC[edge] = triangle.x[edge] * triangle.y[next] - triangle.y[edge] * triangle.x[next];
+    }
+
+    // The tiles start on multiples of 4 pixels
+    int startX = minX & ~3;
+
+#ifdef OCCLUSION_SSE
+    const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 stepA[3];
+    for (int edge = 0; edge < 3; edge++)
+    {
+        stepA[edge] = _mm_set1_ps(4.0f * edgeA[edge]);
+    }
+    __m128 depthStep = _mm_set1_ps(4.0f * triangle.depthSlopeX);
+
+    for (int y = minY; y <= maxY; y++)
+    {
+        float centreY = float(y) + 0.5f;
+        __m128 x = _mm_add_ps(_mm_set1_ps(float(startX)), laneOffsets);
+
+        __m128 edges[3];
+        for (int edge = 0; edge < 3; edge++)
+        {
+            edges[edge] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edgeA[edge]), x),
+                                     _mm_set1_ps(edgeB[edge] * centreY + edgeC[edge]));
+        }
+        __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.depthSlopeX), x),
+                              _mm_set1_ps(triangle.depthSlopeY * centreY + triangle.depthOrigin));
+
+        float *row = &depth[size_t(y) * width];
+        for (int pixel = startX; pixel <= maxX; pixel += 4)
+        {
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edges[0], zero), _mm_cmpge_ps(edges[1], zero)),
+                                       _mm_cmpge_ps(edges[2], zero));
+            if (_mm_movemask_ps(inside) != 0)
+            {
+                __m128 current = _mm_loadu_ps(row + pixel);
+                __m128 closest = _mm_min_ps(current, z);
+                _mm_storeu_ps(row + pixel, _mm_or_ps(_mm_and_ps(inside, closest), _mm_andnot_ps(inside, current)));
+            }
+
+            for (int edge = 0; edge < 3; edge++)
+            {
+                edges[edge] = _mm_add_ps(edges[edge], stepA[edge]);
+            }
+            z = _mm_add_ps(z, depthStep);
+        }
+    }
+#else
+    for (int y = minY; y <= maxY; y++)
+    {
+        float centreY = float(y) + 0.5f;
+        float *row = &depth[size_t(y) * width];
+        for (int pixel = startX; pixel <= maxX; pixel++)
+        {
+            float centreX = float(pixel) + 0.5f;
+            bool inside = true;
+            for (int edge = 0; edge < 3; edge++)
+            {
+                inside = inside && edgeA[edge] * centreX + edgeB[edge] * centreY + edgeC[edge] >= 0.0f;
+            }
+            if (inside)
+            {
+                float z = triangle.depthSlopeX * centreX + triangle.depthSlopeY * centreY + triangle.depthOrigin;
+                row[pixel] = std::min(row[pixel], z);
+            }
+        }
+    }
+#endif
+}
+
+bool OcclusionCuller::isVisible(float3 const &boundsMin, float3 const &boundsMax, glm::mat4 const &model)
+{
+    testedObjects++;
+    glm::mat4 modelViewProjection = viewProjection * model;
+
+    // Screen rectangle and closest depth of the corners of the box
+    float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+    float closest = 1e30f;
+    for (int corner = 0; corner < 8; corner++)
+    {
+        glm::vec4 position((corner & 1) ? boundsMax.x : boundsMin.x,
+                           (corner & 2) ? boundsMax.y : boundsMin.y,
+                           (corner & 4) ? boundsMax.z : boundsMin.z, 1.0f);
+        glm::vec4 clip = modelViewProjection * position;
+        if (clip.z < -clip.w || clip.w <= 0.0f)
+        {
+            return true;
+        }
+
+        float inverseW = 1.0f / clip.w;
+        float x = (clip.x * inverseW * 0.5f + 0.5f) * float(width);
+        float y = (clip.y * inverseW * 0.5f + 0.5f) * float(height);
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        closest = std::min(closest, clip.z * inverseW * 0.5f + 0.5f);
+    }
+
+    // Boxes outside of the screen are left to the frustum culling
+    if (maxX < 0.0f || maxY < 0.0f || minX >= float(width) || minY >= float(height))
+    {
+        return true;
+    }
+
+    // Every pixel the rectangle touches
+    int pixelMinX = std::max(int(std::floor(minX)), 0);
+    int pixelMaxX = std::min(int(std::floor(maxX)), width - 1);
+    int pixelMinY = std::max(int(std::floor(minY)), 0);
+    int pixelMaxY = std::min(int(std::floor(maxY)), height - 1);
+
+    int blockCountX = width / occlusionBlockSize;
+    for (int blockY = pixelMinY / occlusionBlockSize; blockY <= pixelMaxY / occlusionBlockSize; blockY++)
+    {
+        for (int blockX = pixelMinX / occlusionBlockSize; blockX <= pixelMaxX / occlusionBlockSize; blockX++)
+        {
+            // Everything in the block is in front of the box
+            if (blockDepth[size_t(blockY) * blockCountX + blockX] < closest)
+            {
+                continue;
+            }
+
+            int startX = std::max(blockX * occlusionBlockSize, pixelMinX);
+            int endX = std::min((blockX + 1) * occlusionBlockSize - 1, pixelMaxX);
+            int startY = std::max(blockY * occlusionBlockSize, pixelMinY);
+            int endY = std::min((blockY + 1) * occlusionBlockSize - 1, pixelMaxY);
+            for (int y = startY; y <= endY; y++)
+            {
+                float const *row = &depth[size_t(y) * width];
+                for (int x = startX; x <= endX; x++)
+                {
+                    if (row[x] >= closest)
+                    {
+                        return true;
+                    }
+                }
+            }
+        }
+    }
+
+    occludedObjects++;
+    return false;
+}
+
+OcclusionStats OcclusionCuller::getStats() const
+{
+    OcclusionStats current = stats;
+    current.testedObjects = testedObjects;
+    current.occludedObjects = occludedObjects;
+    return current;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <glm/mat4x4.hpp>
+#include <atomic>
+#include <vector>
+#include "mesh.hpp"
+#include "threadPool.hpp"
+
+// Size of the tiles the depth buffer is split into, each rasterized by one thread.
+// The width is a multiple of 4 so that the SIMD rows never straddle two tiles.
+const int occlusionTileWidth = 32;
+const int occlusionTileHeight = 16;
+
+// Size of the blocks of the coarse depth buffer
+const int occlusionBlockSize = 8;
+
+// Counters of the current frame
+struct OcclusionStats {
+    unsigned int occluders = 0;
+    unsigned int occluderTriangles = 0;
+
+    // Triangles skipped because they cross the near plane, lie outside of the screen or
+    // cover no pixel
+    unsigned int rejectedTriangles = 0;
+
+    unsigned int testedObjects = 0;
+    unsigned int occludedObjects = 0;
+};
+
+// Culls the objects hidden behind a few large occluders on the CPU, before any OpenGL call.
+//
+// Every frame the occluders are rasterized into a small depth buffer holding the depth of
+// the closest occluder at each pixel. The buffer is split into tiles rasterized in parallel,
+// 4 pixels at a time with SSE. Each tile then keeps the farthest depth of each block of
+// occlusionBlockSize pixels, in a coarse buffer.
+//
+// An object is hidden when the closest point of its bounding box is behind the occluders
+// everywhere the box covers on screen. The coarse buffer settles most objects with a few
+// reads, and the pixels are only read in the blocks where it cannot tell.
+//
+//    culler.beginFrame(viewProjection);
+//    culler.addOccluder(mesh, model);         // for every occluder
+//    culler.rasterize(threadPool);
+//    culler.isVisible(boundsMin, boundsMax, model);  // from any thread
+class OcclusionCuller {
+public:
+    // The size is rounded up to whole tiles
+    OcclusionCuller(int width, int height);
+
+    // Clears the depth buffer and the counters
+    void beginFrame(glm::mat4 const &viewProjection);
+
+    // Projects the triangles of mesh, placed in the world by model
+    void addOccluder(Mesh const &mesh, glm::mat4 const &model);
+
+    void rasterize(ThreadPool &threadPool);
+
+    // Whether some of the box [boundsMin, boundsMax] of the space of model may be seen.
+    // Boxes crossing the near plane are always visible. Safe to call from several threads.
+    bool isVisible(float3 const &boundsMin, float3 const &boundsMax, glm::mat4 const &model);
+
+    OcclusionStats getStats() const;
+
+    // Depth of the closest occluder at each pixel, row by row from the bottom of the screen
+    std::vector<float> const & getDepth() const { return depth; }
+    int getWidth() const  { return width; }
+    int getHeight() const { return height; }
+
+private:
+    OcclusionCuller(OcclusionCuller const &) = delete;
+    OcclusionCuller & operator =(OcclusionCuller const &) = delete;
+
+    // A projected triangle, counter-clockwise on screen, with the plane of its depth
+    struct Triangle {
+        float x[3];
+        float y[3];
+
+        // z = depthOrigin + depthSlopeX * x + depthSlopeY * y
+        float depthOrigin;
+        float depthSlopeX;
+        float depthSlopeY;
+
+        // Pixels covered by the bounding rectangle, inclusive
+        int minX, minY, maxX, maxY;
+    };
+
+    void rasterizeTile(int tileX, int tileY);
+    void rasterizeTriangle(Triangle const &triangle, int minX, int minY, int maxX, int maxY);
+
+    int width;
+    int height;
+    int tileCountX;
+    int tileCountY;
+
+    glm::mat4 viewProjection;
+
+    std::vector<float> depth;
+    std::vector<float> blockDepth;
+    std::vector<Triangle> triangles;
+
+    OcclusionStats stats;
+    std::atomic<unsigned int> testedObjects;
+    std::atomic<unsigned int> occludedObjects;
+};
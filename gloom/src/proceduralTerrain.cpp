@@ -0,0 +1,38 @@
+#include "proceduralTerrain.hpp"
+#include "frameConstants.hpp"
+#include "glStateCache.hpp"
+
+ProceduralTerrain::ProceduralTerrain(GpuResourceManager &resources, unsigned int width, unsigned int height, float tileWidth,
+                                     float4 tileColour1, float4 tileColour2, std::string const &fragmentShader)
+    : width(width), height(height), tileWidth(tileWidth),
+      tileColour1(tileColour1.x, tileColour1.y, tileColour1.z, tileColour1.w),
+      tileColour2(tileColour2.x, tileColour2.y, tileColour2.z, tileColour2.w),
+      emptyVertexArray(&resources)
+{
+    program = resources.createProgram("../gloom/shaders/terrain.vert", fragmentShader);
+    bindSceneUniformBlocks(program->get());
+    modelMatrixLocation = glGetUniformLocation(program->get(), "modelMatrix");
+    tileWidthLocation = glGetUniformLocation(program->get(), "tileWidth");
+    tileColour1Location = glGetUniformLocation(program->get(), "tileColour1");
+    tileColour2Location = glGetUniformLocation(program->get(), "tileColour2");
+}
+
+void ProceduralTerrain::draw(glm::mat4 const &modelMatrix)
+{
+    if (width == 0 || height == 0)
+    {
+        return;
+    }
+
+    GLStateCache &state = getGLStateCache();
+
+    // The cache drops the uniforms which did not change since the last frame
+    state.useProgram(program->get());
+    state.uniformMatrix4(modelMatrixLocation, modelMatrix);
+    state.uniform1f(tileWidthLocation, tileWidth);
+    state.uniform4f(tileColour1Location, tileColour1);
+    state.uniform4f(tileColour2Location, tileColour2);
+
+    state.bindVertexArray(emptyVertexArray.get());
+    glDrawArraysInstanced(GL_TRIANGLES, 0, GLsizei(6 * width), GLsizei(height));
+}
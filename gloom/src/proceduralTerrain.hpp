@@ -0,0 +1,41 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/mat4x4.hpp>
+#include <string>
+#include "floats.hpp"
+#include "gpuResources.hpp"
+
+// The chessboard of generateChessboard, generated in terrain.vert from gl_VertexID and
+// gl_InstanceID instead of being stored in vertex buffers. Any board size takes no vertex
+// memory and a single draw call: one instance for each row of tiles, 6 vertices per tile.
+class ProceduralTerrain {
+public:
+    // fragmentShader is the shader used for the rest of the scene (simple.frag, clustered.frag, ...)
+    ProceduralTerrain(GpuResourceManager &resources, unsigned int width, unsigned int height, float tileWidth,
+                      float4 tileColour1, float4 tileColour2, std::string const &fragmentShader);
+
+    GLuint getProgram() { return program->get(); }
+
+    // Draws the board with the frame constants of the scene, which must be bound
+    void draw(glm::mat4 const &modelMatrix);
+
+private:
+    ProceduralTerrain(ProceduralTerrain const &) = delete;
+    ProceduralTerrain & operator =(ProceduralTerrain const &) = delete;
+
+    unsigned int width;
+    unsigned int height;
+    float tileWidth;
+    glm::vec4 tileColour1;
+    glm::vec4 tileColour2;
+
+    GpuProgram *program;
+    GLint modelMatrixLocation;
+    GLint tileWidthLocation;
+    GLint tileColour1Location;
+    GLint tileColour2Location;
+
+    // Core profiles need a bound VAO even for a draw without attributes
+    GpuVertexArray emptyVertexArray;
+};
@@ -4,6 +4,7 @@
 #include "gloom/shader.hpp"
 #include <math.h>
 #include <iostream>
+#include <algorithm>
 #include <glm/mat4x4.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/transform.hpp>
@@ -16,16 +17,23 @@
 
 void runProgram(GLFWwindow *window)
 {
+    // Report the driver errors and warnings asynchronously when enabled
+    initialiseGLDebugLayer();
+
+    // The fixed function state goes through the state cache, so that later calls setting
+    // the same values are dropped
+    GLStateCache &state = getGLStateCache();
+
     // Enable depth (Z) buffer (accept "closest" fragment)
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
+    state.enable(GL_DEPTH_TEST);
+    state.depthFunc(GL_LESS);
 
-    //Enable transparency
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    // Blending is only enabled where transparent geometry is drawn
+    state.disable(GL_BLEND);
+    state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     // Configure miscellaneous OpenGL settings
-    glEnable(GL_CULL_FACE);
+    state.enable(GL_CULL_FACE);
 
     // Set default colour after clearing the colour buffer
     glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
@@ -58,12 +66,18 @@ void runProgram(GLFWwindow *window)
     //drawSpiral(window, 0.0, 0.0, 0.5, 5);                             //shaders: simple.vert and simple.frag
     //drawChangingColorInTime(window, uniformLocation);                 //shaders: simple.vert and changeColorInTime.frag
     //drawTrheeOverlappingTriangle(window);                             //shaders: simple.vert and simple.frag
+    //drawOrderIndependentTriangles(window);                            //shaders: simple.vert and transparencyAccumulate.frag
     //drawTransformation(window, uniformMatrixLocation);                //shaders: transformation.vert and simple.frag
     //camera(window, uniformMatrixLocation);                            //shaders: transformation.vert and simple.frag
     //drawSteve(window, uniformMatrixLocation);                         //shaders: transformation.vert and simple.frag
+    //drawMeshletModel(window, uniformMatrixLocation);                  //shaders: transformation.vert and simple.frag
+    //drawCrowd(window);                                                //shaders: instanced.vert and simple.frag
 
     //printScene(constructSceneGraph());
-    drawScene(window, uniformMatrixLocation);                           //shaders: transfromation.vert and simple.frag
+    drawScene(window);                                                  //shaders: scene.vert and simple.frag
+
+    // Only the demos above read the matrix uniform, drawScene() uploads its matrices in blocks
+    (void) uniformMatrixLocation;
 }
 
 void draw(GLFWwindow *window, unsigned int vaoID, int number_of_vertices, int mode)
@@ -257,35 +271,67 @@ unsigned int setUpVAOWithColorFloat4(std::vector<float4> vertices, unsigned int
     return vaoID;
 }
 
+// Rendering loop of the 2D demos: the shapes are added again to the batch every frame
+static void drawShapes(GLFWwindow *window, std::function<void(ShapeBatch &)> const &addShapes)
+{
+    GpuResourceManager resources(gpuMemoryBudget);
+
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    ShapeBatch batch(resources, width, height);
+
+    while (!glfwWindowShouldClose(window))
+    {
+        // Clear colour and depth buffers
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        glfwGetFramebufferSize(window, &width, &height);
+        batch.setViewport(width, height);
+
+        addShapes(batch);
+        batch.flush();
+
+        // Handle other events
+        glfwPollEvents();
+        handleKeyboardInput(window);
+
+        // Flip buffers
+        glfwSwapBuffers(window);
+    }
+}
+
 void drawFiveTriangles(GLFWwindow *window)
 {
 
     //5 triangles coordinates to be changed if you want to draw differents triangles.
-    float coordinates[] =
+    glm::vec2 coordinates[] =
     {
-        1.0, 0.0, 0.0,
-        0.6, 0.6, 0.0,
-        0.0, 0.6, 0.0,
-        -0.6f, 0.6f, 0.0f,
-        -1.0f, 0.0f, 0.0f,
-        -0.6f, -0.6f, 0.0f,
-        0.0f, -0.6f, 0.0f,
-        0.6f, -0.6f, 0.0f,
-        0.3f, 0.0f, 0.0f,
-        0.0f, 0.3f, 0.0f,
-        -0.3f, 0.0f, 0.0f,
+        glm::vec2(1.0f, 0.0f),
+        glm::vec2(0.6f, 0.6f),
+        glm::vec2(0.0f, 0.6f),
+        glm::vec2(-0.6f, 0.6f),
+        glm::vec2(-1.0f, 0.0f),
+        glm::vec2(-0.6f, -0.6f),
+        glm::vec2(0.0f, -0.6f),
+        glm::vec2(0.6f, -0.6f),
+        glm::vec2(0.3f, 0.0f),
+        glm::vec2(0.0f, 0.3f),
+        glm::vec2(-0.3f, 0.0f),
     };
 
-    //index buffer to draw 5 triangles
+    //index of the vertices of the 5 triangles
     int index[] = {0, 1, 2, 2, 3, 4, 4, 5, 6, 6, 7, 0, 8, 9, 10};
 
     int number_of_triangles = 5;
 
-    // Set up the Vertex Array Objects to draw 5 triangles
-    unsigned int vaoID = setUpVAO(coordinates, index, sizeof(coordinates), sizeof(index), 3);
-
-    // Effective draw of the 5 triangles
-    draw(window, vaoID, number_of_triangles * 3, 0);
+    drawShapes(window, [&](ShapeBatch &batch)
+    {
+        for (int i = 0; i < number_of_triangles; i++)
+        {
+            batch.triangle(coordinates[index[i * 3]], coordinates[index[i * 3 + 1]], coordinates[index[i * 3 + 2]],
+                           glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+        }
+    });
 }
 
 void drawSingleTriangle(GLFWwindow *window)
@@ -312,71 +358,19 @@ void drawSingleTriangle(GLFWwindow *window)
 
 void drawCircle(GLFWwindow *window, float cx, float cy, float r)
 {
-
-    int number_of_triangles = 90;
-    int number_of_dimension = 2;
-    int num_segments = number_of_triangles + 2;
-    float coordinates[number_of_triangles * 3];
-    int index[number_of_triangles * 3];
-
-    int n = 2;
-    //set the centre of the circle
-    coordinates[0] = 0.0;
-    coordinates[1] = 0.0;
-    index[0] = 0;
-
-    // Compute all the other vertices and fill the coordinates and index arrays
-    for(int ii = 0; ii <= num_segments; ii++)
+    // The number of segments follows the size of the circle on screen
+    drawShapes(window, [=](ShapeBatch &batch)
     {
-        float theta = 2.0f * 3.14169f * float(ii) / float(num_segments);//get the current angle
-
-        float x = r * cosf(theta);//calculate the x component
-        float y = r * sinf(theta);//calculate the y component
-
-        coordinates[n] = x + cx;
-        coordinates[n + 1] = y + cy;
-
-        n += 2;
-
-        index[ii + 1] = ii + 1;
-
-    }
-
-    unsigned int vaoID = setUpVAO(coordinates, index, number_of_triangles * 3 * number_of_dimension, number_of_triangles * 3, number_of_dimension);
-
-    draw(window, vaoID, number_of_triangles * 3, 1);
+        batch.circle(glm::vec2(cx, cy), r, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    });
 }
 
 void drawSpiral(GLFWwindow *window, float cx, float cy, float r, int times)
 {
-    int number_of_dimension = 2;
-    int number_of_vertices = 1200;
-    int num_segments = number_of_vertices;
-
-    float coordinates[number_of_vertices * number_of_dimension];
-    int index[number_of_vertices];
-
-    int n = 0;
-    for(int ii = 0; ii < num_segments; ii++)
+    drawShapes(window, [=](ShapeBatch &batch)
     {
-        float theta = 2.0f * 3.14169f * float(ii) / float(num_segments / times); //get the current angle
-
-        float x = r * cosf(theta);//calculate the x component
-        float y = r * sinf(theta);//calculate the y component
-
-        coordinates[n] = x + cx;
-        coordinates[n + 1] = y + cy;
-
-        n += 2;
-
-        index[ii] = ii;
-
-        r = r - r * times / num_segments;
-    }
-
-    unsigned int vaoID = setUpVAO(coordinates, index, number_of_vertices * number_of_dimension, number_of_vertices, number_of_dimension);
-
-    draw(window, vaoID, number_of_vertices, 2);
+        batch.spiral(glm::vec2(cx, cy), r, float(times), 1.5f, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    });
 }
 
 void drawChangingColorInTime(GLFWwindow *window, int uniformLocation)
@@ -427,7 +421,8 @@ void drawChangingColorInTime(GLFWwindow *window, int uniformLocation)
 
 }
 
-void drawTrheeOverlappingTriangle(GLFWwindow *window)
+// Set up the Vertex Array Object of the 3 translucent triangles
+static unsigned int setUpOverlappingTriangles()
 {
     //3 triangles coordinates to be changed if you want to draw differents triangles.
     float coordinates[] =
@@ -457,15 +452,71 @@ void drawTrheeOverlappingTriangle(GLFWwindow *window)
                          1.0, 0.5, 0.5, 0.8
                         };
 
+    return setUpVAOWithColor(coordinates, index, sizeof(coordinates), sizeof(index), 3, RGBAcolor, sizeof(RGBAcolor));
+}
+
+void drawTrheeOverlappingTriangle(GLFWwindow *window)
+{
     int number_of_triangles = 3;
 
     // Set up the Vertex Array Objects to draw 3 triangles
-    unsigned int vaoID = setUpVAOWithColor(coordinates, index, sizeof(coordinates), sizeof(index), 3, RGBAcolor, sizeof(RGBAcolor));
+    unsigned int vaoID = setUpOverlappingTriangles();
+
+    // The triangles are translucent. Blending them in this order only looks right because
+    // the indices list them from the farthest to the closest
+    getGLStateCache().enable(GL_BLEND);
 
     // Effective draw of the 3 triangles
     draw(window, vaoID, number_of_triangles * 3, 0);
 }
 
+void drawOrderIndependentTriangles(GLFWwindow *window)
+{
+    GpuResourceManager resources(gpuMemoryBudget);
+    GLStateCache &state = getGLStateCache();
+
+    // The accumulation shader replaces simple.frag, the vertices are unchanged
+    GpuProgram *program = resources.createProgram("../gloom/shaders/simple.vert", "../gloom/shaders/transparencyAccumulate.frag");
+    TransparencyPass transparency(resources, windowWidth, windowHeight);
+
+    unsigned int vaoID = setUpOverlappingTriangles();
+    unsigned long frameCount = 0;
+
+    // Rendering Loop
+    while (!glfwWindowShouldClose(window))
+    {
+        // Clear colour and depth buffers
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        transparency.begin();
+        applyTransparencyAccumulationState(state);
+        program->activate();
+        state.bindVertexArray(vaoID);
+
+        // Change the order of the triangles every second, the image stays the same
+        for(unsigned long i = 0; i < 3; i++)
+        {
+            unsigned long triangle = (i + frameCount / 60) % 3;
+            glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_INT, (void *)(triangle * 3 * sizeof(int)));
+        }
+
+        transparency.composite();
+
+        // Depth writes are needed by the next glClear
+        state.depthMask(GL_TRUE);
+        state.depthFunc(GL_LESS);
+
+        frameCount++;
+
+        // Handle other events
+        glfwPollEvents();
+        handleKeyboardInput(window);
+
+        // Flip buffers
+        glfwSwapBuffers(window);
+    }
+}
+
 void drawTransformation(GLFWwindow *window, int uniformLocation)
 {
     //3 triangles coordinates to be changed if you want to draw differents triangles.
@@ -561,7 +612,7 @@ void cameraMovement(GLFWwindow *window, int uniformLocation, float *motion)
     glm::mat4x4 matrix = glm::mat4();
 
     // Build the perspective matrix
-    glm::mat4x4 matrixPerspective = glm::perspective(glm::pi<float>() * 0.5f, float(windowWidth/windowHeight), 1.0f, 150.0f);
+    glm::mat4x4 matrixPerspective = glm::perspective(glm::pi<float>() * 0.5f, float(windowWidth) / float(windowHeight), 1.0f, 150.0f);
 
     // Build the view matrix
     glm::vec3 TVector = glm::vec3(motion[0], motion[1], motion[2]);
@@ -694,6 +745,333 @@ void drawSteve(GLFWwindow *window, int uniformLocation)
     }
 }
 
+void drawMeshletModel(GLFWwindow *window, int uniformLocation)
+{
+    // Every object of the model is split into meshlets once, after loading
+    std::vector<Mesh> objects = loadWavefront("../gloom/res/fireyaretziresp.obj");
+    GpuResourceManager resources(gpuMemoryBudget);
+    std::vector<std::unique_ptr<MeshletRenderer>> renderers;
+    for(Mesh &object : objects)
+    {
+        // One colour per object, so that the welding still merges the shared vertices
+        float4 colour(randomUniformFloat(), randomUniformFloat(), randomUniformFloat(), 1.0f);
+        object.colours.assign(object.vertices.size(), colour);
+        renderers.emplace_back(new MeshletRenderer(resources, buildMeshlets(object)));
+    }
+
+    // x, y, z, x angle, y angle;
+    float motion[7] = {0.0f, -8.0f, -30.0f, 0.2f, 0.0f};
+    float angle = 0.0f;
+    unsigned long frameCount = 0;
+
+    while (!glfwWindowShouldClose(window))
+    {
+        resources.beginFrame();
+
+        // Clear colour and depth buffers
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        FrameConstants frame = computeFrameConstants(motion, sceneFarPlane, float(width) / float(std::max(height, 1)));
+
+        // The model is about 6 units wide, turning slowly shows the cone culling at work
+        angle += 0.005f;
+        glm::mat4 model = glm::rotate(angle, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::scale(glm::vec3(4.0f));
+        glm::mat4 cameraMatrix = glm::inverse(frame.view);
+        glm::vec3 cameraPosition(cameraMatrix[3][0], cameraMatrix[3][1], cameraMatrix[3][2]);
+
+        glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, glm::value_ptr(frame.viewProjection * model));
+        for(std::unique_ptr<MeshletRenderer> &renderer : renderers)
+        {
+            renderer->draw(model, frame.viewProjection, cameraPosition);
+        }
+
+        resources.endFrame();
+
+        frameCount++;
+        if(printStatistics && frameCount % statisticsInterval == 0)
+        {
+            for(std::unique_ptr<MeshletRenderer> const &renderer : renderers)
+            {
+                MeshletStats const &stats = renderer->getStats();
+                printf("Meshlets: %u, %u outside the frustum, %u facing away, %u triangles drawn in %u ranges\n",
+                       stats.meshlets, stats.frustumCulled, stats.backfaceCulled, stats.drawnTriangles, stats.ranges);
+            }
+        }
+
+        // Handle other events
+        glfwPollEvents();
+        handleKeyboardInputMotion(window, motion);
+
+        // Flip buffers
+        glfwSwapBuffers(window);
+    }
+}
+
+void setInstanceAttributes(GLuint instanceBuffer, GLintptr offset)
+{
+    getGLStateCache().bindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+
+    // The model matrix takes four consecutive locations, one for each column
+    for(int column = 0; column < 4; column++)
+    {
+        GLintptr columnOffset = offset + column * sizeof(glm::vec4);
+        glVertexAttribPointer(2 + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void *) columnOffset);
+        glEnableVertexAttribArray(2 + column);
+        glVertexAttribDivisor(2 + column, 1);
+    }
+
+    // The colour of the instance
+    GLintptr colourOffset = offset + sizeof(glm::mat4);
+    glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void *) colourOffset);
+    glEnableVertexAttribArray(6);
+    glVertexAttribDivisor(6, 1);
+}
+
+void drawCrowd(GLFWwindow *window)
+{
+    // Every character of the crowd shares the meshes of Steve
+    MinecraftCharacter steve = loadMinecraftCharacterModel("../gloom/res/steve.obj");
+
+    // Place the characters on a grid
+    unsigned int crowdWidth = 100;
+    unsigned int crowdHeight = 100;
+    float spacing = 20.0f;
+    float areaSize = crowdWidth * spacing;
+    unsigned int characterCount = crowdWidth * crowdHeight;
+    std::vector<CrowdCharacter> characters = generateCrowd(crowdWidth, crowdHeight, spacing);
+
+    // Upload each body part once
+    GpuResourceManager resources(gpuMemoryBudget);
+    GpuMesh *bodyParts[BODY_PART_COUNT];
+    for(int part = 0; part < BODY_PART_COUNT; part++)
+    {
+        bodyParts[part] = resources.createMesh(getBodyPartMesh(steve, BodyPart(part)));
+    }
+
+    GpuProgram *program = resources.createProgram("../gloom/shaders/instanced.vert", "../gloom/shaders/simple.frag");
+    GLint viewProjectionLocation = glGetUniformLocation(program->get(), "viewProjection");
+
+    // Cull the crowd on the GPU when the context supports it, draw everything otherwise
+    std::unique_ptr<GpuCrowdCuller> culler;
+    GLsizeiptr instanceAlignment = sizeof(glm::vec4);
+    if(useGpuCulling && GpuCrowdCuller::isSupported())
+    {
+        culler.reset(new GpuCrowdCuller(resources, steve, characterCount));
+        instanceAlignment = GpuCrowdCuller::getInstanceAlignment();
+    }
+
+    // The distant characters are drawn as impostors, baked on the first frame
+    std::unique_ptr<ImpostorRenderer> impostors;
+    if(useImpostors)
+    {
+        impostors.reset(new ImpostorRenderer(resources, steve));
+    }
+
+    // The instances of every body part are computed and streamed each frame. An impostor
+    // takes less room than the body parts of a character, so the same space holds both.
+    GLsizeiptr instanceBytes = GLsizeiptr(characterCount) * BODY_PART_COUNT * sizeof(InstanceData);
+    StreamBuffer instanceBuffer(GL_ARRAY_BUFFER, instanceBytes + instanceAlignment);
+    resources.recordAllocation(CATEGORY_STREAMING, instanceBuffer.getCapacity());
+
+    ThreadPool threadPool;
+    GLStateCache &state = getGLStateCache();
+
+    // The characters close enough to be drawn with meshes, and the impostors of the others,
+    // sorted by each thread into its own list
+    std::vector<CrowdCharacter> nearCharacters;
+    std::vector<std::vector<CrowdCharacter>> threadNearCharacters(threadPool.getThreadCount());
+    std::vector<std::vector<ImpostorInstance>> threadImpostors(threadPool.getThreadCount());
+
+    // x, y, z, x angle, y angle, for the camera movement
+    float motion[7] = {-areaSize / 2.0f, -60.0f, -areaSize / 2.0f, 0.3f, 0.0f};
+    float farPlane = 1000.0f;
+
+    double time = 0.0;
+    getTimeDeltaSeconds();
+
+    unsigned long frameCount = 0;
+
+    while (!glfwWindowShouldClose(window))
+    {
+        resources.beginFrame();
+        instanceBuffer.beginFrame();
+        state.beginFrame();
+
+        // Clear colour and depth buffers
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        time += getTimeDeltaSeconds();
+
+        FrameConstants constants = computeFrameConstants(motion, farPlane);
+        glm::mat4 viewProjection = constants.viewProjection;
+
+        CrowdCharacter const *meshCharacters = characters.data();
+        unsigned int meshCount = characterCount;
+        unsigned int impostorCount = 0;
+        GLintptr impostorOffset = 0;
+
+        if(impostors)
+        {
+            glm::mat4 cameraMatrix = glm::inverse(constants.view);
+            glm::vec3 cameraPosition(cameraMatrix[3][0], cameraMatrix[3][1], cameraMatrix[3][2]);
+
+            glm::vec4 frustumPlanes[6];
+            extractFrustumPlanes(viewProjection, frustumPlanes);
+
+            // The bounding sphere is centred away from the feet, grow it so that it holds
+            // the character whatever its heading
+            glm::vec4 bounds = impostors->getBounds();
+            float radius = bounds.w + std::sqrt(bounds.x * bounds.x + bounds.z * bounds.z);
+
+            // Sort the characters by distance to the camera, dropping the distant ones
+            // outside of the view, which the impostors do not cull on the GPU
+            threadPool.parallelFor(characterCount, [&](unsigned int begin, unsigned int end, unsigned int thread)
+            {
+                for(unsigned int i = begin; i < end; i++)
+                {
+                    float3 position = getCrowdCharacterPosition(characters[i], areaSize, float(time));
+                    glm::vec3 centre(position.x, bounds.y, position.z);
+                    glm::vec3 toCamera = cameraPosition - centre;
+                    if(glm::dot(toCamera, toCamera) < impostorDistance * impostorDistance)
+                    {
+                        threadNearCharacters[thread].push_back(characters[i]);
+                        continue;
+                    }
+
+                    bool visible = true;
+                    for(int plane = 0; plane < 6 && visible; plane++)
+                    {
+                        visible = frustumPlanes[plane].x * centre.x + frustumPlanes[plane].y * centre.y +
+                                  frustumPlanes[plane].z * centre.z + frustumPlanes[plane].w >= -radius;
+                    }
+                    if(visible)
+                    {
+                        float4 const &colour = characters[i].colour;
+                        ImpostorInstance impostor;
+                        impostor.positionAndHeading = glm::vec4(position.x, position.y, position.z, characters[i].heading);
+                        impostor.colour = glm::vec4(colour.x, colour.y, colour.z, colour.w);
+                        threadImpostors[thread].push_back(impostor);
+                    }
+                }
+            });
+
+            nearCharacters.clear();
+            for(std::vector<CrowdCharacter> &bucket : threadNearCharacters)
+            {
+                nearCharacters.insert(nearCharacters.end(), bucket.begin(), bucket.end());
+                bucket.clear();
+            }
+            meshCharacters = nearCharacters.data();
+            meshCount = unsigned(nearCharacters.size());
+
+            for(std::vector<ImpostorInstance> const &bucket : threadImpostors)
+            {
+                impostorCount += unsigned(bucket.size());
+            }
+
+            ImpostorInstance *impostorData = impostorCount == 0 ? nullptr :
+                (ImpostorInstance *) instanceBuffer.map(GLsizeiptr(impostorCount) * sizeof(ImpostorInstance),
+                                                        sizeof(glm::vec4), impostorOffset);
+            if(impostorData != nullptr)
+            {
+                for(std::vector<ImpostorInstance> &bucket : threadImpostors)
+                {
+                    std::copy(bucket.begin(), bucket.end(), impostorData);
+                    impostorData += bucket.size();
+                }
+                instanceBuffer.unmap();
+            }
+            else
+            {
+                impostorCount = 0;
+            }
+
+            for(std::vector<ImpostorInstance> &bucket : threadImpostors)
+            {
+                bucket.clear();
+            }
+        }
+
+        // Animate the characters drawn with meshes on all cores, writing straight into the stream buffer
+        GLintptr instanceOffset = 0;
+        GLsizeiptr meshInstanceBytes = GLsizeiptr(meshCount) * BODY_PART_COUNT * sizeof(InstanceData);
+        InstanceData *instances = meshCount == 0 ? nullptr :
+            (InstanceData *) instanceBuffer.map(meshInstanceBytes, instanceAlignment, instanceOffset);
+        if(instances != nullptr)
+        {
+            threadPool.parallelFor(meshCount, [&](unsigned int begin, unsigned int end, unsigned int)
+            {
+                computeCrowdInstances(meshCharacters, begin, end, meshCount, areaSize, float(time), instances);
+            });
+            instanceBuffer.unmap();
+
+            if(culler)
+            {
+                // Only the visible instances are drawn, with a single indirect draw call
+                {
+                    GLDebugGroup group("Crowd culling");
+                    culler->cull(instanceBuffer.get(), instanceOffset, meshCount, viewProjection);
+                }
+
+                GLDebugGroup group("Crowd");
+                program->activate();
+                state.uniformMatrix4(viewProjectionLocation, viewProjection);
+                culler->draw();
+            }
+            else
+            {
+                GLDebugGroup group("Crowd");
+                program->activate();
+                state.uniformMatrix4(viewProjectionLocation, viewProjection);
+
+                // One instanced draw call for each body part
+                for(int part = 0; part < BODY_PART_COUNT; part++)
+                {
+                    state.bindVertexArray(bodyParts[part]->use());
+                    setInstanceAttributes(instanceBuffer.get(), instanceOffset + GLintptr(part) * meshCount * sizeof(InstanceData));
+                    glDrawElementsInstanced(GL_TRIANGLES, bodyParts[part]->getIndexCount(), GL_UNSIGNED_INT, 0, meshCount);
+                }
+            }
+        }
+
+        if(impostors)
+        {
+            GLDebugGroup group("Crowd impostors");
+            impostors->draw(instanceBuffer.get(), impostorOffset, impostorCount, constants.view, viewProjection);
+        }
+
+        instanceBuffer.endFrame();
+        resources.endFrame();
+
+        flushGLDebugMessages();
+
+        frameCount++;
+        if(printStatistics && frameCount % statisticsInterval == 0)
+        {
+            resources.printStats();
+
+            GLStateStats const &stateStats = state.getLastFrameStats();
+            printf("GL state: %u calls issued, %u skipped\n", stateStats.issued, stateStats.skipped);
+
+            if(impostors)
+            {
+                ImpostorStats const &impostorStats = impostors->getStats();
+                printf("Crowd: %u characters with meshes, %u impostors in %u draw calls\n",
+                       meshCount, impostorStats.impostors, impostorStats.drawCalls);
+            }
+        }
+
+        // Handle other events
+        glfwPollEvents();
+        handleKeyboardInputMotion(window, motion);
+
+        // Flip buffers
+        glfwSwapBuffers(window);
+    }
+}
+
 void handleKeyboardInputMotion(GLFWwindow *window, float *motion)
 {
     // Use escape key for terminating the GLFW window
@@ -774,7 +1152,7 @@ void handleKeyboardInput(GLFWwindow *window)
     }
 }
 
-SceneNode *constructSceneGraph(MinecraftCharacter &steve, Mesh &terrain, float3 initialPosition)
+SceneNode *constructSceneGraph(MinecraftCharacter &steve, Mesh &terrain, float3 initialPosition, GpuResourceManager &resources, UploadService *uploads, EntityWorld *entities)
 {
     // Generate one SceneNode for each object
     SceneNode *rootNode = createSceneNode();
@@ -805,22 +1183,37 @@ SceneNode *constructSceneGraph(MinecraftCharacter &steve, Mesh &terrain, float3
     addChild(rootNode, torsoNode);
     addChild(rootNode, terrainNode);
 
-    // Initialise the values in the SceneNode data structure
-    torsoNode->vertexArrayObjectID = setUpVAOWithColorFloat4(steve.torso.vertices, &steve.torso.indices[0], steve.torso.vertices.size() * 4, steve.torso.indices.size(), 4, steve.torso.colours, steve.torso.colours.size() * 4);
-    leftLegNode->vertexArrayObjectID = setUpVAOWithColorFloat4(steve.leftLeg.vertices, &steve.leftLeg.indices[0], steve.leftLeg.vertices.size() * 4, steve.leftLeg.indices.size(), 4, steve.leftLeg.colours, steve.leftLeg.colours.size() * 4);
-    leftArmNode->vertexArrayObjectID = setUpVAOWithColorFloat4(steve.leftArm.vertices, &steve.leftArm.indices[0], steve.leftArm.vertices.size() * 4, steve.leftArm.indices.size(), 4, steve.leftArm.colours, steve.leftArm.colours.size() * 4);
-    rightLegNode->vertexArrayObjectID = setUpVAOWithColorFloat4(steve.rightLeg.vertices, &steve.rightLeg.indices[0], steve.rightLeg.vertices.size() * 4, steve.rightLeg.indices.size(), 4, steve.rightLeg.colours, steve.rightLeg.colours.size() * 4);
-    rightArmNode->vertexArrayObjectID = setUpVAOWithColorFloat4(steve.rightArm.vertices, &steve.rightArm.indices[0], steve.rightArm.vertices.size() * 4, steve.rightArm.indices.size(), 4, steve.rightArm.colours, steve.rightArm.colours.size() * 4);
-    headNode->vertexArrayObjectID = setUpVAOWithColorFloat4(steve.head.vertices, &steve.head.indices[0], steve.head.vertices.size() * 4, steve.head.indices.size(), 4, steve.head.colours, steve.head.colours.size() * 4);
-    terrainNode->vertexArrayObjectID = setUpVAOWithColorFloat4(terrain.vertices, &terrain.indices[0], terrain.vertices.size() * 4, terrain.indices.size(), 4, terrain.colours, terrain.colours.size() * 4);
-
-    torsoNode->VAOIndexCount = steve.torso.indices.size();
-    headNode->VAOIndexCount = steve.head.indices.size();
-    leftLegNode->VAOIndexCount = steve.leftLeg.indices.size();
-    leftArmNode->VAOIndexCount = steve.leftArm.indices.size();
-    rightLegNode->VAOIndexCount = steve.rightLeg.indices.size();
-    rightArmNode->VAOIndexCount = steve.rightArm.indices.size();
-    terrainNode->VAOIndexCount = terrain.indices.size();
+    // Upload the meshes, the resource manager owns the GPU buffers from now on.
+    // With an upload service the nodes get their mesh a few frames later, once it is on the GPU.
+    std::vector<std::pair<SceneNode *, Mesh *>> nodeMeshes = {
+        {torsoNode, &steve.torso}, {leftLegNode, &steve.leftLeg}, {leftArmNode, &steve.leftArm},
+        {rightLegNode, &steve.rightLeg}, {rightArmNode, &steve.rightArm}, {headNode, &steve.head},
+        {terrainNode, &terrain}
+    };
+    for(std::pair<SceneNode *, Mesh *> &nodeMesh : nodeMeshes)
+    {
+        SceneNode *node = nodeMesh.first;
+        if(nodeMesh.second->indices.empty())
+        {
+            continue;
+        }
+        if(uploads != nullptr)
+        {
+            uploads->uploadMesh(*nodeMesh.second, [node](GpuMesh *mesh) { setNodeMesh(node, mesh); });
+        }
+        else
+        {
+            setNodeMesh(node, resources.createMesh(*nodeMesh.second));
+        }
+    }
+
+    // The terrain never moves, it is drawn from a command list
+    setNodeStatic(terrainNode, true);
+
+    // The largest opaque parts hide what is behind them
+    torsoNode->isOccluder = true;
+    headNode->isOccluder = true;
+    terrainNode->isOccluder = true;
 
     torsoNode->position = initialPosition;
 
@@ -833,6 +1226,26 @@ SceneNode *constructSceneGraph(MinecraftCharacter &steve, Mesh &terrain, float3
     torsoNode->referencePoint = float3(0, 12, 0) + initialPosition ;
     terrainNode->referencePoint = float3(0, 0, 0) ;
 
+    // One entity for each dynamic node. The torso walks along the path, the arms and legs
+    // swing in opposite directions, the static terrain needs none.
+    if(entities != nullptr)
+    {
+        auto transformOf = [](SceneNode *node) { return Transform{node->position, node->rotation, node->referencePoint}; };
+        auto referenceTo = [](SceneNode *node) { return SceneNodeRef{node, noFlatNode}; };
+
+        entities->create(transformOf(rootNode), referenceTo(rootNode));
+        entities->create(transformOf(torsoNode), PathFollower{1.0f}, referenceTo(torsoNode));
+        entities->create(transformOf(headNode), referenceTo(headNode));
+
+        std::pair<SceneNode *, float> limbs[] = {
+            {leftArmNode, 1.0f}, {rightLegNode, 1.0f}, {rightArmNode, -1.0f}, {leftLegNode, -1.0f}
+        };
+        for(std::pair<SceneNode *, float> &limb : limbs)
+        {
+            entities->create(transformOf(limb.first), WalkCycle{limb.second}, referenceTo(limb.first));
+        }
+    }
+
     printScene(rootNode);
     // Return the root node
     return rootNode;
@@ -847,43 +1260,16 @@ void printScene(SceneNode *rootNode)
     }
 }
 
-void visitSceneNode(SceneNode *node, glm::mat4 transformationThusFar, float rotation, float2 movement, float angle, std::stack<glm::mat4> *stack)
+void visitSceneNode(SceneNode *node, glm::mat4 transformationThusFar, std::stack<glm::mat4> *stack)
 {
-    // Update the position, rotation and reference point of the interested node
-    if(node->name == "torso")
+    // The transformations of static subtrees are computed when their command list is recorded
+    if(node->isStatic)
     {
-        node->position.x += movement.x;
-        node->position.z += movement.y;
-        node->referencePoint.x += movement.x;
-        node->referencePoint.z += movement.y;
-        node->rotation.y = angle;
+        return;
     }
 
-    if((node->name == "leftArm") || (node->name == "rightLeg"))
-    {
-        node->rotation.x += rotation;
-    }
-
-    if(node->name == "rightArm" || node->name == "leftLeg")
-    {
-        node->rotation.x -= rotation;
-    }
-
-    // Start with the identity matrix
-    glm::mat4 matrix = glm::mat4();
-
-    // Compute the translation matrix of the node
-    glm::mat4x4 TMatrix = glm::translate(matrix, glm::vec3(node->position.x, node->position.y, node->position.z));
-
-    // Compute the matrices needed to rotate around the reference point of the node
-    glm::mat4x4 TReferenceMatrix = glm::translate(matrix, glm::vec3(node->referencePoint.x, node->referencePoint.y, node->referencePoint.z));
-    glm::mat4x4 inverseTReferenceMatrix = glm::translate(matrix, glm::vec3( - node->referencePoint.x, - node->referencePoint.y, - node->referencePoint.z));
-    glm::mat4x4 RXMatrix = glm::rotate(matrix, node->rotation.x, glm::vec3(1.0f, 0.0f, 0.0f));
-    glm::mat4x4 RYMatrix = glm::rotate(matrix, node->rotation.y, glm::vec3(0.0f, 1.0f, 0.0f));
-    glm::mat4x4 RZMatrix = glm::rotate(matrix, node->rotation.z, glm::vec3(0.0f, 0.0f, 1.0f));
-
     // Compute the model matrix of the node
-    node->currentTransformationMatrix = TReferenceMatrix * RXMatrix * RYMatrix * RZMatrix * inverseTReferenceMatrix * TMatrix;
+    node->currentTransformationMatrix = computeLocalTransformation(node);
 
     // Multiply the model matrix of the current node for the model matrix of the parent node
     node->currentTransformationMatrix =  transformationThusFar * node->currentTransformationMatrix;
@@ -894,35 +1280,65 @@ void visitSceneNode(SceneNode *node, glm::mat4 transformationThusFar, float rota
     // visit all the children node
     for(SceneNode *child : node->children)
     {
-        visitSceneNode(child, node->currentTransformationMatrix, rotation, movement, angle, stack);
+        visitSceneNode(child, node->currentTransformationMatrix, stack);
     }
 
+    // The children are done, so their bounds can be merged into the bounds of the node
+    updateWorldBounds(node);
+
     // pop the model matrix of the current node from the stack
     popMatrix(stack);
 }
 
-void drawSceneNode(SceneNode *node, float *motion, int uniformLocation)
+FrameConstants computeFrameConstants(float *motion, float farPlane, float aspectRatio)
 {
-    if(node->name != "root")
-    {
-        // Start with and identity matrix
-        glm::mat4x4 matrix = glm::mat4x4();
+    FrameConstants constants;
+
+    // Start with and identity matrix
+    glm::mat4x4 matrix = glm::mat4x4();
+
+    // Build the perspective matrx
+    constants.projection = glm::perspective(glm::pi<float>() * 0.5f, aspectRatio, sceneNearPlane, farPlane);
+
+    // Build the view matrix
+    glm::vec3 TVector = glm::vec3(motion[0], motion[1], motion[2]);
+    glm::mat4x4 T1Matrix = glm::translate(matrix, TVector);
+    glm::mat4x4 RX1Matrix = glm::rotate(matrix, motion[3], glm::vec3(1.0f, 0.0f, 0.0f));
+    glm::mat4x4 RY1Matrix = glm::rotate(matrix, motion[4], glm::vec3(0.0f, 1.0f, 0.0f));
+    constants.view = RX1Matrix * RY1Matrix * T1Matrix;
+
+    constants.viewProjection = constants.projection * constants.view;
+
+    return constants;
+}
 
-        // Build the perspective matrx
-        glm::mat4x4 matrixPerspective = glm::perspective(glm::pi<float>() * 0.5f, float(windowHeight / windowWidth), 1.0f, 150.0f);
+glm::mat4 computeViewProjection(float *motion, float farPlane)
+{
+    return computeFrameConstants(motion, farPlane).viewProjection;
+}
 
-        // Build the view matrix
-        glm::vec3 TVector = glm::vec3(motion[0], motion[1], motion[2]);
-        glm::mat4x4 T1Matrix = glm::translate(matrix, TVector);
-        glm::mat4x4 RX1Matrix = glm::rotate(matrix, motion[3], glm::vec3(1.0f, 0.0f, 0.0f));
-        glm::mat4x4 RY1Matrix = glm::rotate(matrix, motion[4], glm::vec3(0.0f, 1.0f, 0.0f));
+void drawSceneNode(SceneNode *node, glm::mat4 const &viewProjection, int uniformLocation)
+{
+    // Subtrees rejected by the last cullSceneGraph() are skipped as a whole
+    if(!node->isInFrustum)
+    {
+        return;
+    }
 
+    if(node->name != "root")
+    {
         // Compute the MVP matrix
-        matrix = matrixPerspective * RX1Matrix * RY1Matrix * T1Matrix * node->currentTransformationMatrix;
+        glm::mat4x4 matrix = viewProjection * node->currentTransformationMatrix;
 
         // Update the uniform variable in the vertex shader
         glUniformMatrix4fv(uniformLocation, 1, 0, glm::value_ptr(matrix));
 
+        // Make sure the mesh is resident, it may have been evicted since the last frame
+        if(node->mesh != nullptr)
+        {
+            node->vertexArrayObjectID = node->mesh->use();
+        }
+
         // Draw the current node
         glBindVertexArray(node->vertexArrayObjectID);
         glDrawElements(GL_TRIANGLES, node->VAOIndexCount, GL_UNSIGNED_INT, 0);
@@ -930,10 +1346,92 @@ void drawSceneNode(SceneNode *node, float *motion, int uniformLocation)
 
     for(SceneNode *child : node->children)
     {
-        drawSceneNode(child, motion, uniformLocation);
+        drawSceneNode(child, viewProjection, uniformLocation);
     }
 }
 
+void collectOccluderNodes(SceneNode *node, std::vector<SceneNode *> &occluders)
+{
+    if(node->isOccluder)
+    {
+        occluders.push_back(node);
+    }
+
+    for(SceneNode *child : node->children)
+    {
+        collectOccluderNodes(child, occluders);
+    }
+}
+
+void collectDrawableNodes(SceneNode *node, std::vector<SceneNode *> &nodes, std::vector<SceneNode *> &staticRoots)
+{
+    // Static subtrees are drawn by their own command list
+    if(node->isStatic)
+    {
+        staticRoots.push_back(node);
+        return;
+    }
+
+    // Grouping nodes have no mesh, and the meshes still being uploaded have not reached
+    // their node yet, the nodes are collected again once they do
+    if(node->mesh != nullptr)
+    {
+        nodes.push_back(node);
+    }
+
+    for(SceneNode *child : node->children)
+    {
+        collectDrawableNodes(child, nodes, staticRoots);
+    }
+}
+
+unsigned int countDynamicNodes(SceneNode *node)
+{
+    if(node->isStatic)
+    {
+        return 0;
+    }
+
+    unsigned int count = 1;
+    for(SceneNode *child : node->children)
+    {
+        count += countDynamicNodes(child);
+    }
+    return count;
+}
+
+DrawPacket makeDrawPacket(SceneNode *node, unsigned int transformIndex, glm::mat4 const &viewProjection, GLuint program, RenderPass pass)
+{
+    DrawPacket packet;
+    packet.program = program;
+    packet.vao = node->vertexArrayObjectID;
+    packet.indexCount = node->VAOIndexCount;
+    packet.mesh = node->mesh;
+    packet.positionOnly = (pass == PASS_DEPTH_PREPASS);
+    packet.transformIndex = transformIndex;
+
+    // Distance of the node origin from the camera, normalised by the far plane
+    glm::vec4 origin = node->currentTransformationMatrix * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    float depth = (viewProjection * origin).w / sceneFarPlane;
+
+    // The VAO of a mesh changes when it is evicted and uploaded again, its number does not
+    unsigned int meshId = (node->mesh != nullptr) ? node->mesh->getId() : unsigned(packet.vao);
+
+    if((pass == PASS_OPAQUE && useDepthPrepass) || pass == PASS_TRANSPARENT_WEIGHTED)
+    {
+        // The pre-pass already resolved the visibility, and the weighted blending does not
+        // depend on the order, so the draws are grouped by state
+        packet.sortKey = makeSortKey(pass, program, node->material, meshId, depth);
+    }
+    else
+    {
+        // Front to back for the depth, back to front for the blending
+        packet.sortKey = makeDepthSortKey(pass, program, node->material, meshId, depth, pass == PASS_TRANSPARENT);
+    }
+
+    return packet;
+}
+
 void computeWalkingParameter(float Dx, float Dy, float2 &movement, float &rotation, float2 &currentWaypoint, float &increment)
 {
     
@@ -961,7 +1459,7 @@ void computeAngleNextWaypoint(float dx, float dy, float &angle)
     }
 }
 
-void drawScene(GLFWwindow *window, int uniformLocation)
+void drawScene(GLFWwindow *window)
 {
     // Load the minecraft characters
     MinecraftCharacter steve = loadMinecraftCharacterModel("../gloom/res/steve.obj");
@@ -972,7 +1470,9 @@ void drawScene(GLFWwindow *window, int uniformLocation)
     int terrain_height = 5;
     float4 color1 = float4(1.0f, 0.0f, 0.0f, 1.0f);
     float4 color2 = float4(0.0f, 1.0f, 0.0f, 1.0f);
-    Mesh terrain = generateChessboard(terrain_width, terrain_height, tileWidth, color1, color2);
+    // The procedural terrain is generated on the GPU, the terrain node is then left without a mesh
+    Mesh terrain = useProceduralTerrain ? Mesh("Procedural terrain")
+                                        : generateChessboard(terrain_width, terrain_height, tileWidth, color1, color2);
 
     // Load the path that the character will follow and get the next way point
     Path path("coordinates_0.txt");
@@ -981,9 +1481,114 @@ void drawScene(GLFWwindow *window, int uniformLocation)
     float2 nextWaypoint = path.getCurrentWaypoint(tileWidth);
     float2 movement;
 
+    // Create the manager owning the GPU resources of the scene
+    GpuResourceManager resources(gpuMemoryBudget);
+
+    // The draw calls of each frame are generated on all cores and sorted before submission
+    ThreadPool threadPool;
+    RenderQueue renderQueue(threadPool.getThreadCount());
+    GLStateCache &state = getGLStateCache();
+
+    // The nodes read their world matrix from a uniform buffer indexed by drawID
+    const char *sceneFragmentShader = useClusteredLighting ? "../gloom/shaders/clustered.frag" : "../gloom/shaders/simple.frag";
+    GpuProgram *program = resources.createProgram("../gloom/shaders/scene.vert", sceneFragmentShader);
+    bindSceneUniformBlocks(program->get());
+
+    // Generates the tiles of the terrain in the vertex shader, with a single draw call
+    std::unique_ptr<ProceduralTerrain> proceduralTerrain;
+    if(useProceduralTerrain)
+    {
+        proceduralTerrain.reset(new ProceduralTerrain(resources, terrain_width, terrain_height, tileWidth, color1, color2, sceneFragmentShader));
+    }
+
+    // A night scene lit by torches scattered over the terrain
+    ClusteredLighting lighting(resources, sceneNearPlane, sceneFarPlane);
+    if(useClusteredLighting)
+    {
+        glm::vec3 terrainMin(-0.5f * tileWidth, 1.0f, -0.5f * tileWidth);
+        glm::vec3 terrainMax((terrain_width - 0.5f) * tileWidth, 4.0f, (terrain_height - 0.5f) * tileWidth);
+        lighting.getLights() = scatterTorches(torchCount, terrainMin, terrainMax);
+        lighting.setupProgram(program->get());
+        if(proceduralTerrain)
+        {
+            lighting.setupProgram(proceduralTerrain->getProgram());
+        }
+        glClearColor(0.02f, 0.02f, 0.05f, 1.0f);
+    }
+    GLint drawIDLocation = glGetUniformLocation(program->get(), "drawID");
+
+    // Writes the depth of the opaque nodes before they are shaded
+    GpuProgram *depthProgram = resources.createProgram("../gloom/shaders/depthOnly.vert", "../gloom/shaders/depthOnly.frag");
+    bindSceneUniformBlocks(depthProgram->get());
+
+    // Accumulates the translucent nodes, which are then composited over the opaque image.
+    // Its targets are only allocated on the first frame drawing a translucent node.
+    GpuProgram *transparentProgram = resources.createProgram("../gloom/shaders/scene.vert", "../gloom/shaders/transparencyAccumulate.frag");
+    bindSceneUniformBlocks(transparentProgram->get());
+    std::unique_ptr<TransparencyPass> transparency;
+
+    // Schedules the passes of each frame and owns their render targets
+    FrameGraph frameGraph(resources);
+
+    // Picks the resolution of each frame from the GPU time of the previous ones. When
+    // disabled the scale stays at 1, but the GPU time is still measured.
+    DynamicResolution resolution(gpuFrameBudgetMilliseconds, useDynamicResolution ? minimumResolutionScale : 1.0f);
+
+    // Upload the meshes on a background thread, the scene fills in as they arrive
+    std::unique_ptr<UploadService> uploads;
+    if(useUploadThread)
+    {
+        uploads.reset(new UploadService(window, resources));
+    }
+
     // Construct the scene graph
     float3 initialPosition = float3(currentWaypoint.x, 0.0f, currentWaypoint.y);
-    SceneNode *rootNode = constructSceneGraph(steve, terrain, initialPosition);
+    // The behaviour of the dynamic nodes comes from the components of their entities
+    EntityWorld entities;
+    SceneNode *rootNode = constructSceneGraph(steve, terrain, initialPosition, resources, uploads.get(), &entities);
+
+    // The structure of the scene does not change, so the drawable nodes are only gathered
+    // again when a mesh reaches its node, which changes the revision of the root
+    std::vector<SceneNode *> drawableNodes;
+    std::vector<SceneNode *> staticRoots;
+    collectDrawableNodes(rootNode, drawableNodes, staticRoots);
+    unsigned long drawableRevision = rootNode->revision;
+
+    // The dynamic nodes copied into arrays, whose transformations are computed in one loop
+    std::unique_ptr<FlatScene> flatScene;
+    if(useFlatScene)
+    {
+        flatScene.reset(new FlatScene(rootNode));
+        bindFlatScene(entities, *flatScene);
+    }
+
+    // Skips the nodes hidden behind the occluders before generating their draws. The
+    // procedural terrain has no mesh on the CPU, a chessboard of the same tiles stands in for it.
+    std::unique_ptr<OcclusionCuller> occlusion;
+    std::vector<SceneNode *> occluderNodes;
+    Mesh terrainOccluder("Terrain occluder");
+    if(useOcclusionCulling)
+    {
+        occlusion.reset(new OcclusionCuller(occlusionBufferWidth, occlusionBufferHeight));
+        collectOccluderNodes(rootNode, occluderNodes);
+        if(useProceduralTerrain)
+        {
+            terrainOccluder = generateChessboard(terrain_width, terrain_height, tileWidth, color1, color2);
+        }
+    }
+
+    // Static subtrees are recorded once and replayed every frame
+    std::vector<std::unique_ptr<CommandList>> commandLists;
+    for(SceneNode *staticRoot : staticRoots)
+    {
+        commandLists.emplace_back(new CommandList(resources, staticRoot, program->get(), drawIDLocation));
+    }
+
+    // The camera constants and the world matrices of all nodes are uploaded once per frame.
+    // The buffer has room for every dynamic node, the most that can become drawable.
+    std::vector<glm::mat4> nodeTransforms(drawableNodes.size());
+    StreamBuffer uniformBuffer(GL_UNIFORM_BUFFER, getSceneUniformBytesPerFrame(countDynamicNodes(rootNode)));
+    resources.recordAllocation(CATEGORY_UNIFORM_DATA, uniformBuffer.getCapacity());
 
     // Create the stack for the transform matrices
     std::stack<glm::mat4> *stack = createEmptyMatrixStack();
@@ -1007,10 +1612,46 @@ void drawScene(GLFWwindow *window, int uniformLocation)
 
     computeAngleNextWaypoint(dx, dy, angle);
 
+    unsigned long frameCount = 0;
+    FrustumCullingStats frustumStats;
+
     while (!glfwWindowShouldClose(window))
     {
-        // Clear colour and depth buffers
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // Nothing can be drawn while the window is minimised
+        int framebufferWidth = 0;
+        int framebufferHeight = 0;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        if(framebufferWidth == 0 || framebufferHeight == 0)
+        {
+            glfwWaitEvents();
+            continue;
+        }
+
+        resources.beginFrame();
+        uniformBuffer.beginFrame();
+        state.beginFrame();
+        resolution.beginFrame();
+
+        // The scene is drawn in the lower left corner of the render targets, which keep the
+        // size of the window, so that a new scale does not reallocate them
+        int renderWidth = resolution.getRenderWidth(framebufferWidth);
+        int renderHeight = resolution.getRenderHeight(framebufferHeight);
+
+        // Give the meshes which finished uploading to their nodes
+        if(uploads)
+        {
+            GLDebugGroup group("Upload polling");
+            uploads->poll();
+        }
+
+        if(rootNode->revision != drawableRevision)
+        {
+            std::vector<SceneNode *> unchangedStaticRoots;
+            drawableNodes.clear();
+            collectDrawableNodes(rootNode, drawableNodes, unchangedStaticRoots);
+            nodeTransforms.resize(drawableNodes.size());
+            drawableRevision = rootNode->revision;
+        }
 
         total += getTimeDeltaSeconds();
         if(total >= treshold)
@@ -1047,11 +1688,275 @@ void drawScene(GLFWwindow *window, int uniformLocation)
 
         }
 
-        // Visit the scene graph and compute the transformation matrix of each node
-        visitSceneNode(rootNode, rootNode->currentTransformationMatrix, increment, movement, angle, stack);
+        // Walk the character along the path and swing its limbs, then hand the local
+        // transformations over to the scene
+        updatePathFollowers(entities, threadPool, movement, angle);
+        updateWalkCycles(entities, threadPool, increment);
+        writeTransformsToScene(entities, threadPool, flatScene.get());
+
+        // Compute the transformation matrix of each node
+        if(flatScene)
+        {
+            if(useParallelPropagation)
+            {
+                flatScene->propagateTransforms(threadPool);
+                flatScene->writeBack(threadPool);
+            }
+            else
+            {
+                flatScene->propagateTransforms();
+                flatScene->writeBack();
+            }
+        }
+        else
+        {
+            visitSceneNode(rootNode, rootNode->currentTransformationMatrix, stack);
+        }
+
+        // The camera matrices are computed once and shared by every draw of the frame
+        FrameConstants frameConstants = computeFrameConstants(motion, sceneFarPlane, float(framebufferWidth) / float(framebufferHeight));
+        uploadFrameConstants(uniformBuffer, frameConstants);
+
+        // Reject the subtrees outside of the view, from the bounds computed by visitSceneNode()
+        if(useFrustumCulling)
+        {
+            cullSceneGraph(rootNode, computeFrustumPlanes(frameConstants.viewProjection), frustumStats);
+        }
+
+        // Rasterize the occluders on all cores, before any node is tested against them
+        if(occlusion)
+        {
+            occlusion->beginFrame(frameConstants.viewProjection);
+            for(SceneNode *occluder : occluderNodes)
+            {
+                if(occluder->mesh != nullptr)
+                {
+                    occlusion->addOccluder(occluder->mesh->getSource(), occluder->currentTransformationMatrix);
+                }
+            }
+            if(!terrainOccluder.indices.empty())
+            {
+                occlusion->addOccluder(terrainOccluder, glm::mat4());
+            }
+            occlusion->rasterize(threadPool);
+        }
+
+        // Bin the lights into the clusters of this view
+        if(useClusteredLighting)
+        {
+            GLDebugGroup group("Light binning");
+            lighting.setViewport(renderWidth, renderHeight);
+            lighting.update(frameConstants, threadPool);
+            lighting.bind();
+        }
+
+        // Generate one draw packet for each node, every thread filling its own bucket.
+        // Node i reads its world matrix from nodeTransforms[i].
+        renderQueue.clear();
+        threadPool.parallelFor(unsigned(drawableNodes.size()), [&](unsigned int begin, unsigned int end, unsigned int thread)
+        {
+            std::vector<DrawPacket> &bucket = renderQueue.getBucket(thread);
+            for(unsigned int i = begin; i < end; i++)
+            {
+                nodeTransforms[i] = drawableNodes[i]->currentTransformationMatrix;
+                SceneNode *node = drawableNodes[i];
+                if(node->VAOIndexCount == 0)
+                {
+                    continue;
+                }
+
+                if(!node->isInFrustum)
+                {
+                    continue;
+                }
+
+                // Hidden behind the occluders, no draw is generated at all
+                if(occlusion && node->mesh != nullptr)
+                {
+                    Mesh const &source = node->mesh->getSource();
+                    if(!occlusion->isVisible(source.boundsMin, source.boundsMax, node->currentTransformationMatrix))
+                    {
+                        continue;
+                    }
+                }
+
+                if(node->isTransparent && useWeightedTransparency)
+                {
+                    bucket.push_back(makeDrawPacket(node, i, frameConstants.viewProjection, transparentProgram->get(), PASS_TRANSPARENT_WEIGHTED));
+                    continue;
+                }
+                if(node->isTransparent)
+                {
+                    bucket.push_back(makeDrawPacket(node, i, frameConstants.viewProjection, program->get(), PASS_TRANSPARENT));
+                    continue;
+                }
+
+                if(useDepthPrepass)
+                {
+                    bucket.push_back(makeDrawPacket(node, i, frameConstants.viewProjection, depthProgram->get(), PASS_DEPTH_PREPASS));
+                }
+                bucket.push_back(makeDrawPacket(node, i, frameConstants.viewProjection, program->get(), PASS_OPAQUE));
+            }
+        });
+
+        // Upload all the world matrices at once, and order the draws by sort key
+        GLintptr transformsOffset = uploadNodeTransforms(uniformBuffer, nodeTransforms);
+        renderQueue.sort();
+
+        // Describe the passes of the frame, the graph allocates their render targets
+        FrameGraphTextureDescription colourDescription;
+        colourDescription.width = framebufferWidth;
+        colourDescription.height = framebufferHeight;
+        colourDescription.format = GL_RGBA8;
+        colourDescription.samples = std::max(windowSamples, 1);
+        FrameGraphTextureDescription depthDescription = colourDescription;
+        depthDescription.format = GL_DEPTH24_STENCIL8;
+
+        frameGraph.reset();
+        FrameGraphResource backbuffer = frameGraph.importFramebuffer("backbuffer", 0, framebufferWidth, framebufferHeight);
+        FrameGraphResource sceneColour = 0;
+        FrameGraphResource sceneDepth = 0;
+
+        frameGraph.addPass("Scene", [&](FrameGraphBuilder &builder)
+        {
+            sceneColour = builder.write(builder.create("scene colour", colourDescription));
+            sceneDepth = builder.write(builder.create("scene depth", depthDescription));
+        },
+        [&](FrameGraphContext &)
+        {
+            // Clear colour and depth buffers
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glViewport(0, 0, renderWidth, renderHeight);
+
+            // The static geometry is replayed from its command lists
+            for(std::unique_ptr<CommandList> &commandList : commandLists)
+            {
+                commandList->execute();
+            }
+
+            // The procedural terrain lies at the origin, like the terrain node
+            if(proceduralTerrain)
+            {
+                proceduralTerrain->draw(glm::mat4());
+            }
+
+            // Then every other node, in sort key order
+            if(transformsOffset >= 0)
+            {
+                renderQueue.submit(uniformBuffer.get(), transformsOffset);
+            }
+        });
+
+        // The translucent nodes are drawn last, once all the opaque depth is known
+        if(transformsOffset >= 0 && renderQueue.getPacketCount(PASS_TRANSPARENT_WEIGHTED) > 0)
+        {
+            frameGraph.addPass("Weighted transparency", [&](FrameGraphBuilder &builder)
+            {
+                builder.read(sceneDepth);
+                builder.write(sceneColour);
+            },
+            [&](FrameGraphContext &context)
+            {
+                GLuint sceneFramebuffer = context.getFramebuffer({sceneColour, sceneDepth});
+                if(!transparency)
+                {
+                    transparency.reset(new TransparencyPass(resources, framebufferWidth, framebufferHeight, GL_DEPTH24_STENCIL8));
+                }
+                transparency->resize(framebufferWidth, framebufferHeight);
+                transparency->begin(sceneFramebuffer);
+                glViewport(0, 0, renderWidth, renderHeight);
+                renderQueue.submit(uniformBuffer.get(), transformsOffset, PASS_TRANSPARENT_WEIGHTED, PASS_TRANSPARENT_WEIGHTED);
+                transparency->composite(sceneFramebuffer);
+            });
+        }
+
+        // Stretches the frame over the window when it was rendered at a lower resolution
+        frameGraph.addPresentPass(sceneColour, backbuffer, renderWidth, renderHeight);
+        frameGraph.compile();
+        frameGraph.execute();
+
+        resolution.endFrame();
+
+        uniformBuffer.endFrame();
+
+        // Evict the coldest meshes if the scene went over its memory budget
+        resources.endFrame();
+
+        flushGLDebugMessages();
 
-        // Visit the scene graph and draw each node
-        drawSceneNode(rootNode, motion, uniformLocation);
+        frameCount++;
+        if(printStatistics && frameCount % statisticsInterval == 0)
+        {
+            resources.printStats();
+
+            RenderQueueStats const &queueStats = renderQueue.getStats();
+            printf("Render queue: %u draw calls, %u program changes, %u VAO changes\n",
+                   queueStats.drawCalls, queueStats.programChanges, queueStats.vertexArrayChanges);
+
+            GLStateStats const &stateStats = state.getLastFrameStats();
+            printf("GL state: %u calls issued, %u skipped\n", stateStats.issued, stateStats.skipped);
+
+            FrameGraphStats const &graphStats = frameGraph.getStats();
+            printf("Frame graph: %u passes, %u culled, %u transient textures in %u textures, %u barriers, %lld bytes\n",
+                   graphStats.passes, graphStats.culledPasses, graphStats.transientTextures,
+                   graphStats.physicalTextures, graphStats.barriers, graphStats.textureBytes);
+
+            DynamicResolutionStats const &resolutionStats = resolution.getStats();
+            printf("Resolution: %dx%d (scale %.2f), GPU frame time %.2f ms, average %.2f ms\n",
+                   renderWidth, renderHeight, resolution.getScale(),
+                   resolutionStats.lastGpuMilliseconds, resolutionStats.averageGpuMilliseconds);
+
+            EntityStats entityStats = entities.getStats();
+            printf("Entities: %u in %u archetypes, %u chunks\n", entityStats.entities, entityStats.archetypes, entityStats.chunks);
+
+            if(flatScene)
+            {
+                FlatSceneStats const &sceneStats = flatScene->getStats();
+                printf("Scene: %u of %u world matrices updated in %u levels, %u local matrices, %u bounds\n",
+                       sceneStats.worldUpdates, sceneStats.nodes, sceneStats.levels, sceneStats.localUpdates, sceneStats.boundsUpdates);
+                if(verifyParallelPropagation)
+                {
+                    printf("Scene: %u world matrices differ from the serial computation, %lu steals\n",
+                           flatScene->verifyTransforms(), threadPool.getStealCount());
+                }
+            }
+
+            if(useFrustumCulling)
+            {
+                printf("Frustum culling: %u subtrees culled, %u nodes tested, %u plane tests, %u rejections by the cached plane\n",
+                       frustumStats.culledSubtrees, frustumStats.testedNodes, frustumStats.planeTests, frustumStats.hintRejections);
+            }
+
+            if(occlusion)
+            {
+                OcclusionStats occlusionStats = occlusion->getStats();
+                printf("Occlusion: %u occluders, %u of %u triangles rasterized, %u of %u nodes culled (%.1f%%)\n",
+                       occlusionStats.occluders, occlusionStats.occluderTriangles - occlusionStats.rejectedTriangles,
+                       occlusionStats.occluderTriangles, occlusionStats.occludedObjects, occlusionStats.testedObjects,
+                       occlusionStats.testedObjects > 0 ? 100.0f * occlusionStats.occludedObjects / occlusionStats.testedObjects : 0.0f);
+            }
+
+            if(useClusteredLighting)
+            {
+                ClusteredLightingStats const &lightingStats = lighting.getStats();
+                printf("Lighting: %u visible lights, %u cluster references, at most %u lights per cluster\n",
+                       lightingStats.visibleLights, lightingStats.lightReferences, lightingStats.busiestCluster);
+            }
+
+            if(uploads)
+            {
+                UploadStats uploadStats = uploads->getStats();
+                printf("Uploads: %u of %u meshes, %lld bytes\n",
+                       uploadStats.completed, uploadStats.requested, uploadStats.uploadedBytes);
+            }
+
+            for(std::unique_ptr<CommandList> const &commandList : commandLists)
+            {
+                CommandListStats const &listStats = commandList->getStats();
+                printf("Command list: %u recordings, %u replays, %u draw calls\n",
+                       listStats.recordings, listStats.replays, listStats.drawCalls);
+            }
+        }
 
         // Handle other events
         glfwPollEvents();
@@ -12,6 +12,31 @@
 #include <glm/mat4x4.hpp>
 #include "OBJLoader.hpp"
 #include "toolbox.hpp"
+#include "gpuResources.hpp"
+#include "renderQueue.hpp"
+#include "threadPool.hpp"
+#include "streamBuffer.hpp"
+#include "crowd.hpp"
+#include "gpuCulling.hpp"
+#include "frameConstants.hpp"
+#include "glStateCache.hpp"
+#include "commandList.hpp"
+#include "uploadService.hpp"
+#include "debugLayer.hpp"
+#include "transparencyPass.hpp"
+#include "clusteredLighting.hpp"
+#include "frameGraph.hpp"
+#include "proceduralTerrain.hpp"
+#include "shapeBatch.hpp"
+#include "dynamicResolution.hpp"
+#include "meshlets.hpp"
+#include "impostors.hpp"
+#include "occlusionCulling.hpp"
+#include "frustumCulling.hpp"
+#include "flatScene.hpp"
+#include "entities.hpp"
+#include "sceneSystems.hpp"
+#include "gloom/gloom.hpp"
 
 // Main OpenGL program
 void runProgram(GLFWwindow* window);
@@ -36,6 +61,9 @@ void drawChangingColorInTime(GLFWwindow* window, int uniformLocation);
 
 void drawTrheeOverlappingTriangle(GLFWwindow* window);
 
+// Same triangles, drawn in a changing order with order-independent transparency
+void drawOrderIndependentTriangles(GLFWwindow* window);
+
 void drawTransformation(GLFWwindow* window, int uniformLocation);
 
 void camera(GLFWwindow* window, int uniformLocation);
@@ -44,6 +72,13 @@ void drawSteve(GLFWwindow* window, int uniformLocation);
 
 void cameraMovement(GLFWwindow *window, int uniformLocation, float* motion);
 
+// Draws fireyaretziresp.obj split into meshlets, culled on the CPU every frame
+void drawMeshletModel(GLFWwindow *window, int uniformLocation);
+
+void setInstanceAttributes(GLuint instanceBuffer, GLintptr offset);
+
+void drawCrowd(GLFWwindow *window);
+
 // Function for handling keypresses
 void handleKeyboardInput(GLFWwindow* window);
 
@@ -51,16 +86,46 @@ void handleKeyboardInputMotion(GLFWwindow* window, float* motion);
 
 void printScene(SceneNode* rootNode);
 
-SceneNode *constructSceneGraph(MinecraftCharacter &steve, Mesh &terrain, float3 initialPosition);
+// Gives the dynamic nodes their entities in entities, when given
+SceneNode *constructSceneGraph(MinecraftCharacter &steve, Mesh &terrain, float3 initialPosition, GpuResourceManager &resources,
+                               UploadService *uploads = nullptr, EntityWorld *entities = nullptr);
+
+void drawScene(GLFWwindow *window);
+
+// Computes the world matrices and bounds of the dynamic nodes. The nodes are animated by the
+// systems of sceneSystems.hpp beforehand.
+void visitSceneNode(SceneNode *node, glm::mat4 transformationThusFar, std::stack<glm::mat4> *stack);
 
-void drawScene(GLFWwindow *window, int uniformLocation);
+void drawSceneNode(SceneNode *node, glm::mat4 const &viewProjection, int uniformLocation);
 
-void visitSceneNode(SceneNode *node, glm::mat4 transformationThusFar, float rotation, float2 movement, float angle, std::stack<glm::mat4> *stack);
+// The aspect ratio must follow the size of the framebuffer when the window is resized
+FrameConstants computeFrameConstants(float *motion, float farPlane = sceneFarPlane,
+                                     float aspectRatio = float(windowWidth) / float(windowHeight));
+glm::mat4 computeViewProjection(float *motion, float farPlane = sceneFarPlane);
 
-void drawSceneNode(SceneNode *node, float *motion, int uniformLocation);
+void collectDrawableNodes(SceneNode *node, std::vector<SceneNode *> &nodes, std::vector<SceneNode *> &staticRoots);
+
+// Number of nodes outside of the static subtrees, the most collectDrawableNodes() can return
+unsigned int countDynamicNodes(SceneNode *node);
+
+void collectOccluderNodes(SceneNode *node, std::vector<SceneNode *> &occluders);
+
+DrawPacket makeDrawPacket(SceneNode *node, unsigned int transformIndex, glm::mat4 const &viewProjection, GLuint program, RenderPass pass);
+
+// Checks whether the current OpenGL context is at least version major.minor
+inline bool isGLVersionAtLeast(int major, int minor) {
+    GLint contextMajor = 0;
+    GLint contextMinor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &contextMajor);
+    glGetIntegerv(GL_MINOR_VERSION, &contextMinor);
+
+    return contextMajor > major || (contextMajor == major && contextMinor >= minor);
+}
 
 // Checks for whether an OpenGL error occurred. If one did,
 // it prints out the error type and ID
+// Waits for the GPU to report the last error, prefer the debug layer of debugLayer.hpp
+// which reports errors asynchronously
 inline void printGLError() {
     int errorID = glGetError();
 
@@ -0,0 +1,237 @@
+#include "renderQueue.hpp"
+#include "gpuResources.hpp"
+#include "frameConstants.hpp"
+#include "glStateCache.hpp"
+#include "transparencyPass.hpp"
+
+uint64_t makeSortKey(unsigned int pass, unsigned int program, unsigned int material,
+                     unsigned int mesh, float depth)
+{
+    // Clamp the depth and quantize it to 24 bits
+    depth = (depth < 0.0f) ? 0.0f : ((depth > 1.0f) ? 1.0f : depth);
+    uint64_t depthBits = uint64_t(depth * float(0xFFFFFF));
+
+    return (uint64_t(pass & 0xF) << 60) |
+           (uint64_t(program & 0x3FF) << 50) |
+           (uint64_t(material & 0xFFF) << 38) |
+           (uint64_t(mesh & 0x3FFF) << 24) |
+           depthBits;
+}
+
+uint64_t makeDepthSortKey(unsigned int pass, unsigned int program, unsigned int material,
+                          unsigned int mesh, float depth, bool backToFront)
+{
+    depth = (depth < 0.0f) ? 0.0f : ((depth > 1.0f) ? 1.0f : depth);
+    uint64_t depthBits = uint64_t(depth * float(0xFFFFFF));
+    if (backToFront)
+    {
+        depthBits = 0xFFFFFF - depthBits;
+    }
+
+    return (uint64_t(pass & 0xF) << 60) |
+           (depthBits << 36) |
+           (uint64_t(program & 0x3FF) << 26) |
+           (uint64_t(material & 0xFFF) << 14) |
+           uint64_t(mesh & 0x3FFF);
+}
+
+RenderQueue::RenderQueue(unsigned int bucketCount) : buckets(bucketCount)
+{
+}
+
+void RenderQueue::clear()
+{
+    for (std::vector<DrawPacket> &bucket : buckets)
+    {
+        bucket.clear();
+    }
+    mergedPackets.clear();
+    sortedPackets.clear();
+}
+
+void RenderQueue::sort()
+{
+    stats = RenderQueueStats();
+
+    // Merge the buckets of all the threads
+    for (std::vector<DrawPacket> const &bucket : buckets)
+    {
+        mergedPackets.insert(mergedPackets.end(), bucket.begin(), bucket.end());
+    }
+
+    size_t count = mergedPackets.size();
+    keys.resize(count);
+    keysScratch.resize(count);
+    order.resize(count);
+    orderScratch.resize(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        keys[i] = mergedPackets[i].sortKey;
+        order[i] = unsigned(i);
+    }
+
+    // Least significant digit radix sort, one byte at a time. The sort is stable,
+    // so packets with equal keys keep the order in which they were generated.
+    for (unsigned int shift = 0; shift < 64; shift += 8)
+    {
+        size_t histogram[256] = {};
+        for (size_t i = 0; i < count; i++)
+        {
+            histogram[(keys[i] >> shift) & 0xFF]++;
+        }
+
+        // All keys share this byte, nothing to do for this pass
+        if (count == 0 || histogram[(keys[0] >> shift) & 0xFF] == count)
+        {
+            continue;
+        }
+
+        // Turn the histogram into the start offset of each digit
+        size_t offset = 0;
+        for (size_t &bin : histogram)
+        {
+            size_t binCount = bin;
+            bin = offset;
+            offset += binCount;
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t destination = histogram[(keys[i] >> shift) & 0xFF]++;
+            keysScratch[destination] = keys[i];
+            orderScratch[destination] = order[i];
+        }
+
+        keys.swap(keysScratch);
+        order.swap(orderScratch);
+    }
+
+    for (unsigned int &passCount : passPacketCounts)
+    {
+        passCount = 0;
+    }
+
+    sortedPackets.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        sortedPackets[i] = mergedPackets[order[i]];
+        passPacketCounts[keys[i] >> 60]++;
+    }
+}
+
+GLint RenderQueue::getDrawIDLocation(GLuint program)
+{
+    auto location = drawIDLocations.find(program);
+    if (location == drawIDLocations.end())
+    {
+        location = drawIDLocations.emplace(program, glGetUniformLocation(program, "drawID")).first;
+    }
+    return location->second;
+}
+
+// Sets the depth, colour and blending state of a pass
+static void applyPassState(GLStateCache &state, unsigned int pass, bool depthPrepassDrawn)
+{
+    state.enable(GL_DEPTH_TEST);
+
+    switch (pass)
+    {
+    case PASS_DEPTH_PREPASS:
+        state.disable(GL_BLEND);
+        state.colorMask(GL_FALSE);
+        state.depthMask(GL_TRUE);
+        state.depthFunc(GL_LESS);
+        break;
+    case PASS_TRANSPARENT:
+        state.enable(GL_BLEND);
+        state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        state.colorMask(GL_TRUE);
+        state.depthMask(GL_FALSE);
+        state.depthFunc(GL_LEQUAL);
+        break;
+    case PASS_TRANSPARENT_WEIGHTED:
+        applyTransparencyAccumulationState(state);
+        break;
+    default:
+        // The depth of the visible fragments is already known after a pre-pass,
+        // so only the fragments matching it are shaded
+        state.disable(GL_BLEND);
+        state.colorMask(GL_TRUE);
+        state.depthMask(depthPrepassDrawn ? GL_FALSE : GL_TRUE);
+        state.depthFunc(depthPrepassDrawn ? GL_LEQUAL : GL_LESS);
+        break;
+    }
+}
+
+void RenderQueue::submit(GLuint transformBuffer, GLintptr transformsOffset,
+                         unsigned int firstPass, unsigned int lastPass)
+{
+    // The state cache drops the calls which would not change anything. It also stays right
+    // when making a mesh resident binds another VAO, or reuses the name of an evicted one.
+    GLStateCache &state = getGLStateCache();
+
+    bool first = true;
+    bool depthPrepassDrawn = false;
+    unsigned int currentPass = 0;
+    GLuint previousProgram = 0;
+    GLuint previousVao = 0;
+    unsigned int previousWindow = 0;
+
+    for (DrawPacket &packet : sortedPackets)
+    {
+        unsigned int pass = unsigned(packet.sortKey >> 60);
+        if (pass < firstPass || pass > lastPass)
+        {
+            continue;
+        }
+
+        if (first || pass != currentPass)
+        {
+            applyPassState(state, pass, depthPrepassDrawn);
+            currentPass = pass;
+            depthPrepassDrawn = depthPrepassDrawn || (pass == PASS_DEPTH_PREPASS);
+        }
+
+        state.useProgram(packet.program);
+        if (first || packet.program != previousProgram)
+        {
+            previousProgram = packet.program;
+            stats.programChanges++;
+        }
+
+        GLuint vao = packet.vao;
+        if (packet.mesh != nullptr)
+        {
+            vao = packet.positionOnly ? packet.mesh->usePositionOnly() : packet.mesh->use();
+        }
+        state.bindVertexArray(vao);
+        if (first || vao != previousVao)
+        {
+            previousVao = vao;
+            stats.vertexArrayChanges++;
+        }
+
+        // The shader only sees maxNodeTransforms matrices at once
+        unsigned int window = packet.transformIndex / maxNodeTransforms;
+        bindNodeTransformWindow(transformBuffer, transformsOffset, packet.transformIndex);
+        if (first || window != previousWindow)
+        {
+            previousWindow = window;
+            stats.transformWindowChanges++;
+        }
+
+        first = false;
+
+        state.uniform1i(getDrawIDLocation(packet.program), int(packet.transformIndex % maxNodeTransforms));
+        glDrawElements(GL_TRIANGLES, packet.indexCount, GL_UNSIGNED_INT, 0);
+        stats.drawCalls++;
+    }
+
+    // Leave the state expected by the code drawing outside of the queue, and by glClear
+    state.disable(GL_BLEND);
+    state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    state.colorMask(GL_TRUE);
+    state.depthMask(GL_TRUE);
+    state.depthFunc(GL_LESS);
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class GpuMesh;
+
+// Passes of a frame, in the order in which they are submitted
+enum RenderPass {
+    // Writes the depth of the opaque geometry, without colour
+    PASS_DEPTH_PREPASS = 0,
+
+    // Opaque geometry, without blending. After a depth pre-pass only the visible fragments are shaded.
+    PASS_OPAQUE,
+
+    // Blended geometry, drawn back to front without writing depth
+    PASS_TRANSPARENT,
+
+    // Translucent geometry accumulated in the targets of a TransparencyPass, in any order.
+    // Must be submitted on its own, between TransparencyPass::begin() and composite().
+    PASS_TRANSPARENT_WEIGHTED
+};
+
+// Builds the 64 bit key used to order the draw calls of a frame.
+// From the most to the least significant bits:
+//    pass (4 bits) | program (10) | material (12) | mesh (14) | depth (24)
+// so that all the draws of a pass are grouped by shader program, then by material and mesh,
+// which minimises the state changes between consecutive draws. The mesh is identified by
+// GpuMesh::getId() rather than by its VAO, which changes when the mesh is uploaded again. The depth is expected in
+// [0, 1] and orders the draws sharing the same state.
+uint64_t makeSortKey(unsigned int pass, unsigned int program, unsigned int material,
+                     unsigned int mesh, float depth);
+
+// Builds a key ordering the draws of a pass by depth first:
+//    pass (4 bits) | depth (24) | program (10) | material (12) | mesh (14)
+// Front to back is used for opaque draws so that the depth test rejects the hidden fragments
+// early, back to front for the blended draws, which must be composited in that order.
+uint64_t makeDepthSortKey(unsigned int pass, unsigned int program, unsigned int material,
+                          unsigned int mesh, float depth, bool backToFront);
+
+// Everything needed to issue one draw call
+struct DrawPacket {
+    uint64_t sortKey;
+
+    GLuint program;
+    GLuint vao;
+    GLsizei indexCount;
+
+    // When set, the mesh is made resident and its VAO is used instead of vao
+    GpuMesh *mesh;
+
+    // Use the VAO of the mesh which only reads the positions
+    bool positionOnly;
+
+    // Index of the world matrix of the draw in the transform buffer of the frame
+    unsigned int transformIndex;
+};
+
+// Counters of the last submitted frame, over all its submit() calls
+struct RenderQueueStats {
+    unsigned int drawCalls = 0;
+    unsigned int programChanges = 0;
+    unsigned int vertexArrayChanges = 0;
+    unsigned int transformWindowChanges = 0;
+};
+
+// Collects the draw packets of a frame and submits them in sort key order.
+// Each thread generating packets appends to its own bucket, so no locking is needed.
+// The buckets are merged and radix sorted before the submission.
+class RenderQueue {
+public:
+    explicit RenderQueue(unsigned int bucketCount);
+
+    // Empties all the buckets, must be called at the start of each frame
+    void clear();
+
+    // The bucket owned by the thread with the given index
+    std::vector<DrawPacket> & getBucket(unsigned int threadIndex) { return buckets.at(threadIndex); }
+
+    // Merges the buckets and sorts the packets by their sort key
+    void sort();
+
+    // Issues the draw calls of the sorted packets whose pass lies in [firstPass, lastPass],
+    // setting the depth and blending state of each pass. The world matrices of the frame are
+    // read from transformBuffer, starting at transformsOffset (see uploadNodeTransforms()),
+    // and selected with the drawID uniform.
+    // The depth and colour writes are enabled again and blending disabled at the end.
+    void submit(GLuint transformBuffer, GLintptr transformsOffset,
+                unsigned int firstPass = PASS_DEPTH_PREPASS, unsigned int lastPass = PASS_TRANSPARENT);
+
+    unsigned int getPacketCount() const      { return unsigned(sortedPackets.size()); }
+
+    // Number of sorted packets in the given pass
+    unsigned int getPacketCount(unsigned int pass) const { return passPacketCounts[pass & 0xF]; }
+    RenderQueueStats const & getStats() const { return stats; }
+
+private:
+    // Location of the drawID uniform, looked up once per program
+    GLint getDrawIDLocation(GLuint program);
+
+    std::vector<std::vector<DrawPacket>> buckets;
+
+    std::unordered_map<GLuint, GLint> drawIDLocations;
+
+    // The content of all buckets, before sorting
+    std::vector<DrawPacket> mergedPackets;
+
+    // All packets of the frame, in submission order after sort()
+    std::vector<DrawPacket> sortedPackets;
+
+    // Scratch memory for the radix sort, kept to avoid allocating every frame
+    std::vector<uint64_t> keys;
+    std::vector<uint64_t> keysScratch;
+    std::vector<unsigned int> order;
+    std::vector<unsigned int> orderScratch;
+
+    // Indexed by the 4 bit pass of the sort key, filled by sort()
+    unsigned int passPacketCounts[16] = {};
+
+    RenderQueueStats stats;
+};
@@ -1,4 +1,5 @@
 #include "sceneGraph.hpp"
+#include "gpuResources.hpp"
 #include <iostream>
 
 // --- Matrix Stack related functions ---
@@ -47,6 +48,133 @@ SceneNode* createSceneNode() {
 // Add a child node to its parent's list of children
 void addChild(SceneNode* parent, SceneNode* child) {
 	parent->children.push_back(child);
+	child->parent = parent;
+	touchSceneNode(parent);
+}
+
+// Mark a node as changed. The revisions of its ancestors are incremented as well,
+// so that the command lists recorded from any subtree containing the node are recorded again.
+void touchSceneNode(SceneNode* node) {
+	for (SceneNode* current = node; current != nullptr; current = current->parent) {
+		current->revision++;
+	}
+}
+
+// Change the mesh drawn by a node
+void setNodeMesh(SceneNode* node, GpuMesh* mesh) {
+	node->mesh = mesh;
+	node->vertexArrayObjectID = (mesh != nullptr) ? int(mesh->use()) : -1;
+	node->VAOIndexCount = (mesh != nullptr) ? mesh->getIndexCount() : 0;
+	touchSceneNode(node);
+}
+
+// Change the material of a node
+void setNodeMaterial(SceneNode* node, unsigned int material) {
+	node->material = material;
+	touchSceneNode(node);
+}
+
+// Change the position, rotation and reference point of a node
+void setNodeTransform(SceneNode* node, float3 position, float3 rotation, float3 referencePoint) {
+	node->position = position;
+	node->rotation = rotation;
+	node->referencePoint = referencePoint;
+	touchSceneNode(node);
+}
+
+// Mark a node as static or dynamic
+void setNodeStatic(SceneNode* node, bool isStatic) {
+	node->isStatic = isStatic;
+	touchSceneNode(node);
+}
+
+// Mark a node as transparent or opaque
+void setNodeTransparent(SceneNode* node, bool isTransparent) {
+	node->isTransparent = isTransparent;
+	touchSceneNode(node);
+}
+
+// Compute the transformation of a node relative to its parent. The node is rotated around
+// its reference point, then translated by its position.
+glm::mat4 computeLocalTransformation(SceneNode const* node) {
+	return computeLocalTransformation(node->position, node->rotation, node->referencePoint);
+}
+
+glm::mat4 computeLocalTransformation(float3 const& position, float3 const& rotation, float3 const& referencePoint) {
+	glm::mat4 identity = glm::mat4();
+
+	glm::mat4 translation = glm::translate(identity, glm::vec3(position.x, position.y, position.z));
+	glm::mat4 toReference = glm::translate(identity, glm::vec3(referencePoint.x, referencePoint.y, referencePoint.z));
+	glm::mat4 fromReference = glm::translate(identity, glm::vec3(-referencePoint.x, -referencePoint.y, -referencePoint.z));
+	glm::mat4 rotationX = glm::rotate(identity, rotation.x, glm::vec3(1.0f, 0.0f, 0.0f));
+	glm::mat4 rotationY = glm::rotate(identity, rotation.y, glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 rotationZ = glm::rotate(identity, rotation.z, glm::vec3(0.0f, 0.0f, 1.0f));
+
+	return toReference * rotationX * rotationY * rotationZ * fromReference * translation;
+}
+
+// Grow the box [boundsMin, boundsMax] to contain [otherMin, otherMax]
+static void mergeBounds(float3 &boundsMin, float3 &boundsMax, float3 const &otherMin, float3 const &otherMax) {
+	boundsMin = float3(std::min(boundsMin.x, otherMin.x), std::min(boundsMin.y, otherMin.y), std::min(boundsMin.z, otherMin.z));
+	boundsMax = float3(std::max(boundsMax.x, otherMax.x), std::max(boundsMax.y, otherMax.y), std::max(boundsMax.z, otherMax.z));
+}
+
+// The mesh box and sphere are both transformed into world aligned boxes, the box of the node
+// is their intersection. The sphere gives the tighter box when a long mesh is rotated.
+void updateWorldBounds(SceneNode* node) {
+	node->hasWorldBounds = false;
+	glm::mat4 const &matrix = node->currentTransformationMatrix;
+
+	if (node->mesh != nullptr && !node->mesh->getSource().vertices.empty()) {
+		Mesh const &source = node->mesh->getSource();
+
+		float centre[3] = {(source.boundsMin.x + source.boundsMax.x) * 0.5f,
+		                   (source.boundsMin.y + source.boundsMax.y) * 0.5f,
+		                   (source.boundsMin.z + source.boundsMax.z) * 0.5f};
+		float extent[3] = {(source.boundsMax.x - source.boundsMin.x) * 0.5f,
+		                   (source.boundsMax.y - source.boundsMin.y) * 0.5f,
+		                   (source.boundsMax.z - source.boundsMin.z) * 0.5f};
+		float sphereCentre[3] = {source.boundsCentre.x, source.boundsCentre.y, source.boundsCentre.z};
+
+		// Largest scale of the matrix, which the sphere radius is multiplied by
+		float scale = 0.0f;
+		for (int column = 0; column < 3; column++) {
+			scale = std::max(scale, glm::length(glm::vec3(matrix[column][0], matrix[column][1], matrix[column][2])));
+		}
+		float radius = source.boundsRadius * scale;
+
+		float boundsMin[3];
+		float boundsMax[3];
+		for (int axis = 0; axis < 3; axis++) {
+			float worldCentre = matrix[3][axis];
+			float worldExtent = 0.0f;
+			float worldSphereCentre = matrix[3][axis];
+			for (int column = 0; column < 3; column++) {
+				worldCentre += matrix[column][axis] * centre[column];
+				worldExtent += std::fabs(matrix[column][axis]) * extent[column];
+				worldSphereCentre += matrix[column][axis] * sphereCentre[column];
+			}
+			boundsMin[axis] = std::max(worldCentre - worldExtent, worldSphereCentre - radius);
+			boundsMax[axis] = std::min(worldCentre + worldExtent, worldSphereCentre + radius);
+		}
+
+		node->worldBoundsMin = float3(boundsMin[0], boundsMin[1], boundsMin[2]);
+		node->worldBoundsMax = float3(boundsMax[0], boundsMax[1], boundsMax[2]);
+		node->hasWorldBounds = true;
+	}
+
+	for (SceneNode* child : node->children) {
+		if (!child->hasWorldBounds || child->isStatic) {
+			continue;
+		}
+		if (node->hasWorldBounds) {
+			mergeBounds(node->worldBoundsMin, node->worldBoundsMax, child->worldBoundsMin, child->worldBoundsMax);
+		} else {
+			node->worldBoundsMin = child->worldBoundsMin;
+			node->worldBoundsMax = child->worldBoundsMax;
+			node->hasWorldBounds = true;
+		}
+	}
 }
 
 // Pretty prints the current values of a SceneNode instance to stdout
@@ -1 +1 @@
-#pragma once#include <glm/glm.hpp>#include <glm/mat4x4.hpp>#include <glm/gtc/type_ptr.hpp>#include <glm/gtx/transform.hpp>#include <stack>#include <vector>#include <cstdio>#include <stdbool.h>#include <cstdlib> #include <ctime> #include <chrono>#include <fstream>#include "floats.hpp"// Matrix stack related functionsstd::stack<glm::mat4>* createEmptyMatrixStack();void pushMatrix(std::stack<glm::mat4>* stack, glm::mat4 matrix);void popMatrix(std::stack<glm::mat4>* stack);glm::mat4 peekMatrix(std::stack<glm::mat4>* stack);void printMatrix(glm::mat4 matrix);// In case you haven't got much experience with C or C++, let me explain this "typedef" you see below.// The point of a typedef is that you it, as its name implies, allows you to define arbitrary data types based upon existing ones. For instance, "typedef float typeWhichMightBeAFloat;" allows you to define a variable such as this one: "typeWhichMightBeAFloat variableName = 5.0;". The C/C++ compiler translates this type into a float. // What is the point of using it here? A smrt person, while designing the C language, thought it would be a good idea for various reasons to force you to explicitly state that you are using a data structure datatype (struct). So, when defining a variable, you'd have to type "struct SceneNode node = ..." in the case of a SceneNode. Which can get in the way of readability.// If we just use typedef to define a new type called "SceneNode", which really is the type "struct SceneNode", we can omit the "struct" part when creating an instance of SceneNode. typedef struct SceneNode {	SceneNode() {		position = float3(0, 0, 0);		rotation = float3(0, 0, 0);        referencePoint = float3(0, 0, 0);        vertexArrayObjectID = -1;        VAOIndexCount = 0;	}	std::string name;	// A list of all children that belong to this node.	// For instance, in case of the scene graph of a human body shown in the assignment text, the "Upper Torso" node would contain the "Left Arm", "Right Arm", "Head" and "Lower Torso" nodes in its list of children.	std::vector<SceneNode*> children;		// The node's position and rotation relative to its parent	float3 position;	float3 rotation;	// A transformation matrix representing the transformation of the node's location relative to its parent. This matrix is updated every frame.	glm::mat4 currentTransformationMatrix;	// The location of the node's reference point	float3 referencePoint;	// The ID of the VAO containing the "appearance" of this SceneNode.	int vertexArrayObjectID;	unsigned int VAOIndexCount;} SceneNode;// Struct for keeping track of 2D coordinatesSceneNode* createSceneNode();void addChild(SceneNode* parent, SceneNode* child);void printNode(SceneNode* node);// For more details, see SceneGraph.cpp.
\ No newline at end of file
+#pragma once#include <glm/glm.hpp>#include <glm/mat4x4.hpp>#include <glm/gtc/type_ptr.hpp>#include <glm/gtx/transform.hpp>#include <stack>#include <vector>#include <cstdio>#include <stdbool.h>#include <cstdlib> #include <ctime> #include <chrono>#include <fstream>#include "floats.hpp"class GpuMesh;// Matrix stack related functionsstd::stack<glm::mat4>* createEmptyMatrixStack();void pushMatrix(std::stack<glm::mat4>* stack, glm::mat4 matrix);void popMatrix(std::stack<glm::mat4>* stack);glm::mat4 peekMatrix(std::stack<glm::mat4>* stack);void printMatrix(glm::mat4 matrix);// In case you haven't got much experience with C or C++, let me explain this "typedef" you see below.// The point of a typedef is that you it, as its name implies, allows you to define arbitrary data types based upon existing ones. For instance, "typedef float typeWhichMightBeAFloat;" allows you to define a variable such as this one: "typeWhichMightBeAFloat variableName = 5.0;". The C/C++ compiler translates this type into a float. // What is the point of using it here? A smrt person, while designing the C language, thought it would be a good idea for various reasons to force you to explicitly state that you are using a data structure datatype (struct). So, when defining a variable, you'd have to type "struct SceneNode node = ..." in the case of a SceneNode. Which can get in the way of readability.// If we just use typedef to define a new type called "SceneNode", which really is the type "struct SceneNode", we can omit the "struct" part when creating an instance of SceneNode. typedef struct SceneNode {	SceneNode() {		position = float3(0, 0, 0);		rotation = float3(0, 0, 0);        referencePoint = float3(0, 0, 0);        vertexArrayObjectID = -1;        VAOIndexCount = 0;        mesh = nullptr;        parent = nullptr;        material = 0;        isStatic = false;        isTransparent = false;        isOccluder = false;        revision = 0;        hasWorldBounds = false;        frustumPlaneHint = 0;        isInFrustum = true;	}	std::string name;	// A list of all children that belong to this node.	// For instance, in case of the scene graph of a human body shown in the assignment text, the "Upper Torso" node would contain the "Left Arm", "Right Arm", "Head" and "Lower Torso" nodes in its list of children.	std::vector<SceneNode*> children;	// The node this node is a child of, nullptr for the root	SceneNode* parent;		// The node's position and rotation relative to its parent	float3 position;	float3 rotation;	// A transformation matrix representing the transformation of the node's location relative to its parent. This matrix is updated every frame.	glm::mat4 currentTransformationMatrix;	// The location of the node's reference point	float3 referencePoint;	// The ID of the VAO containing the "appearance" of this SceneNode.	int vertexArrayObjectID;	unsigned int VAOIndexCount;	// The GPU resources backing the VAO, owned by the GpuResourceManager of the scene.	// The mesh may be evicted and uploaded again, so its VAO ID can change over time.	GpuMesh* mesh;	// Identifies the material used to draw the node	unsigned int material;	// Static nodes never move on their own. They are drawn through a command list recorded once,	// and their transformation matrix is only updated when the list is recorded again.	bool isStatic;	// Transparent nodes are blended in a separate pass, after all the opaque ones	bool isTransparent;	// Large opaque nodes which hide the nodes behind them, see OcclusionCuller	bool isOccluder;	// Incremented whenever the node, or any node below it, is changed through the setters below.	// Comparing it with a previous value tells in O(1) whether a subtree changed.	unsigned long revision;	// Bounding box of the meshes of the node and of all the nodes below it, in world space,	// see updateWorldBounds(). Static subtrees and meshes still being uploaded are left out.	float3 worldBoundsMin;	float3 worldBoundsMax;	bool hasWorldBounds;	// The frustum plane which last rejected the subtree, tested first the next frame	int frustumPlaneHint;	// Whether the subtree was found in the view frustum by the last cullSceneGraph()	bool isInFrustum;} SceneNode;// Struct for keeping track of 2D coordinatesSceneNode* createSceneNode();void addChild(SceneNode* parent, SceneNode* child);// Increments the revision of a node and of all its ancestorsvoid touchSceneNode(SceneNode* node);// Setters which keep the revisions up to date. Static nodes must only be changed through them.void setNodeMesh(SceneNode* node, GpuMesh* mesh);void setNodeMaterial(SceneNode* node, unsigned int material);void setNodeTransform(SceneNode* node, float3 position, float3 rotation, float3 referencePoint);void setNodeStatic(SceneNode* node, bool isStatic);void setNodeTransparent(SceneNode* node, bool isTransparent);// The transformation of a node relative to its parentglm::mat4 computeLocalTransformation(SceneNode const* node);glm::mat4 computeLocalTransformation(float3 const& position, float3 const& rotation, float3 const& referencePoint);// Computes the world bounds of a node from its mesh and currentTransformationMatrix, merged// with the world bounds of its children, which must be up to datevoid updateWorldBounds(SceneNode* node);void printNode(SceneNode* node);// For more details, see SceneGraph.cpp.
\ No newline at end of file
@@ -0,0 +1,65 @@
+#include "sceneSystems.hpp"
+
+void updatePathFollowers(EntityWorld &entities, ThreadPool &threadPool, float2 movement, float heading)
+{
+    entities.parallelForEachChunk<Transform, PathFollower>(threadPool,
+        [&](unsigned int count, Transform *transforms, PathFollower *followers)
+    {
+        for (unsigned int i = 0; i < count; i++)
+        {
+            float2 step = movement * followers[i].speed;
+            transforms[i].position.x += step.x;
+            transforms[i].position.z += step.y;
+            transforms[i].referencePoint.x += step.x;
+            transforms[i].referencePoint.z += step.y;
+            transforms[i].rotation.y = heading;
+        }
+    });
+}
+
+void updateWalkCycles(EntityWorld &entities, ThreadPool &threadPool, float step)
+{
+    entities.parallelForEachChunk<Transform, WalkCycle>(threadPool,
+        [&](unsigned int count, Transform *transforms, WalkCycle *cycles)
+    {
+        for (unsigned int i = 0; i < count; i++)
+        {
+            transforms[i].rotation.x += cycles[i].direction * step;
+        }
+    });
+}
+
+void bindFlatScene(EntityWorld &entities, FlatScene const &flatScene)
+{
+    entities.forEachChunk<SceneNodeRef>([&](unsigned int count, SceneNodeRef *nodes)
+    {
+        for (unsigned int i = 0; i < count; i++)
+        {
+            nodes[i].flatIndex = flatScene.find(nodes[i].node);
+        }
+    });
+}
+
+void writeTransformsToScene(EntityWorld &entities, ThreadPool &threadPool, FlatScene *flatScene)
+{
+    // Every entity has its own node, so the chunks can be written concurrently
+    entities.parallelForEachChunk<Transform, SceneNodeRef>(threadPool,
+        [&](unsigned int count, Transform *transforms, SceneNodeRef *nodes)
+    {
+        for (unsigned int i = 0; i < count; i++)
+        {
+            Transform const &transform = transforms[i];
+            if (flatScene != nullptr && nodes[i].flatIndex != noFlatNode)
+            {
+                flatScene->setLocalTransform(nodes[i].flatIndex, transform.position, transform.rotation, transform.referencePoint);
+            }
+            else
+            {
+                SceneNode *node = nodes[i].node;
+                node->position = transform.position;
+                node->rotation = transform.rotation;
+                node->referencePoint = transform.referencePoint;
+            }
+        }
+    });
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "entities.hpp"
+#include "flatScene.hpp"
+#include "floats.hpp"
+#include "sceneGraph.hpp"
+#include "threadPool.hpp"
+
+// The components of the entities of the scene, one entity per dynamic SceneNode
+
+// Local transformation, relative to the parent, see computeLocalTransformation()
+struct Transform {
+    float3 position;
+    float3 rotation;
+    float3 referencePoint;
+};
+
+// A limb swinging around the x axis while walking, forwards for a direction of 1,
+// backwards for -1
+struct WalkCycle {
+    float direction;
+};
+
+// An entity moved along the path of the scene, facing where it goes. The path itself is
+// followed by drawScene(), which gives the step of each frame to updatePathFollowers().
+struct PathFollower {
+    float speed;
+};
+
+// The node drawing the entity, and its index in the flat scene if there is one
+struct SceneNodeRef {
+    SceneNode *node;
+    FlatNodeIndex flatIndex;
+};
+
+// Moves the path followers by movement and turns them to heading
+void updatePathFollowers(EntityWorld &entities, ThreadPool &threadPool, float2 movement, float heading);
+
+// Swings the limbs by step
+void updateWalkCycles(EntityWorld &entities, ThreadPool &threadPool, float step);
+
+// Finds the flat scene nodes of the entities, once the flat scene is built
+void bindFlatScene(EntityWorld &entities, FlatScene const &flatScene);
+
+// Gives the transformations to the flat scene, or to the SceneNodes when there is none
+void writeTransformsToScene(EntityWorld &entities, ThreadPool &threadPool, FlatScene *flatScene);
@@ -0,0 +1,286 @@
+#include "shapeBatch.hpp"
+#include "glStateCache.hpp"
+#include <algorithm>
+#include <cmath>
+
+static const float pi = 3.14159265f;
+
+static uint32_t packColour(glm::vec4 const &colour)
+{
+    uint32_t r = uint32_t(std::min(std::max(colour.x, 0.0f), 1.0f) * 255.0f + 0.5f);
+    uint32_t g = uint32_t(std::min(std::max(colour.y, 0.0f), 1.0f) * 255.0f + 0.5f);
+    uint32_t b = uint32_t(std::min(std::max(colour.z, 0.0f), 1.0f) * 255.0f + 0.5f);
+    uint32_t a = uint32_t(std::min(std::max(colour.w, 0.0f), 1.0f) * 255.0f + 0.5f);
+
+    // Read as 4 normalised bytes in memory order, r first
+    return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+ShapeBatch::ShapeBatch(GpuResourceManager &resources, int viewportWidth, int viewportHeight)
+    : resources(resources), vertexArray(&resources)
+{
+    setViewport(viewportWidth, viewportHeight);
+    program = resources.createProgram("../gloom/shaders/simple.vert", "../gloom/shaders/simple.frag");
+}
+
+void ShapeBatch::setViewport(int width, int height)
+{
+    pixelsPerUnit = glm::vec2(0.5f * float(width), 0.5f * float(height));
+}
+
+unsigned int ShapeBatch::getSegmentCount(float radius, float angle) const
+{
+    // A chord spanning the angle step deviates from the circle by r * (1 - cos(step / 2))
+    float pixels = radius * std::max(pixelsPerUnit.x, pixelsPerUnit.y);
+    if (pixels <= tolerance)
+    {
+        return 3;
+    }
+    float step = 2.0f * std::acos(1.0f - tolerance / pixels);
+    unsigned int segments = unsigned(std::ceil(std::fabs(angle) / step));
+    return std::min(std::max(segments, 3u), 4096u);
+}
+
+uint32_t ShapeBatch::addVertex(glm::vec2 position, uint32_t colour)
+{
+    Vertex vertex = {position.x, position.y, colour};
+    vertices.push_back(vertex);
+    return uint32_t(vertices.size() - 1);
+}
+
+void ShapeBatch::triangle(glm::vec2 a, glm::vec2 b, glm::vec2 c, glm::vec4 const &colour)
+{
+    uint32_t packed = packColour(colour);
+    indices.push_back(addVertex(a, packed));
+    indices.push_back(addVertex(b, packed));
+    indices.push_back(addVertex(c, packed));
+    shapeCount++;
+}
+
+void ShapeBatch::circle(glm::vec2 centre, float radius, glm::vec4 const &colour)
+{
+    uint32_t packed = packColour(colour);
+    unsigned int segments = getSegmentCount(radius, 2.0f * pi);
+
+    // Rotate (x, y) by the step at every segment instead of calling sinf and cosf
+    float stepCos = std::cos(2.0f * pi / float(segments));
+    float stepSin = std::sin(2.0f * pi / float(segments));
+    float x = radius;
+    float y = 0.0f;
+
+    uint32_t centreIndex = addVertex(centre, packed);
+    uint32_t first = uint32_t(vertices.size());
+    for (unsigned int i = 0; i < segments; i++)
+    {
+        addVertex(centre + glm::vec2(x, y), packed);
+
+        float rotatedX = x * stepCos - y * stepSin;
+        y = x * stepSin + y * stepCos;
+        x = rotatedX;
+    }
+
+    // A fan around the centre, the last triangle closes on the first vertex
+    for (unsigned int i = 0; i < segments; i++)
+    {
+        indices.push_back(centreIndex);
+        indices.push_back(first + i);
+        indices.push_back(first + (i + 1) % segments);
+    }
+    shapeCount++;
+}
+
+void ShapeBatch::arc(glm::vec2 centre, float radius, float startAngle, float endAngle, float width, glm::vec4 const &colour)
+{
+    float angle = endAngle - startAngle;
+    unsigned int segments = getSegmentCount(radius, angle);
+
+    float stepCos = std::cos(angle / float(segments));
+    float stepSin = std::sin(angle / float(segments));
+    float x = radius * std::cos(startAngle);
+    float y = radius * std::sin(startAngle);
+
+    points.clear();
+    for (unsigned int i = 0; i <= segments; i++)
+    {
+        points.push_back(centre + glm::vec2(x, y));
+
+        float rotatedX = x * stepCos - y * stepSin;
+        y = x * stepSin + y * stepCos;
+        x = rotatedX;
+    }
+
+    strokePoints(width, packColour(colour), false);
+    shapeCount++;
+}
+
+void ShapeBatch::spiral(glm::vec2 centre, float radius, float turns, float width, glm::vec4 const &colour)
+{
+    // The outermost turn needs the most segments, the inner ones reuse its angle step
+    float angle = 2.0f * pi * turns;
+    unsigned int segments = getSegmentCount(radius, angle);
+
+    float stepCos = std::cos(angle / float(segments));
+    float stepSin = std::sin(angle / float(segments));
+    float x = 1.0f;
+    float y = 0.0f;
+
+    points.clear();
+    for (unsigned int i = 0; i <= segments; i++)
+    {
+        // The radius shrinks linearly with the angle
+        float currentRadius = radius * (1.0f - float(i) / float(segments));
+        points.push_back(centre + currentRadius * glm::vec2(x, y));
+
+        float rotatedX = x * stepCos - y * stepSin;
+        y = x * stepSin + y * stepCos;
+        x = rotatedX;
+    }
+
+    strokePoints(width, packColour(colour), false);
+    shapeCount++;
+}
+
+void ShapeBatch::polyline(glm::vec2 const *linePoints, size_t count, float width, glm::vec4 const &colour, bool closed)
+{
+    points.assign(linePoints, linePoints + count);
+    strokePoints(width, packColour(colour), closed);
+    shapeCount++;
+}
+
+void ShapeBatch::strokePoints(float width, uint32_t colour, bool closed)
+{
+    size_t count = points.size();
+    if (count < 2)
+    {
+        return;
+    }
+
+    // The joints are computed in pixels, so that the width is the same in every direction
+    float halfWidth = 0.5f * width;
+    uint32_t first = uint32_t(vertices.size());
+
+    for (size_t i = 0; i < count; i++)
+    {
+        bool hasPrevious = closed || i > 0;
+        bool hasNext = closed || i + 1 < count;
+        glm::vec2 previous = points[(i + count - 1) % count];
+        glm::vec2 next = points[(i + 1) % count];
+
+        // Normals of the segments on either side of the point, in pixels
+        glm::vec2 normal(0.0f, 0.0f);
+        glm::vec2 incoming(0.0f, 0.0f);
+        glm::vec2 outgoing(0.0f, 0.0f);
+        if (hasPrevious)
+        {
+            glm::vec2 direction = (points[i] - previous) * pixelsPerUnit;
+            float length = std::sqrt(direction.x * direction.x + direction.y * direction.y);
+            if (length > 0.0f)
+            {
+                incoming = glm::vec2(-direction.y, direction.x) / length;
+            }
+        }
+        if (hasNext)
+        {
+            glm::vec2 direction = (next - points[i]) * pixelsPerUnit;
+            float length = std::sqrt(direction.x * direction.x + direction.y * direction.y);
+            if (length > 0.0f)
+            {
+                outgoing = glm::vec2(-direction.y, direction.x) / length;
+            }
+        }
+
+        // Mitre joint: along the average normal, lengthened so that both edges keep their
+        // width, but limited so that sharp turns do not spike
+        float scale = 1.0f;
+        normal = incoming + outgoing;
+        float length = std::sqrt(normal.x * normal.x + normal.y * normal.y);
+        if (length > 0.0f)
+        {
+            normal = normal / length;
+            glm::vec2 edge = hasNext ? outgoing : incoming;
+            float cosine = normal.x * edge.x + normal.y * edge.y;
+            scale = 1.0f / std::max(cosine, 0.25f);
+        }
+
+        glm::vec2 offset = normal * (halfWidth * scale) / pixelsPerUnit;
+        addVertex(points[i] + offset, colour);
+        addVertex(points[i] - offset, colour);
+    }
+
+    size_t segments = closed ? count : count - 1;
+    for (size_t i = 0; i < segments; i++)
+    {
+        uint32_t a = first + uint32_t(2 * i);
+        uint32_t b = first + uint32_t(2 * ((i + 1) % count));
+        indices.push_back(a);
+        indices.push_back(a + 1);
+        indices.push_back(b);
+        indices.push_back(b);
+        indices.push_back(a + 1);
+        indices.push_back(b + 1);
+    }
+}
+
+void ShapeBatch::flush()
+{
+    stats = ShapeBatchStats();
+    stats.shapes = shapeCount;
+    stats.vertices = unsigned(vertices.size());
+    stats.indices = unsigned(indices.size());
+    shapeCount = 0;
+
+    if (indices.empty())
+    {
+        vertices.clear();
+        return;
+    }
+
+    GLsizeiptr vertexBytes = GLsizeiptr(vertices.size() * sizeof(Vertex));
+    GLsizeiptr indexBytes = GLsizeiptr(indices.size() * sizeof(uint32_t));
+
+    // Grow the stream buffer when the batch does not fit, including the alignment padding
+    GLsizeiptr needed = vertexBytes + indexBytes + 32;
+    if (needed > streamBytes)
+    {
+        if (stream)
+        {
+            resources.recordRelease(CATEGORY_STREAMING, stream->getCapacity());
+        }
+        streamBytes = std::max(needed, std::max(streamBytes * 2, GLsizeiptr(64 * 1024)));
+        stream.reset(new StreamBuffer(GL_ARRAY_BUFFER, streamBytes));
+        resources.recordAllocation(CATEGORY_STREAMING, stream->getCapacity());
+    }
+
+    stream->beginFrame();
+    GLintptr vertexOffset = stream->upload(vertices.data(), vertexBytes);
+    GLintptr indexOffset = stream->upload(indices.data(), indexBytes);
+
+    // Both streams live in the same buffer, at offsets which change every flush
+    GLStateCache &state = getGLStateCache();
+    state.useProgram(program->get());
+    state.bindVertexArray(vertexArray.get());
+    state.bindBuffer(GL_ARRAY_BUFFER, stream->get());
+    state.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, stream->get());
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) vertexOffset);
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (void *) (vertexOffset + 2 * sizeof(float)));
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+
+    // Overlays are drawn over everything, and the shapes mix both windings
+    state.disable(GL_DEPTH_TEST);
+    state.disable(GL_CULL_FACE);
+    state.enable(GL_BLEND);
+    state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    glDrawElements(GL_TRIANGLES, GLsizei(indices.size()), GL_UNSIGNED_INT, (void *) indexOffset);
+    stats.drawCalls = 1;
+
+    state.enable(GL_DEPTH_TEST);
+    state.enable(GL_CULL_FACE);
+    state.disable(GL_BLEND);
+
+    stream->endFrame();
+
+    vertices.clear();
+    indices.clear();
+}
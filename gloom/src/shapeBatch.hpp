@@ -0,0 +1,96 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "gpuResources.hpp"
+#include "streamBuffer.hpp"
+
+// Counters of the last flush
+struct ShapeBatchStats {
+    unsigned int shapes = 0;
+    unsigned int vertices = 0;
+    unsigned int indices = 0;
+    unsigned int drawCalls = 0;
+};
+
+// Immediate mode renderer for 2D shapes (overlays, debug drawing, the 2D demos).
+//
+// The shapes are re-submitted every frame. They are tessellated on the CPU into one
+// vertex and index array, streamed to the GPU and drawn with a single draw call by flush().
+// Positions are in normalised device coordinates, like those of simple.vert; widths and
+// tolerances are in pixels.
+//
+// Curves are tessellated adaptively: a circle gets just enough segments for the chords to
+// stay within the tolerance of the true curve on screen, so small shapes cost a handful of
+// vertices. The points along a curve are generated by rotating a vector with a sin/cos
+// recurrence, which only needs one sinf and one cosf per shape.
+class ShapeBatch {
+public:
+    ShapeBatch(GpuResourceManager &resources, int viewportWidth, int viewportHeight);
+
+    // Must be called when the viewport is resized, the tessellation depends on its size
+    void setViewport(int width, int height);
+
+    // Largest distance in pixels between a curve and its tessellation
+    void setTolerance(float pixels) { tolerance = pixels; }
+
+    void triangle(glm::vec2 a, glm::vec2 b, glm::vec2 c, glm::vec4 const &colour);
+    void circle(glm::vec2 centre, float radius, glm::vec4 const &colour);
+
+    // Angles in radians, counter-clockwise from the x axis
+    void arc(glm::vec2 centre, float radius, float startAngle, float endAngle, float width, glm::vec4 const &colour);
+
+    // A spiral winding inwards from radius to the centre in the given number of turns
+    void spiral(glm::vec2 centre, float radius, float turns, float width, glm::vec4 const &colour);
+
+    // Line through count points with mitred joints
+    void polyline(glm::vec2 const *points, size_t count, float width, glm::vec4 const &colour, bool closed = false);
+
+    // Draws all the shapes added since the last flush with one draw call, then forgets them
+    void flush();
+
+    ShapeBatchStats const & getStats() const { return stats; }
+
+private:
+    ShapeBatch(ShapeBatch const &) = delete;
+    ShapeBatch & operator =(ShapeBatch const &) = delete;
+
+    struct Vertex {
+        float x, y;
+        uint32_t colour;
+    };
+
+    // Number of segments keeping a circle of the given radius within the tolerance
+    unsigned int getSegmentCount(float radius, float angle) const;
+
+    uint32_t addVertex(glm::vec2 position, uint32_t colour);
+
+    // Strokes the points currently in points
+    void strokePoints(float width, uint32_t colour, bool closed);
+
+    GpuResourceManager &resources;
+
+    // Half of the viewport size: the number of pixels in one unit of device coordinates
+    glm::vec2 pixelsPerUnit;
+    float tolerance = 0.25f;
+
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+
+    // Scratch memory for the points of the curves
+    std::vector<glm::vec2> points;
+
+    // Holds both the vertices and the indices of a flush, grown when a batch does not fit
+    std::unique_ptr<StreamBuffer> stream;
+    GLsizeiptr streamBytes = 0;
+
+    GpuProgram *program;
+    GpuVertexArray vertexArray;
+
+    unsigned int shapeCount = 0;
+    ShapeBatchStats stats;
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// A bounded lock-free queue with a single producer thread and a single consumer thread.
+// The slots form a ring; the producer only writes tail and the consumer only writes head,
+// so no locking is needed and neither side ever blocks.
+template <typename T>
+class SpscQueue {
+public:
+    // The capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+        {
+            size *= 2;
+        }
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    // Called by the producer. Returns false, leaving value untouched, when the queue is full.
+    bool push(T &&value)
+    {
+        size_t currentTail = tail.load(std::memory_order_relaxed);
+        if (currentTail - head.load(std::memory_order_acquire) == slots.size())
+        {
+            return false;
+        }
+
+        slots[currentTail & mask] = std::move(value);
+        tail.store(currentTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Called by the consumer. Returns false when the queue is empty.
+    bool pop(T &value)
+    {
+        size_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        value = std::move(slots[currentHead & mask]);
+        head.store(currentHead + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Only exact when called from one of the two threads while the other one is idle
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    SpscQueue(SpscQueue const &) = delete;
+    SpscQueue & operator =(SpscQueue const &) = delete;
+
+    std::vector<T> slots;
+    size_t mask;
+
+    // Padded onto separate cache lines, each one is written by a single thread
+    char padding0[64];
+    std::atomic<size_t> head{0};
+    char padding1[64];
+    std::atomic<size_t> tail{0};
+    char padding2[64];
+};
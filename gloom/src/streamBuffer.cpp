@@ -0,0 +1,167 @@
+#include "streamBuffer.hpp"
+#include "program.hpp"
+#include "glStateCache.hpp"
+#include "debugLayer.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+StreamBuffer::StreamBuffer(GLenum target, GLsizeiptr bytesPerFrame, unsigned int framesInFlight)
+    : target(target), regionSize(bytesPerFrame), regionCount(framesInFlight)
+{
+    // The regions start at a multiple of the largest offset alignment a binding may need,
+    // so that an offset aligned within a region is aligned in the buffer too
+    GLint uniformAlignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+    GLsizeiptr regionAlignment = std::max(GLsizeiptr(uniformAlignment), GLsizeiptr(256));
+    regionSize = ((regionSize + regionAlignment - 1) / regionAlignment) * regionAlignment;
+
+    // Persistent mapping requires glBufferStorage, which is core since OpenGL 4.4
+    persistent = isGLVersionAtLeast(4, 4);
+
+    glGenBuffers(1, &bufferID);
+    getGLStateCache().bindBuffer(target, bufferID);
+
+    if (persistent)
+    {
+        // Allocate immutable storage for all the frames in flight and keep it mapped
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(target, regionSize * regionCount, nullptr, flags);
+        mappedData = (char *) glMapBufferRange(target, 0, regionSize * regionCount, flags);
+
+        fences.resize(regionCount, nullptr);
+    }
+    else
+    {
+        // Only a single region is needed, the driver takes care of the frames in flight
+        regionCount = 1;
+        glBufferData(target, regionSize, nullptr, GL_STREAM_DRAW);
+    }
+
+    setGLObjectLabel(GL_BUFFER, bufferID, "stream buffer");
+}
+
+StreamBuffer::~StreamBuffer()
+{
+    for (GLsync fence : fences)
+    {
+        if (fence != nullptr)
+        {
+            glDeleteSync(fence);
+        }
+    }
+
+    if (mappedData != nullptr)
+    {
+        getGLStateCache().bindBuffer(target, bufferID);
+        glUnmapBuffer(target);
+    }
+
+    glDeleteBuffers(1, &bufferID);
+    getGLStateCache().forgetBuffer(bufferID);
+}
+
+void StreamBuffer::beginFrame()
+{
+    writeOffset = 0;
+
+    if (!persistent)
+    {
+        // Orphan the previous storage, the GPU may still be reading from it
+        getGLStateCache().bindBuffer(target, bufferID);
+        glBufferData(target, regionSize, nullptr, GL_STREAM_DRAW);
+        return;
+    }
+
+    // Move on to the region used the longest time ago
+    currentRegion = (currentRegion + 1) % regionCount;
+
+    GLsync fence = fences.at(currentRegion);
+    if (fence == nullptr)
+    {
+        return;
+    }
+
+    // Check without blocking first, this is the common case
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED)
+    {
+        // The GPU is more than framesInFlight frames behind, we have to wait for it
+        stallCount++;
+        do
+        {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        }
+        while (status == GL_TIMEOUT_EXPIRED);
+    }
+
+    glDeleteSync(fence);
+    fences.at(currentRegion) = nullptr;
+}
+
+void StreamBuffer::endFrame()
+{
+    if (persistent)
+    {
+        // Signalled once the GPU has executed every command which reads this region
+        fences.at(currentRegion) = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+}
+
+void* StreamBuffer::map(GLsizeiptr size, GLsizeiptr alignment, GLintptr &offset)
+{
+    // Round the write position up to the requested alignment
+    GLsizeiptr alignedOffset = ((writeOffset + alignment - 1) / alignment) * alignment;
+
+    if (alignedOffset + size > regionSize)
+    {
+        if (!overflowReported)
+        {
+            fprintf(stderr, "StreamBuffer: a frame requested more than the %li bytes available per frame.\n",
+                    long(regionSize));
+            overflowReported = true;
+        }
+        offset = -1;
+        return nullptr;
+    }
+
+    writeOffset = alignedOffset + size;
+    offset = GLintptr(currentRegion) * regionSize + alignedOffset;
+
+    if (persistent)
+    {
+        return mappedData + offset;
+    }
+
+    // The storage has been orphaned this frame and we never write a range twice,
+    // so there is no need for the driver to synchronise
+    getGLStateCache().bindBuffer(target, bufferID);
+    rangeMapped = true;
+    return glMapBufferRange(target, offset, size,
+                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+}
+
+void StreamBuffer::unmap()
+{
+    if (rangeMapped)
+    {
+        getGLStateCache().bindBuffer(target, bufferID);
+        glUnmapBuffer(target);
+        rangeMapped = false;
+    }
+}
+
+GLintptr StreamBuffer::upload(const void *data, GLsizeiptr size, GLsizeiptr alignment)
+{
+    GLintptr offset;
+    void *destination = map(size, alignment, offset);
+    if (destination == nullptr)
+    {
+        return -1;
+    }
+
+    memcpy(destination, data, size_t(size));
+    unmap();
+
+    return offset;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <vector>
+
+// A ring buffer used to stream data which changes every frame (matrices, particle
+// vertices, debug lines, ...) to the GPU.
+//
+// When the context supports OpenGL 4.4 the buffer is allocated once with glBufferStorage
+// and stays mapped for its whole lifetime. It is split into one region per frame in flight,
+// and a fence placed at the end of each frame tells us when the GPU has finished reading
+// a region so that the CPU can safely overwrite it. With enough frames in flight the fence
+// is already signalled by the time we come back to a region, so the CPU never waits.
+//
+// On older contexts the buffer is orphaned with glBufferData at the start of every frame
+// instead, which lets the driver hand us fresh memory while the GPU still reads the old one.
+class StreamBuffer {
+public:
+    // Creates a buffer for the given target (GL_ARRAY_BUFFER, GL_UNIFORM_BUFFER, ...)
+    // which can hold bytesPerFrame bytes of data for each of the frames in flight.
+    StreamBuffer(GLenum target, GLsizeiptr bytesPerFrame, unsigned int framesInFlight = 3);
+    ~StreamBuffer();
+
+    // Must be called once at the start of each frame, before any allocation.
+    void beginFrame();
+
+    // Must be called once at the end of each frame, after the last draw call using the buffer.
+    void endFrame();
+
+    // Reserves size bytes in the region of the current frame and returns a pointer where
+    // the data can be written. The offset of the allocation within the buffer is stored
+    // in offset, and is what must be used when binding the buffer. It is a multiple of
+    // alignment in the whole buffer, for any alignment up to 256 bytes or to the uniform
+    // buffer offset alignment of the context.
+    // Returns nullptr if the region of the current frame is full.
+    void* map(GLsizeiptr size, GLsizeiptr alignment, GLintptr &offset);
+
+    // Must be called after the data returned by map() has been written, before drawing.
+    void unmap();
+
+    // Convenience function which copies size bytes into the buffer and returns their offset,
+    // or -1 if the region of the current frame is full.
+    GLintptr upload(const void *data, GLsizeiptr size, GLsizeiptr alignment = 16);
+
+    GLuint get()            { return bufferID; }
+    GLenum getTarget()      { return target; }
+    bool   isPersistent()   { return persistent; }
+
+    // Size of the whole buffer, all frames in flight included
+    GLsizeiptr getCapacity() { return regionSize * regionCount; }
+
+    // Number of times beginFrame() had to block because the GPU was still using a region.
+    unsigned int getStallCount() { return stallCount; }
+
+private:
+    // Disable copying and assignment
+    StreamBuffer(StreamBuffer const &) = delete;
+    StreamBuffer & operator =(StreamBuffer const &) = delete;
+
+    GLenum target;
+    GLuint bufferID = 0;
+    bool persistent = false;
+
+    GLsizeiptr regionSize;
+    unsigned int regionCount;
+    unsigned int currentRegion = 0;
+
+    // Write position within the region of the current frame
+    GLsizeiptr writeOffset = 0;
+
+    // Pointer to the start of the persistently mapped buffer (null when orphaning)
+    char *mappedData = nullptr;
+
+    // Whether a range is currently mapped through glMapBufferRange (orphaning path only)
+    bool rangeMapped = false;
+
+    // One fence for each region, placed at the end of the frame which used it
+    std::vector<GLsync> fences;
+
+    unsigned int stallCount = 0;
+    bool overflowReported = false;
+};
@@ -0,0 +1,186 @@
+#include "threadPool.hpp"
+#include <algorithm>
+#include <new>
+
+unsigned int ThreadPool::defaultWorkerCount()
+{
+    unsigned int cores = std::thread::hardware_concurrency();
+    return (cores > 1) ? (cores - 1) : 0;
+}
+
+ThreadPool::ThreadPool(unsigned int workerCount)
+    : queueStorage(new unsigned char[(workerCount + 1) * sizeof(RangeQueue) + cacheLineSize - 1]), stealCount(0)
+{
+    uintptr_t address = reinterpret_cast<uintptr_t>(queueStorage.get());
+    queues = reinterpret_cast<RangeQueue *>((address + cacheLineSize - 1) & ~uintptr_t(cacheLineSize - 1));
+    for (unsigned int i = 0; i <= workerCount; i++)
+    {
+        new (&queues[i]) RangeQueue();
+        queues[i].ranges = 0;
+    }
+
+    for (unsigned int i = 0; i < workerCount; i++)
+    {
+        // Index 0 is reserved for the thread calling parallelFor()
+        workers.emplace_back(&ThreadPool::workerLoop, this, i + 1);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobAvailable.notify_all();
+
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::parallelFor(unsigned int count,
+                             std::function<void(unsigned int, unsigned int, unsigned int)> const &function,
+                             unsigned int minRangeSize)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    // A few ranges per thread so that threads finishing early can pick up more work
+    unsigned int threadCount = getThreadCount();
+    unsigned int size = std::max(minRangeSize, (count + threadCount * 4 - 1) / (threadCount * 4));
+    unsigned int ranges = (count + size - 1) / size;
+
+    // Not worth waking up the workers
+    if (ranges == 1 || workers.empty())
+    {
+        function(0, count, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &function;
+        jobCount = count;
+        rangeSize = size;
+        rangeCount = ranges;
+
+        // Contiguous ranges for each thread, which keeps neighbouring elements on one core
+        for (unsigned int thread = 0; thread < threadCount; thread++)
+        {
+            uint64_t first = uint64_t(ranges) * thread / threadCount;
+            uint64_t end = uint64_t(ranges) * (thread + 1) / threadCount;
+            queues[thread].ranges = (first << 32) | end;
+        }
+
+        activeWorkers = unsigned(workers.size());
+        jobGeneration++;
+    }
+    jobAvailable.notify_all();
+
+    runRanges(0);
+
+    // Wait until no worker is still looking at the job
+    std::unique_lock<std::mutex> lock(mutex);
+    jobFinished.wait(lock, [this] { return activeWorkers == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::workerLoop(unsigned int threadIndex)
+{
+    unsigned long lastGeneration = 0;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            jobAvailable.wait(lock, [&] { return stopping || jobGeneration != lastGeneration; });
+            if (stopping)
+            {
+                return;
+            }
+            lastGeneration = jobGeneration;
+        }
+
+        runRanges(threadIndex);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        activeWorkers--;
+        if (activeWorkers == 0)
+        {
+            jobFinished.notify_one();
+        }
+    }
+}
+
+void ThreadPool::runRanges(unsigned int threadIndex)
+{
+    // The stolen ranges may be stolen again before they are run, so the thread only stops
+    // once no other thread has any left
+    unsigned int range;
+    do
+    {
+        while (popRange(threadIndex, range))
+        {
+            unsigned int begin = range * rangeSize;
+            unsigned int end = std::min(jobCount, begin + rangeSize);
+            (*job)(begin, end, threadIndex);
+        }
+    }
+    while (stealRanges(threadIndex));
+}
+
+bool ThreadPool::popRange(unsigned int threadIndex, unsigned int &range)
+{
+    std::atomic<uint64_t> &queue = queues[threadIndex].ranges;
+    uint64_t ranges = queue.load();
+    while (true)
+    {
+        uint64_t first = ranges >> 32;
+        uint64_t end = ranges & 0xffffffffu;
+        if (first >= end)
+        {
+            return false;
+        }
+
+        // Fails when a thief took some ranges in the meantime, ranges is then reloaded
+        if (queue.compare_exchange_weak(ranges, ((first + 1) << 32) | end))
+        {
+            range = unsigned(first);
+            return true;
+        }
+    }
+}
+
+bool ThreadPool::stealRanges(unsigned int threadIndex)
+{
+    unsigned int threadCount = getThreadCount();
+    for (unsigned int offset = 1; offset < threadCount; offset++)
+    {
+        std::atomic<uint64_t> &victim = queues[(threadIndex + offset) % threadCount].ranges;
+        uint64_t ranges = victim.load();
+        while (true)
+        {
+            uint64_t first = ranges >> 32;
+            uint64_t end = ranges & 0xffffffffu;
+            if (first >= end)
+            {
+                break;
+            }
+
+            // The victim keeps the first half, which it is about to run
+            uint64_t middle = end - (end - first + 1) / 2;
+            if (victim.compare_exchange_weak(ranges, (first << 32) | middle))
+            {
+                // Only the thread itself adds to its queue, and it is empty
+                queues[threadIndex].ranges = (middle << 32) | end;
+                stealCount++;
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads used to split per-frame CPU work (draw list generation,
+// culling, ...) across all cores.
+//
+// The ranges of a parallelFor() are dealt out evenly to the threads up front. Each thread
+// runs its own ranges in order, and once out of work steals the second half of the ranges
+// left to another thread. Threads mostly touch their own queue, and uneven ranges still
+// end up spread over all the threads.
+class ThreadPool {
+public:
+    // Creates workerCount threads. The thread calling parallelFor() also takes part in
+    // the work, so a pool without workers runs everything on the calling thread.
+    explicit ThreadPool(unsigned int workerCount = defaultWorkerCount());
+    ~ThreadPool();
+
+    // Number of threads taking part in a parallelFor(), including the calling thread.
+    // Thread indices passed to the callbacks are in [0, getThreadCount()).
+    unsigned int getThreadCount() const { return unsigned(workers.size()) + 1; }
+
+    // Splits [0, count) into ranges of at least minRangeSize elements and calls
+    // function(begin, end, threadIndex) for each of them. Returns once every range is done.
+    void parallelFor(unsigned int count,
+                     std::function<void(unsigned int, unsigned int, unsigned int)> const &function,
+                     unsigned int minRangeSize = 64);
+
+    // One worker for each core, except the one running the main thread
+    static unsigned int defaultWorkerCount();
+
+    // Number of times a thread took ranges from another one, since the pool was created
+    unsigned long getStealCount() const { return stealCount; }
+
+private:
+    ThreadPool(ThreadPool const &) = delete;
+    ThreadPool & operator =(ThreadPool const &) = delete;
+
+    void workerLoop(unsigned int threadIndex);
+
+    // Runs the ranges of the thread, then the ranges stolen from the others, until none is left
+    void runRanges(unsigned int threadIndex);
+
+    // Takes the first range of the queue of a thread, returns false if it is empty
+    bool popRange(unsigned int threadIndex, unsigned int &range);
+
+    // Moves the second half of the ranges of another thread into the queue of the thread
+    bool stealRanges(unsigned int threadIndex);
+
+    // The ranges [first, end) of a thread packed as (first << 32) | end, so that the owner
+    // and the thieves update them with a single compare and swap. Each queue fills its own
+    // cache line, so that the threads do not slow each other down.
+    static const size_t cacheLineSize = 64;
+    struct alignas(cacheLineSize) RangeQueue {
+        std::atomic<uint64_t> ranges;
+    };
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::condition_variable jobFinished;
+
+    // The job currently being executed
+    std::function<void(unsigned int, unsigned int, unsigned int)> const *job = nullptr;
+    unsigned int jobCount = 0;
+    unsigned int rangeSize = 0;
+    unsigned long jobGeneration = 0;
+    // new only aligns to 8 or 16 bytes before C++17, the queues are placed in a larger
+    // buffer at the first cache line boundary
+    std::unique_ptr<unsigned char[]> queueStorage;
+    RangeQueue *queues;
+    unsigned int rangeCount = 0;
+    std::atomic<unsigned long> stealCount;
+    unsigned int activeWorkers = 0;
+
+    bool stopping = false;
+};
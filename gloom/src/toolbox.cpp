@@ -1,6 +1,8 @@
 #include <iostream>
 #include <chrono>
 #include <fstream>
+#include <cstdint>
+#include <limits>
 #include "toolbox.hpp"
 
 Mesh generateChessboard(
@@ -14,15 +16,25 @@ Mesh generateChessboard(
     std::vector<float4> vertexColours;
     std::vector<unsigned int> indices;
 
-    unsigned int tileCount = width * height;
+    // Every tile adds 4 vertices, which must stay addressable by 32 bit indices.
+    // Larger boards are drawn by the procedural terrain, which needs no vertex data.
+    uint64_t tileCount = uint64_t(width) * uint64_t(height);
+    if(tileCount > std::numeric_limits<unsigned int>::max() / 4)
+    {
+        std::cerr << "A " << width << "x" << height << " chessboard does not fit in 32 bit indices, "
+                  << "use the procedural terrain instead." << std::endl;
+        Mesh empty("Chessboard terrain");
+        empty.hasNormals = false;
+        return empty;
+    }
 
     vertices.reserve(4 * tileCount);
     vertexColours.reserve(4 * tileCount);
     indices.reserve(6 * tileCount);
 
-    for(int x = 0; x < width; x++)
+    for(unsigned int x = 0; x < width; x++)
     {
-        for(int y = 0; y < height; y++)
+        for(unsigned int y = 0; y < height; y++)
         {
             float leftX = (float(x) - 0.5f) * tileWidth;
             float rightX = (float(x) + 0.5f) * tileWidth;
@@ -67,6 +79,7 @@ Mesh generateChessboard(
     mesh.colours = vertexColours;
     mesh.hasNormals = false;
     mesh.indices = indices;
+    mesh.computeBounds();
 
     return mesh;
 }
@@ -191,4 +204,28 @@ float *toFloat(std::vector<float4> v)
         c.push_back(v.at(i).w);
     }
     return &c[0];
-}
\ No newline at end of file
+}
+
+void extractFrustumPlanes(glm::mat4 const &viewProjection, glm::vec4 planes[6])
+{
+    // Rows of the matrix, glm matrices are stored column major
+    glm::vec4 rows[4];
+    for(int row = 0; row < 4; row++)
+    {
+        rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+    }
+
+    planes[0] = rows[3] + rows[0];
+    planes[1] = rows[3] - rows[0];
+    planes[2] = rows[3] + rows[1];
+    planes[3] = rows[3] - rows[1];
+    planes[4] = rows[3] + rows[2];
+    planes[5] = rows[3] - rows[2];
+
+    // Normalise the planes so that the distances are in world units
+    for(int i = 0; i < 6; i++)
+    {
+        float length = std::sqrt(planes[i].x * planes[i].x + planes[i].y * planes[i].y + planes[i].z * planes[i].z);
+        planes[i] = planes[i] / length;
+    }
+}
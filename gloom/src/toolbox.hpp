@@ -6,6 +6,7 @@
 #include <vector>
 
 // Generates a mesh containing a 3D object which looks like a chessboard.
+// Returns an empty mesh when the board has too many tiles for 32 bit indices.
 Mesh generateChessboard(unsigned int width, unsigned int height, float tileWidth, float4 tileColour1, float4 tileColour2);
 
 // Returns a random float between 0 and 1
@@ -45,4 +46,9 @@ public:
     // If the end has been reached, it resets to the first waypoint.
     // Should be called if hasWaypointBeenReached() evaluates to true.
     void advanceToNextWaypoint();
-};
\ No newline at end of file
+};
+
+// Extracts the six planes of the view frustum from a view-projection matrix, in the order
+// left, right, bottom, top, near, far. Each plane is stored as (normal, distance) with the
+// normal pointing inside the frustum, so a point p is inside when dot(normal, p) + distance >= 0.
+void extractFrustumPlanes(glm::mat4 const &viewProjection, glm::vec4 planes[6]);
@@ -0,0 +1,178 @@
+#include "transparencyPass.hpp"
+#include "debugLayer.hpp"
+#include <cstdio>
+
+// Finds a depth format which can receive a blit of the depth of the default framebuffer
+static GLenum getDefaultDepthFormat()
+{
+    GLint depthBits = 0;
+    GLint stencilBits = 0;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depthBits);
+    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_STENCIL, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencilBits);
+
+    if (stencilBits > 0)
+    {
+        return (depthBits > 24) ? GL_DEPTH32F_STENCIL8 : GL_DEPTH24_STENCIL8;
+    }
+    if (depthBits > 24)
+    {
+        return GL_DEPTH_COMPONENT32F;
+    }
+    return (depthBits > 16) ? GL_DEPTH_COMPONENT24 : GL_DEPTH_COMPONENT16;
+}
+
+TransparencyPass::TransparencyPass(GpuResourceManager &resources, int width, int height, GLenum depthFormat)
+    : resources(resources), width(width), height(height), depthFormat(depthFormat), emptyVertexArray(&resources)
+{
+    if (depthFormat == GL_NONE)
+    {
+        this->depthFormat = getDefaultDepthFormat();
+    }
+
+    compositeProgram = resources.createProgram("../gloom/shaders/fullscreenTriangle.vert",
+                                               "../gloom/shaders/transparencyComposite.frag");
+
+    // The samplers never change, they are set once
+    GLStateCache &state = getGLStateCache();
+    state.useProgram(compositeProgram->get());
+    state.uniform1i(glGetUniformLocation(compositeProgram->get(), "accumulationTexture"), 0);
+    state.uniform1i(glGetUniformLocation(compositeProgram->get(), "weightTexture"), 1);
+
+    createTargets();
+}
+
+TransparencyPass::~TransparencyPass()
+{
+    releaseTargets();
+}
+
+void TransparencyPass::resize(int newWidth, int newHeight)
+{
+    if (newWidth == width && newHeight == height)
+    {
+        return;
+    }
+
+    width = newWidth;
+    height = newHeight;
+    releaseTargets();
+    createTargets();
+}
+
+static GLuint createTarget(GLenum internalFormat, GLenum format, int width, int height)
+{
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    getGLStateCache().bindTexture(0, GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_HALF_FLOAT, nullptr);
+
+    // The composite shader reads single texels, without filtering
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+void TransparencyPass::createTargets()
+{
+    accumulationTexture = createTarget(GL_RGBA16F, GL_RGBA, width, height);
+    weightTexture = createTarget(GL_R16F, GL_RED, width, height);
+
+    glGenRenderbuffers(1, &depthRenderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, depthFormat, width, height);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumulationTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, weightTexture, 0);
+
+    bool hasStencil = (depthFormat == GL_DEPTH24_STENCIL8 || depthFormat == GL_DEPTH32F_STENCIL8);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, hasStencil ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, depthRenderbuffer);
+
+    GLenum drawBuffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, drawBuffers);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        fprintf(stderr, "The transparency targets are incomplete, translucent geometry will not be visible\n");
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    setGLObjectLabel(GL_TEXTURE, accumulationTexture, "transparency accumulation");
+    setGLObjectLabel(GL_TEXTURE, weightTexture, "transparency weights");
+    setGLObjectLabel(GL_FRAMEBUFFER, framebuffer, "transparency targets");
+
+    // 8 bytes of accumulation, 2 of weight and 4 of depth per pixel
+    targetBytes = (long long) width * height * (8 + 2 + 4);
+    resources.recordAllocation(CATEGORY_TEXTURE, targetBytes);
+}
+
+void TransparencyPass::releaseTargets()
+{
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteRenderbuffers(1, &depthRenderbuffer);
+
+    GLuint textures[] = {accumulationTexture, weightTexture};
+    glDeleteTextures(2, textures);
+    getGLStateCache().forgetTexture(accumulationTexture);
+    getGLStateCache().forgetTexture(weightTexture);
+
+    resources.recordRelease(CATEGORY_TEXTURE, targetBytes);
+    targetBytes = 0;
+}
+
+void TransparencyPass::begin(GLuint sourceFramebuffer)
+{
+    // The translucent fragments hidden by opaque geometry must be rejected, so the opaque
+    // depth is copied. The default framebuffer may be multisampled, the blit resolves it.
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, sourceFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+    // glClearBuffer honours the colour mask, which the depth pre-pass may have left off
+    getGLStateCache().colorMask(GL_TRUE);
+
+    const GLfloat accumulationClear[] = {0.0f, 0.0f, 0.0f, 1.0f};
+    const GLfloat weightClear[] = {0.0f, 0.0f, 0.0f, 0.0f};
+    glClearBufferfv(GL_COLOR, 0, accumulationClear);
+    glClearBufferfv(GL_COLOR, 1, weightClear);
+}
+
+void TransparencyPass::composite(GLuint targetFramebuffer)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+
+    GLStateCache &state = getGLStateCache();
+    state.disable(GL_DEPTH_TEST);
+    state.enable(GL_BLEND);
+    state.blendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+    state.colorMask(GL_TRUE);
+
+    state.useProgram(compositeProgram->get());
+    state.bindTexture(0, GL_TEXTURE_2D, accumulationTexture);
+    state.bindTexture(1, GL_TEXTURE_2D, weightTexture);
+    state.bindVertexArray(emptyVertexArray.get());
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    // Leave the state expected by the code drawing afterwards
+    state.enable(GL_DEPTH_TEST);
+    state.disable(GL_BLEND);
+    state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+void applyTransparencyAccumulationState(GLStateCache &state)
+{
+    state.enable(GL_DEPTH_TEST);
+    state.depthFunc(GL_LEQUAL);
+    state.depthMask(GL_FALSE);
+    state.colorMask(GL_TRUE);
+
+    state.enable(GL_BLEND);
+    state.blendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <glad/glad.h>
+#include "gpuResources.hpp"
+#include "glStateCache.hpp"
+
+// Weighted blended order-independent transparency (McGuire and Bavoil, 2013).
+//
+// Instead of sorting the translucent geometry, every fragment adds its premultiplied colour,
+// weighted by its alpha and depth, to an accumulation target, and multiplies a revealage
+// value by (1 - alpha). Both operations are commutative, so the draws can be issued in any
+// order, in a single geometry pass. The composite step divides the accumulated colour by
+// the sum of the weights and blends the average over the opaque image by the revealage.
+//
+// Per-target blend functions (glBlendFunci) need OpenGL 4.0, so the targets are laid out
+// for a single glBlendFuncSeparate call, which is available on our 3.3 context:
+//    target 0, RGBA16F: weighted colour sum in rgb (ONE, ONE), revealage in alpha (ZERO, ONE_MINUS_SRC_ALPHA)
+//    target 1, R16F:    sum of the weights (ONE, ONE)
+class TransparencyPass {
+public:
+    // Creates the targets for a framebuffer of the given size. depthFormat must be the format
+    // of the depth blitted in begin(); GL_NONE copies the format of the default framebuffer.
+    TransparencyPass(GpuResourceManager &resources, int width, int height, GLenum depthFormat = GL_NONE);
+    ~TransparencyPass();
+
+    // Recreates the targets, must be called when the framebuffer is resized
+    void resize(int width, int height);
+
+    // Copies the depth of the opaque geometry from sourceFramebuffer, binds the targets and
+    // clears them. The translucent draws which follow must be made with the accumulation
+    // state (see applyTransparencyAccumulationState()) and transparencyAccumulate.frag.
+    void begin(GLuint sourceFramebuffer = 0);
+
+    // Blends the translucent layers over the colour of targetFramebuffer and leaves it bound.
+    // Only the pixels covered by a translucent fragment are touched.
+    void composite(GLuint targetFramebuffer = 0);
+
+private:
+    TransparencyPass(TransparencyPass const &) = delete;
+    TransparencyPass & operator =(TransparencyPass const &) = delete;
+
+    void createTargets();
+    void releaseTargets();
+
+    GpuResourceManager &resources;
+    int width;
+    int height;
+
+    GLuint framebuffer = 0;
+    GLuint accumulationTexture = 0;
+    GLuint weightTexture = 0;
+    GLuint depthRenderbuffer = 0;
+
+    // Must match the format of the blitted depth buffer
+    GLenum depthFormat;
+    long long targetBytes = 0;
+
+    GpuProgram *compositeProgram;
+
+    // Core profiles need a bound VAO even for a draw without attributes
+    GpuVertexArray emptyVertexArray;
+};
+
+// Sets the depth and blending state of the accumulation draws: the depth is tested against
+// the opaque geometry but not written, and both targets are blended as described above
+void applyTransparencyAccumulationState(GLStateCache &state);
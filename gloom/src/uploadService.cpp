@@ -0,0 +1,192 @@
+#include "uploadService.hpp"
+#include <chrono>
+#include <cstdio>
+
+UploadService::UploadService(GLFWwindow *mainWindow, GpuResourceManager &resources, unsigned int queueCapacity)
+    : resources(resources), requests(queueCapacity), completed(queueCapacity), running(true), uploadedBytes(0)
+{
+    // A hidden window is the only portable way to get a second context from GLFW.
+    // It inherits the context version hints used for the main window.
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    uploadWindow = glfwCreateWindow(1, 1, "upload", nullptr, mainWindow);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+
+    if (uploadWindow == nullptr)
+    {
+        fprintf(stderr, "Could not create the upload context, meshes will be uploaded on the render thread\n");
+        return;
+    }
+
+    thread = std::thread(&UploadService::run, this);
+}
+
+UploadService::~UploadService()
+{
+    if (thread.joinable())
+    {
+        running = false;
+        wake.notify_one();
+        thread.join();
+    }
+
+    // The buffers are shared, so those of the jobs never handed over can be deleted here
+    std::unique_ptr<UploadJob> job;
+    while (completed.pop(job))
+    {
+        discard(*job);
+    }
+    for (std::unique_ptr<UploadJob> &waitingJob : waiting)
+    {
+        discard(*waitingJob);
+    }
+
+    if (uploadWindow != nullptr)
+    {
+        glfwDestroyWindow(uploadWindow);
+    }
+}
+
+void UploadService::uploadMesh(Mesh const &mesh, std::function<void(GpuMesh *)> onReady)
+{
+    stats.requested++;
+
+    // Without an upload context the mesh is uploaded right away
+    if (uploadWindow == nullptr)
+    {
+        onReady(resources.createMesh(mesh));
+        stats.completed++;
+        return;
+    }
+
+    std::unique_ptr<UploadJob> job(new UploadJob(mesh));
+    job->onReady = onReady;
+
+    // Keep the request order: once a job overflowed, the next ones wait behind it
+    if (!overflow.empty() || !requests.push(std::move(job)))
+    {
+        overflow.push_back(std::move(job));
+        return;
+    }
+
+    wake.notify_one();
+}
+
+void UploadService::poll()
+{
+    // Retry the requests which did not fit in the queue
+    size_t pushed = 0;
+    while (pushed < overflow.size() && requests.push(std::move(overflow[pushed])))
+    {
+        pushed++;
+    }
+    if (pushed > 0)
+    {
+        overflow.erase(overflow.begin(), overflow.begin() + pushed);
+        wake.notify_one();
+    }
+
+    std::unique_ptr<UploadJob> job;
+    while (completed.pop(job))
+    {
+        waiting.push_back(std::move(job));
+    }
+
+    // Hand over the meshes whose uploads have completed, without ever waiting for the GPU
+    for (size_t i = 0; i < waiting.size();)
+    {
+        UploadJob &ready = *waiting[i];
+        GLenum status = glClientWaitSync(ready.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        {
+            i++;
+            continue;
+        }
+
+        glDeleteSync(ready.fence);
+
+        // Binding the buffers while creating the VAO makes their new content visible to this context
+        GpuMesh *mesh = resources.adoptMesh(ready.mesh, ready.vertexBuffer, ready.colourBuffer, ready.indexBuffer);
+        ready.onReady(mesh);
+        stats.completed++;
+
+        waiting.erase(waiting.begin() + i);
+    }
+}
+
+UploadStats UploadService::getStats() const
+{
+    UploadStats current = stats;
+    current.uploadedBytes = uploadedBytes.load();
+    return current;
+}
+
+void UploadService::run()
+{
+    glfwMakeContextCurrent(uploadWindow);
+
+    while (running)
+    {
+        std::unique_ptr<UploadJob> job;
+        if (!requests.pop(job))
+        {
+            // The timeout covers a request pushed between the check and the wait
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wake.wait_for(lock, std::chrono::milliseconds(10), [this] { return !running || !requests.empty(); });
+            continue;
+        }
+
+        upload(*job);
+
+        // The render thread drains the queue every frame, so it is never full for long
+        while (running && !completed.push(std::move(job)))
+        {
+            std::this_thread::yield();
+        }
+        if (job)
+        {
+            discard(*job);
+        }
+    }
+
+    glfwMakeContextCurrent(nullptr);
+}
+
+void UploadService::upload(UploadJob &job)
+{
+    // The state cache belongs to the render thread, so the plain GL calls are used here.
+    // The copy target is used as binding an index buffer requires a VAO.
+    GLsizeiptr vertexBytes = job.mesh.vertices.size() * sizeof(float4);
+    GLsizeiptr colourBytes = job.mesh.colours.size() * sizeof(float4);
+    GLsizeiptr indexBytes = job.mesh.indices.size() * sizeof(unsigned int);
+
+    glGenBuffers(1, &job.vertexBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, job.vertexBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, vertexBytes, job.mesh.vertices.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &job.colourBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, job.colourBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, colourBytes, job.mesh.colours.data(), GL_STATIC_DRAW);
+
+    glGenBuffers(1, &job.indexBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, job.indexBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, indexBytes, job.mesh.indices.data(), GL_STATIC_DRAW);
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    // The fence has to reach the GPU before another context can see it signalled
+    job.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    uploadedBytes += vertexBytes + colourBytes + indexBytes;
+}
+
+void UploadService::discard(UploadJob &job)
+{
+    if (job.fence != nullptr)
+    {
+        glDeleteSync(job.fence);
+    }
+
+    GLuint buffers[] = {job.vertexBuffer, job.colourBuffer, job.indexBuffer};
+    glDeleteBuffers(3, buffers);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "gpuResources.hpp"
+#include "mesh.hpp"
+#include "spscQueue.hpp"
+
+// Counters of an upload service, since it was created
+struct UploadStats {
+    unsigned int requested = 0;
+    unsigned int completed = 0;
+    long long uploadedBytes = 0;
+};
+
+// Uploads meshes to the GPU on a background thread, so that streaming new assets never
+// stalls the render thread.
+//
+// The service owns a hidden window whose context shares its objects with the main window.
+// Finished meshes are sent to the upload thread through a lock-free queue; the thread
+// creates their buffers and places a fence after the uploads. Once per frame the render
+// thread polls the fences without waiting, and hands the meshes whose fence is signalled
+// over to the resource manager. The VAOs are created at that point on the render thread,
+// as vertex array objects are not shared between contexts.
+//
+// Must be created, polled and destroyed on the thread owning the main window's context.
+class UploadService {
+public:
+    UploadService(GLFWwindow *mainWindow, GpuResourceManager &resources, unsigned int queueCapacity = 256);
+    ~UploadService();
+
+    // Queues a copy of the mesh for upload. onReady is called by poll(), on the render thread,
+    // with the mesh once it can be drawn.
+    void uploadMesh(Mesh const &mesh, std::function<void(GpuMesh *)> onReady);
+
+    // Must be called once per frame on the render thread
+    void poll();
+
+    // Number of meshes requested but not handed over yet
+    unsigned int getPendingCount() const { return stats.requested - stats.completed; }
+
+    UploadStats getStats() const;
+
+private:
+    UploadService(UploadService const &) = delete;
+    UploadService & operator =(UploadService const &) = delete;
+
+    struct UploadJob {
+        explicit UploadJob(Mesh const &mesh) : mesh(mesh) {}
+
+        Mesh mesh;
+        std::function<void(GpuMesh *)> onReady;
+
+        // Filled in by the upload thread
+        GLuint vertexBuffer = 0;
+        GLuint colourBuffer = 0;
+        GLuint indexBuffer = 0;
+        GLsync fence = nullptr;
+    };
+
+    // Body of the upload thread
+    void run();
+    void upload(UploadJob &job);
+
+    // Deletes the objects of a job which was never handed over
+    static void discard(UploadJob &job);
+
+    GLFWwindow *uploadWindow = nullptr;
+    GpuResourceManager &resources;
+
+    // Render thread to upload thread
+    SpscQueue<std::unique_ptr<UploadJob>> requests;
+
+    // Upload thread to render thread
+    SpscQueue<std::unique_ptr<UploadJob>> completed;
+
+    // Owned by the render thread: jobs which did not fit in the request queue yet,
+    // and uploaded jobs whose fence is not signalled yet
+    std::vector<std::unique_ptr<UploadJob>> overflow;
+    std::vector<std::unique_ptr<UploadJob>> waiting;
+
+    // Only used to put the upload thread to sleep when there is nothing to do
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+
+    std::atomic<bool> running;
+    std::atomic<long long> uploadedBytes;
+    UploadStats stats;
+
+    std::thread thread;
+};